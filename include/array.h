@@ -0,0 +1,59 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include "parser.h"
+#include <mpfr.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARRAY_DOUBLE_MAX_PRECISION 53 // at or below this precision vectors are plain doubles
+#define ARRAY_ALIGNMENT 64
+#define ARRAY_POOL_LIMIT 32 // released arrays kept for reuse
+#define ARRAY_PRINT_LIMIT 16
+
+typedef enum ArrayStorage{
+    ARRAY_DOUBLE, // contiguous doubles, loops are vectorized by the compiler
+    ARRAY_MPFR    // mpfr_t headers followed by their limbs in one slab
+} ArrayStorage;
+
+typedef struct Array{
+    union {
+        double* d;
+        mpfr_t* m;
+    } data;
+    struct Array* next_free; // pool link
+    size_t bytes;
+    mpfr_prec_t precision;
+    uint32_t len;
+    uint32_t rows, cols; // matrix shape (row-major), rows == 0 for a plain vector
+    uint32_t refs;
+    ArrayStorage storage;
+} Array;
+
+Array* array_create(uint32_t len, mpfr_prec_t precision);
+Array* array_create_matrix(uint32_t rows, uint32_t cols, mpfr_prec_t precision);
+// New reference to 'array' when its storage already suits 'precision', otherwise a converted copy.
+Array* array_coerce(Array* array, mpfr_prec_t precision);
+void array_release(Array* array);
+void array_pool_free();
+
+void array_get(const Array* array, uint32_t i, mpfr_t rop);
+void array_set(Array* array, uint32_t i, const mpfr_t op);
+void array_copy(Array* dst, uint32_t dst_offset, const Array* src, uint32_t src_offset, uint32_t count);
+
+// Element-wise arithmetic, 'op' is TOK_ADD, TOK_SUB, TOK_MULT, TOK_DIVIDE,
+// TOK_MODULE or TOK_POWER. These consume the references to their vector
+// operands and return a new one, an operand nobody else holds becomes the result.
+Array* array_binary(TokenType op, Array* a, Array* b, mpfr_prec_t precision);
+Array* array_scalar(TokenType op, Array* a, const mpfr_t s, bool scalar_left, mpfr_prec_t precision);
+Array* array_negate(Array* a, mpfr_prec_t precision);
+Array* array_map(uint16_t builtin, Array* a, mpfr_prec_t precision);
+
+void array_sum(const Array* a, mpfr_t rop);
+bool array_dot(const Array* a, const Array* b, mpfr_t rop);
+
+void array_print(const Array* array, const char* label);
+const char* array_shape(const Array* array, char* buffer, size_t size);
+
+#endif
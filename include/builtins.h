@@ -0,0 +1,81 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <mpfr.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BUILTIN_MAX_ARITY 2
+#define BUILTIN_LOOKUP_SIZE 128 // power of two, > 2x the number of names
+
+typedef enum BuiltinKind{
+    BUILTIN_FUNCTION,
+    BUILTIN_CONSTANT,
+    BUILTIN_ARRAY // takes vectors or matrices, evaluated by the parser
+} BuiltinKind;
+
+typedef enum ArrayBuiltin{
+    ARRAY_BUILTIN_SUM,
+    ARRAY_BUILTIN_DOT,
+    ARRAY_BUILTIN_LEN,
+    ARRAY_BUILTIN_TRANSPOSE,
+    ARRAY_BUILTIN_SOLVE,
+    ARRAY_BUILTIN_DET
+} ArrayBuiltin;
+
+// How the running time of a function grows, for builtin_estimate()
+typedef enum BuiltinCost{
+    BUILTIN_COST_CHEAP,      // a few multiplications at the precision
+    BUILTIN_COST_ELEMENTARY, // exp, log, atan...: about p log^2 p
+    BUILTIN_COST_PERIODIC,   // the same at p plus the argument's exponent (reduction mod pi)
+    BUILTIN_COST_SERIES,     // lngamma, digamma: about p^3 (Bernoulli numbers)
+    BUILTIN_COST_GAMMA,      // the same, but exact factorials are cheap
+    BUILTIN_COST_ZETA        // about p^3, less for large arguments
+} BuiltinCost;
+
+typedef int (*BuiltinFunc1)(mpfr_ptr, mpfr_srcptr, mpfr_rnd_t);
+typedef int (*BuiltinFunc2)(mpfr_ptr, mpfr_srcptr, mpfr_srcptr, mpfr_rnd_t);
+typedef int (*BuiltinConst)(mpfr_ptr, mpfr_rnd_t);
+typedef double (*BuiltinDouble)(double);
+
+// One row per built-in name. The lexer stores the row index in Token.id and
+// the evaluator dispatches on it, no string compare after tokenize().
+typedef struct Builtin{
+    const char* name;
+    BuiltinKind kind;
+    uint8_t arity;
+    union {
+        BuiltinFunc1 f1;
+        BuiltinFunc2 f2;
+        BuiltinConst constant;
+        ArrayBuiltin array;
+    } fn;
+    BuiltinDouble f64; // libm counterpart used on double vectors, NULL -> MPFR at 53 bits
+    BuiltinCost cost;
+    float growth;      // log2 of the result per unit of argument for exponentials, 0 otherwise
+} Builtin;
+
+// Rough figures for a call before it is made, so -limit can refuse it up front
+typedef struct BuiltinEstimate{
+    double exponent; // |binary exponent| of the result, 0 when not far past the arguments'
+    double ns;       // running time on the high side, 0 when cheap
+} BuiltinEstimate;
+
+extern const Builtin builtinTable[];
+extern const uint16_t builtinCount;
+
+void builtins_init();
+void builtins_free_cache();
+// Returns the row index or -1 when 'name' is not a built-in.
+int builtin_lookup(const char* name, uint8_t len);
+
+// Returns false when the result is NaN although no argument was (domain error).
+bool builtin_call(uint16_t id, mpfr_t rop, mpfr_t* const* args);
+void builtin_constant(uint16_t id, mpfr_t rop);
+// x^y, integer exponents go through binary exponentiation instead of exp/log.
+void builtin_power(mpfr_ptr rop, mpfr_srcptr x, mpfr_srcptr y);
+
+BuiltinEstimate builtin_estimate(uint16_t id, mpfr_t* const* args, mpfr_prec_t precision);
+BuiltinEstimate builtin_power_estimate(mpfr_srcptr x, mpfr_srcptr y, mpfr_prec_t precision);
+
+#endif
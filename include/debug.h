@@ -10,11 +10,23 @@
 
 // ==================== MACROS GLOBAL ====================
 
+// Logging threads run concurrently (--server, --pipeline, the task pool), so
+// the time is formatted from a local struct tm, never localtime()'s static one.
+#define LOG_TIME(timestr) do { \
+    time_t now = time(NULL); \
+    struct tm now_tm; \
+    strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime_r(&now, &now_tm)); \
+} while(0)
+
+// Per thread, NULL for the process streams. When set (a server session) errors
+// and warnings are written there as the bare message, without the time and
+// source prefix. Defined in server.c.
+extern _Thread_local FILE* errorOutput;
+
 #ifdef DEBUG
 #define DEBUG_PRINT(fmt, ...) do { \
-    time_t now = time(NULL); \
     char timestr[20]; \
-    strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&now)); \
+    LOG_TIME(timestr); \
     printf("\033[36m[DEBUG] [%s] [%s:%d]:\033[0m " fmt, \
            timestr, __FILE__, __LINE__, ##__VA_ARGS__); \
 } while(0)
@@ -41,9 +53,12 @@
 
 #ifdef ERROR_LOGGING
 #define ERROR_PRINT(fmt, ...) do { \
-    time_t now = time(NULL); \
+    if (errorOutput) { \
+        fprintf(errorOutput, fmt, ##__VA_ARGS__); \
+        break; \
+    } \
     char timestr[20]; \
-    strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&now)); \
+    LOG_TIME(timestr); \
     fprintf(stderr, "\033[31m[ERROR] [%s] [%s:%d in %s]:\033[0m " fmt, \
             timestr, __FILE__, __LINE__, __func__, ##__VA_ARGS__); \
 } while(0)
@@ -68,9 +83,12 @@
 
 #ifdef WARNING_LOGGING
 #define WARNING_PRINT(fmt, ...) do { \
-    time_t now = time(NULL); \
+    if (errorOutput) { \
+        fprintf(errorOutput, fmt, ##__VA_ARGS__); \
+        break; \
+    } \
     char timestr[20]; \
-    strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&now)); \
+    LOG_TIME(timestr); \
     printf("\033[33m[WARNING] [%s] [%s:%d]:\033[0m " fmt, \
            timestr, __FILE__, __LINE__, ##__VA_ARGS__); \
 } while(0)
@@ -167,15 +185,22 @@
 #ifdef DEBUG
 #define DEBUG_EVAL(fmt, ...) DEBUG_PRINT("[EVAL] " fmt, ##__VA_ARGS__)
 #define DEBUG_EVAL_NODE(node, result) \
-    DEBUG_EVAL("Node %s [%s] = ", \
+    DEBUG_EVAL("Node %s [%.*s] = ", \
               TokenNamesConsts[node->token->type], \
-              token_adjust_lexeme(node->token)); \
+              (int)node->token->len, node->token->lexeme); \
     DEBUG_MPFR_VALUE(*result, "")
 #else
 #define DEBUG_EVAL(fmt, ...)
 #define DEBUG_EVAL_NODE(node, result)
 #endif
 
+// ==================== MACROS CACHE ====================
+#ifdef DEBUG
+#define DEBUG_CACHE(fmt, ...) DEBUG_PRINT("[CACHE] " fmt, ##__VA_ARGS__)
+#else
+#define DEBUG_CACHE(fmt, ...)
+#endif
+
 // ==================== MACROS INSTRUCCION ====================
 #ifdef DEBUG
 #define DEBUG_INSTR(fmt, ...) DEBUG_PRINT("[INSTR] " fmt, ##__VA_ARGS__)
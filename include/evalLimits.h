@@ -0,0 +1,97 @@
+#ifndef EVAL_LIMITS_H
+#define EVAL_LIMITS_H
+
+#include <mpfr.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Per-expression guards (-limit). They are checked before every node of the
+// evaluation, so a single MPFR call runs to its end, but once one is hit every
+// further node of the line (on any worker) is NaN without being evaluated, the
+// evaluation unwinds and the line fails with a diagnostic.
+#define LIMITS_CHECK_STEPS 64        // nodes between clock reads at low precision
+#define LIMITS_CHEAP_PRECISION 8192  // above it every node reads the clock
+#define LIMITS_ADMIT_NS 1000000      // calls estimated to take longer are held against the time left
+
+typedef enum LimitKind{
+    LIMIT_NONE,
+    LIMIT_TIME,
+    LIMIT_TIME_AHEAD, // a single call was estimated to run past the deadline
+    LIMIT_MEMORY,
+    LIMIT_EXPONENT
+} LimitKind;
+
+// Shared by the session parser and its workers. 0 disables a limit.
+typedef struct Limits{
+    uint64_t time_ns;     // evaluation time of one line
+    int64_t memory;       // GMP/MPFR bytes a line may add to what is in use
+    mpfr_exp_t exponent;  // largest |binary exponent| of any intermediate value
+    bool active;          // any limit set
+    // Evaluation in progress
+    bool serial;          // on the calling thread only, memory is counted there
+    uint64_t deadline;
+    uint32_t check_steps;
+    atomic_int tripped;   // LimitKind, the first limit hit wins
+} Limits;
+
+Limits* limits_create();
+void limits_destroy(Limits* limits);
+void limits_show(const Limits* limits, FILE* out);
+// Sets one limit by name (time in ms, memory in bytes, exponent in bits), 0 turns it off.
+bool limits_set(Limits* limits, const char* name, long long value);
+
+// Arms the limits for one evaluation at 'precision'. A 'serial' one never
+// leaves the calling thread, so its memory is what that thread allocates and
+// other threads evaluating at the same time do not count against it.
+void limits_begin(Limits* limits, mpfr_prec_t precision, bool serial);
+// Reads the clock and the memory in use, false once a limit was hit.
+bool limits_poll(Limits* limits);
+// Before a built-in call or a power, with the estimated exponent of its result
+// and its running time: false when the call would pass the exponent limit or
+// the time left. One MPFR call cannot be interrupted, so this is the only
+// check that keeps it from running far past the time limit.
+bool limits_admit(Limits* limits, double exponent, double ns);
+// The limit that stopped the evaluation (LIMIT_NONE if none) and a diagnostic for it.
+LimitKind limits_end(Limits* limits);
+void limits_report(const Limits* limits, LimitKind kind);
+
+static inline bool limits_trip(Limits* limits, LimitKind kind) {
+    int expected = LIMIT_NONE;
+    atomic_compare_exchange_strong(&limits->tripped, &expected, kind);
+    return false;
+}
+
+static inline bool limits_tripped(Limits* limits) {
+    return atomic_load_explicit(&limits->tripped, memory_order_relaxed) != LIMIT_NONE;
+}
+
+// Before a node: false when the evaluation has to stop. 'countdown' is the
+// caller's, so workers do not share a counter.
+static inline bool limits_step(Limits* limits, uint32_t* countdown) {
+    if (atomic_load_explicit(&limits->tripped, memory_order_relaxed)) return false;
+    if (*countdown) {
+        (*countdown)--;
+        return true;
+    }
+    *countdown = limits->check_steps;
+    return limits_poll(limits);
+}
+
+// After a node: false when 'value' is beyond the exponent limit. An infinity
+// counts when it comes from an overflow: the evaluator clears MPFR's (thread
+// local) overflow flag before every node, so a set flag means this node or one
+// of its operands overflowed rather than got an infinite operand.
+static inline bool limits_check_value(Limits* limits, mpfr_srcptr value) {
+    if (!limits->exponent) return true;
+    if (!mpfr_regular_p(value)) {
+        if (mpfr_inf_p(value) && mpfr_overflow_p()) return limits_trip(limits, LIMIT_EXPONENT);
+        return true;
+    }
+    mpfr_exp_t exp = mpfr_get_exp(value);
+    if (exp <= limits->exponent && exp >= -limits->exponent) return true;
+    return limits_trip(limits, LIMIT_EXPONENT);
+}
+
+#endif
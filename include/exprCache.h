@@ -0,0 +1,45 @@
+#ifndef EXPR_CACHE_H
+#define EXPR_CACHE_H
+
+#include "parser.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EXPR_CACHE_BASE_SIZE 64
+#define EXPR_CACHE_DEFAULT_BUDGET (1u << 20) // bytes of compiled expressions
+#define THRESHOLD_CACHE 0.75 // 75% of buckets -> resize
+
+typedef struct ExprCacheEntry{
+    Expr* expr;
+    struct ExprCacheEntry* next;     // bucket chain
+    struct ExprCacheEntry* lru_prev; // towards most recently used
+    struct ExprCacheEntry* lru_next; // towards least recently used
+    uint32_t hash;
+} ExprCacheEntry;
+
+// LRU map from normalized input text to its compiled expression, bounded by
+// the total size of the cached expressions.
+typedef struct ExprCache{
+    ExprCacheEntry** buckets;
+    ExprCacheEntry* lru_head;
+    ExprCacheEntry* lru_tail;
+    size_t budget;
+    size_t used;
+    uint32_t capacity;
+    uint32_t count;
+    uint64_t hits, misses, evictions;
+} ExprCache;
+
+ExprCache* expr_cache_create(size_t budget);
+void expr_cache_destroy(ExprCache* cache);
+void expr_cache_clear(ExprCache* cache);
+void expr_cache_set_budget(ExprCache* cache, size_t budget);
+void expr_cache_show(ExprCache* cache);
+
+// Returns a new reference (release with expr_release) or NULL on a miss.
+Expr* expr_cache_get(ExprCache* cache, const char* text, uint32_t len);
+// Adds its own reference, the caller keeps the one it passed in.
+bool expr_cache_put(ExprCache* cache, Expr* expr);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef FUNCTION_TABLE_H
+#define FUNCTION_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FUNCTION_MAP_BASE_SIZE 32
+#define FUNCTION_CALL_DEPTH_LIMIT 256
+
+struct Expr;
+struct ASTNode;
+
+// A user function keeps a reference to the compiled line that defined it, the
+// body is evaluated straight from that AST on every call.
+typedef struct Function{
+    struct Expr* expr;
+    struct ASTNode* body;
+    char* name;
+    struct Function* next;
+    uint32_t param_count;
+    uint8_t len;
+    bool pure;   // the body neither assigns nor builds vectors, any worker may run it
+    bool writes; // the body assigns
+} Function;
+
+typedef struct FunctionTable{
+    Function** buckets;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t impure_count; // calls are only evaluated in parallel while this is 0
+    uint32_t writer_count; // bodies that assign, lines that call one keep their evaluation order
+} FunctionTable;
+
+FunctionTable* function_table_create();
+void function_table_destroy(FunctionTable* table);
+void function_table_empty(FunctionTable* table);
+void function_table_show(FunctionTable* table);
+
+Function* function_table_define(FunctionTable* table, const char* name, uint8_t nameLen,
+                                struct Expr* expr, struct ASTNode* body, uint32_t param_count);
+Function* function_table_get(FunctionTable* table, const char* name, uint8_t nameLen);
+
+#endif
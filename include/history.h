@@ -0,0 +1,46 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <mpfr.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HISTORY_SIZE 16 // results reachable as $1 (or last) to $16
+#define HISTORY_SLOTS (HISTORY_SIZE + 1) // plus the one the next result is written into
+
+struct Array;
+
+// A vector result holds a reference, 'num' is NaN then.
+typedef struct HistorySlot{
+    mpfr_t num;
+    struct Array* array;
+} HistorySlot;
+
+// Ring of the latest results. The values are mpfr_custom over one slab of
+// limbs at the session precision, allocated once, so recording a result is a
+// copy into the next slot and an index bump.
+typedef struct History{
+    HistorySlot slots[HISTORY_SLOTS];
+    mp_limb_t* limbs;
+    mpfr_prec_t precision;
+    uint32_t head;        // slot of $1
+    uint32_t count;       // results recorded, up to HISTORY_SIZE
+    uint32_t array_count; // vector results, 0 -> scalar-only evaluation
+} History;
+
+History* history_create(mpfr_prec_t precision);
+void history_destroy(History* history);
+void history_empty(History* history);
+void history_show(History* history);
+// Rounds the kept results to 'precision', false (nothing changed) when out of memory.
+bool history_set_precision(History* history, mpfr_prec_t precision);
+
+// Where the next result is written. It becomes $1 on history_commit(),
+// until then $1..$16 are untouched.
+mpfr_t* history_next(History* history);
+// Records the value in history_next(), or takes a new reference to 'array'.
+void history_commit(History* history, struct Array* array);
+// $n, NULL when fewer than n results were recorded.
+HistorySlot* history_get(History* history, uint32_t n);
+
+#endif
@@ -5,14 +5,14 @@
 #include <mpfr.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include "exprCache.h"
 #include "parser.h"
+#include "stats.h"
 
 #define INSTRUCTION_COUNT 24
 #define INSTRUCTION_COUNT_SIZE 256
-#define INPUT_BUFFER 512
-
 typedef struct Instruction{
-    void (*func) (void* args);
+    bool (*func) (void* args); // false when the command failed
     struct Instruction *next;
     char* str;
     uint32_t hash;
@@ -25,16 +25,31 @@ typedef struct InstructionMap{
 } InstructionMap;
 
 typedef struct App{
-    char buffer[INPUT_BUFFER];
-    mpfr_t result;
+    char* buffer; // grown by getline, lines have no length limit
+    size_t buffer_size;
     Parser* parser;
+    ExprCache* cache;
+    Stats* stats;
+    uint64_t line; // input lines evaluated so far, numbers them in --trace
     bool run;
 } App;
 
 
 InstructionMap* instruction_map_creation();
+// The subset of commands a server session may run
+InstructionMap* instruction_map_session();
 void instruction_map_destroy(InstructionMap* map);
 bool instruction_map_exist(InstructionMap* map, const char* inst);
-bool instruction_map_execute(InstructionMap* map, const char* inst, void* args);
+// True when 'inst' is a command of the map, 'ok' (may be NULL) gets whether it succeeded.
+bool instruction_map_execute(InstructionMap* map, const char* inst, void* args, bool* ok);
+
+// One interpreter session: parser with its tables and history, cache, statistics.
+App* app_create(size_t cache_budget);
+void app_destroy(App* app);
+// Compiles (or takes from the cache), evaluates and prints one input line,
+// false when any stage failed.
+bool evaluate_line(App* app, const char* line, size_t len);
+// Drops the newline and surrounding whitespace in place, returns the new start.
+char* trim_line(char* line, size_t* len);
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include "array.h"
+#include <mpfr.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MATRIX_BLOCK 64        // tile edge for double multiplication
+#define MATRIX_BLOCK_MPFR 16   // tile edge for MPFR multiplication
+#define MATRIX_THREAD_MIN_WORK (1u << 21) // multiply-adds before threads are worth it
+#define MATRIX_MAX_THREADS 16
+
+// Matrix kernels over Array values. They only read their operands, the caller
+// keeps its references, and every result is a new array at 'precision'.
+
+// Matrix product. A vector on the left is a row, on the right a column, and
+// the product of a matrix with a vector is a vector.
+Array* matrix_multiply(Array* a, Array* b, mpfr_prec_t precision);
+Array* matrix_transpose(Array* a, mpfr_prec_t precision);
+// Solves a * x = b for a square 'a', 'b' a vector or a matrix of right-hand sides.
+Array* matrix_solve(Array* a, Array* b, mpfr_prec_t precision);
+bool matrix_det(Array* a, mpfr_t rop);
+
+// Row 'row' of a matrix as a new vector.
+Array* matrix_row(Array* a, uint32_t row, mpfr_prec_t precision);
+
+#endif
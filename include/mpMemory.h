@@ -0,0 +1,53 @@
+#ifndef MP_MEMORY_H
+#define MP_MEMORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// GMP/MPFR allocation hooks (mp_set_memory_functions). Every block carries a
+// small header, so mp_memory_install() has to run before the first GMP
+// allocation. Byte counts are the sizes GMP asked for, headers excluded.
+//
+// Arena mode: during evaluate_expression() blocks up to MP_ARENA_MAX_BLOCK are
+// bumped out of a per-thread chunk instead of malloc'd. Freeing them only
+// counts down the chunk, and a chunk whose blocks are all gone is reused from
+// the start in one step. Blocks that outlive the evaluation (MPFR's constant
+// caches, vectors) just keep their chunk until they are freed.
+#define MP_ARENA_CHUNK_BYTES (1u << 18)
+#define MP_ARENA_MAX_BLOCK (MP_ARENA_CHUNK_BYTES / 4) // bigger blocks always go to malloc
+#define MP_ARENA_POOL_CHUNKS 8 // empty chunks kept for reuse
+
+typedef struct MpMemoryStats{
+    int64_t current;       // bytes allocated by GMP/MPFR and not freed
+    int64_t peak;          // highest 'current' since the last reset
+    uint64_t allocations;  // allocate and reallocate calls
+    uint64_t arena_blocks; // of those, served by the arena
+    uint64_t arena_resets; // times a chunk was emptied and bumped from the start again
+    uint32_t arena_chunks; // chunks allocated, in use or pooled
+    bool arena;
+} MpMemoryStats;
+
+void mp_memory_install();
+// Arena on/off for the next evaluations, off also gives the empty chunks back.
+void mp_memory_set_arena(bool on);
+// Brackets one evaluate_expression(), the arena only serves blocks in between.
+void mp_memory_scope_begin();
+void mp_memory_scope_end();
+
+void mp_memory_get(MpMemoryStats* stats);
+// Bytes in use right now, cheap enough to poll during an evaluation.
+int64_t mp_memory_current();
+// Flags the first allocation that takes the bytes in use past 'bytes' (0 for
+// none), so a peak inside a single MPFR call is seen even if it is freed again.
+void mp_memory_set_ceiling(int64_t bytes);
+bool mp_memory_ceiling_hit();
+// The same counted on the calling thread alone, for evaluations that stay on
+// it (server sessions), so threads evaluating side by side do not add up.
+int64_t mp_memory_thread_current();
+void mp_memory_set_thread_ceiling(int64_t bytes);
+bool mp_memory_thread_ceiling_hit();
+// Peak back to the current size, counters to 0.
+void mp_memory_reset();
+void mp_memory_show();
+
+#endif
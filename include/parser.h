@@ -1,8 +1,11 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "functionTable.h"
+#include "history.h"
 #include "symbolTable.h"
 #include <mpfr.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -17,14 +20,27 @@ typedef enum TokenType{
     TOK_MODULE, // %
     TOK_MULT, // *
     TOK_POWER, // ^
-    TOK_SQUARE, // √ (sqrt)
-    // sin , cos , tan , etc
+    TOK_FUNC, // sqrt, sin, log, ... (Token.id -> builtinTable)
+    TOK_CONST, // pi, e, ... (Token.id -> builtinTable)
+    TOK_HISTORY, // $1, $2, ... and last (Token.id -> n of $n)
 
     TOK_LPAR, // (
     TOK_RPAR, // )
     TOK_COMM, // ,
     TOK_LCOR, // [
     TOK_RCOR, // ]
+
+    // AST-only node kinds (produced by the parser, never by the lexer)
+    TOK_NEG, // unary -
+    TOK_CALL, // f(a, b)
+    TOK_PARAM, // parameter inside a function body
+    TOK_DEFINE, // f(x, y) = expr
+    TOK_VECTOR, // [a, b, c]
+    TOK_INDEX, // v[i]
+    TOK_FMA, // a*b + c, one rounding (left or right child is the '*' node)
+    TOK_FMS, // a*b - c or c - a*b, one rounding
+    TOK_SUM, // root of a +/- chain of three or more terms, one rounding
+    TOK_POWI, // x^n with an integer literal n, kept in aux
     
     TOK_INVALID
 } TokenType;
@@ -34,6 +50,7 @@ typedef struct Token{
     TokenType type;
     uint8_t len;
     bool negative;
+    uint16_t id; // built-in row for TOK_FUNC / TOK_CONST, n for TOK_HISTORY
 } Token;
 
 #define TOKEN_BUFFER_SIZE 128
@@ -41,7 +58,7 @@ typedef struct Token{
 
 typedef struct TokenBuffer{
     Token* token_buff;
-    uint16_t size,count;
+    uint32_t size,count;
 } TokenBuffer;
 
 TokenBuffer* token_buffer_create();
@@ -53,31 +70,149 @@ typedef struct ASTNode {
     Token *token;
     struct ASTNode* left;
     struct ASTNode* right;
+    struct ASTNode* next; // next argument of a call or element of a vector (first one is 'left')
+    uint32_t aux;         // call: argument count, vector: element count, parameter: frame slot,
+                          // sum: operator of the root, +/- inside a sum: 1,
+                          // regrouped '*': 2 at the root of the chain, 1 inside,
+                          // integer power: the exponent as int32_t
+    uint32_t weight;      // estimated work of the subtree, 0 -> must run on the evaluating thread
+    uint32_t cut;         // evaluated ahead of the rest of its line or body: slot + 1, else 0
 } ASTNode;
 
+// Subtree weights are in quarters of a multiplication at the working precision
+#define NODE_WEIGHT_MUL 4
+#define NODE_WEIGHT_CALLS 0x80000000u // the subtree calls user functions
+#define NODE_WEIGHT_MASK 0x7FFFFFFFu
+
+// Parallel evaluation: a sibling subtree is handed to another worker when it
+// is worth at least EVAL_FORK_MIN_WORK limb products. The pool is started the
+// first time the precision makes a subtree of EVAL_FORK_MAX_WEIGHT worth it.
+#define EVAL_FORK_MIN_WORK (1u << 17)
+#define EVAL_FORK_MAX_WEIGHT (64 * NODE_WEIGHT_MUL)
+#define EVAL_SUM_TASKS 16 // forked terms per sum, the rest run inline
+#define EVAL_TASK_FRAME 8 // call arguments a forked subtree can see, more keep it inline
+
+// The evaluator recurses once per AST level. Deeper lines and bodies are cut
+// every EVAL_CUT_LEVELS levels: the nodes at the cuts are evaluated first,
+// deepest first, and the rest of the tree reads their values, so no evaluation
+// recurses further. Every level compares its frame with the bounds of the
+// thread's stack and fails once less than EVAL_STACK_RESERVE is left.
+#define EVAL_CUT_LEVELS 64
+#define EVAL_STACK_RESERVE (256u << 10) // MPFR and GMP temporaries
+
+// Temporaries live in fixed-size chunks so a slot address stays valid while the
+// buffer grows (evaluate_node keeps pointers to its children's results).
 #define MPRF_BUFFER_SIZE 128
 
+// Each chunk is one allocation of MPRF_BUFFER_SIZE slots, a slot is an
+// mpfr_custom value followed by its limbs ('stride' bytes).
 typedef struct MprfBUffer{
-    mpfr_t* buffer;
-    uint16_t size,count;
+    uint8_t** chunks;
+    uint32_t chunk_count;
+    uint32_t size,count;
+    mpfr_prec_t precision;
+    size_t stride;
 } MpfrBuffer;
 
+// Operator table row, indexed by TokenType. Adding an operator or a function
+// means adding a row here, the parser itself has no per-operator code.
+typedef struct OperatorInfo{
+    uint8_t precedence;        // binary precedence, 0 -> not a binary operator
+    uint8_t prefix_precedence; // prefix precedence, 0 -> not a prefix operator
+    TokenType prefix_kind;     // node kind produced by the prefix form
+    bool call;                 // must be followed by '(' and an argument list
+    bool right_assoc;
+} OperatorInfo;
+
+typedef enum ParserEntryKind{
+    ENTRY_BINARY,
+    ENTRY_PREFIX,
+    ENTRY_GROUP,  // (
+    ENTRY_CALL,   // func(
+    ENTRY_VECTOR, // [ in operand position
+    ENTRY_INDEX   // [ after an operand
+} ParserEntryKind;
+
+typedef struct ParserEntry{
+    Token* token;
+    uint32_t argc;
+    ParserEntryKind kind;
+} ParserEntry;
+
 typedef struct Parser{
     TokenBuffer* tokens;
     ASTNode* nodesBuffer;
     MpfrBuffer* mpfrBuffer;
     SymbolTable* symTable;
-    uint16_t curr_tok;
-    uint16_t curr_node;
-    uint16_t size;
+    FunctionTable* funcTable;
+    History* history; // results of the previous lines, $1..$n
+    // Call frames: arguments of the active calls, the innermost starts at frame_base
+    mpfr_t** frame;
+    uint32_t frame_base, frame_top, frame_size;
+    uint32_t call_depth;
+    uintptr_t stack_floor; // evaluating below this address fails, 0 -> unchecked
+    // Values of the cut nodes of the active line and bodies, a body stacks
+    // above its caller; cut_base is the innermost one's first slot
+    struct Value* cuts;
+    uint32_t cut_base, cut_top, cut_size;
+    // Terms of the sums being evaluated, a nested sum stacks above its parent
+    mpfr_ptr* terms;
+    uint32_t terms_top, terms_size;
+    mpfr_prec_t precision; // session precision of temporaries and new variables
+    // Parallel evaluation: one Parser per worker shares the tables and owns its
+    // temporaries, workers[0] is the session parser itself
+    struct TaskPool* pool;
+    struct Parser** workers;
+    uint32_t worker;      // index of this parser in the pool
+    uint32_t fork_weight; // lightest subtree worth forking at this precision
+    bool serial;          // never starts a pool, set before the first precision change
+    bool reassociate; // compile '*' chains as balanced trees (-reassoc), changes rounding
+    bool trace;       // --trace, slow nodes are recorded as trace events
+    struct Limits* limits; // -limit guards, shared with the workers
+    uint32_t limit_steps;  // nodes left before this parser polls the limits again
+    struct Expr* expr; // expression being evaluated
+    bool borrow; // nothing below the head writes the table, variables are read in place
+    uint64_t op_counts[TOK_INVALID]; // evaluated nodes by kind, see parser_take_op_counts()
+    struct Array* array_result; // vector produced by the last evaluation, NULL for scalars
+    // Explicit stacks, the parser never recurses
+    ParserEntry* opStack;
+    ASTNode** valStack;
+    uint32_t stack_size;
+    uint32_t curr_tok;
+    uint32_t curr_node;
+    uint32_t size;
 } Parser;
 
+// Self-contained copy of a parsed line. It owns its text, tokens and nodes so
+// it outlives the token buffer and can be cached and evaluated again later.
+typedef struct Expr{
+    char* text;
+    Token* tokens;
+    ASTNode* nodes;
+    ASTNode* head;
+    size_t bytes; // size of the single allocation backing the expression
+    uint32_t token_count, node_count;
+    atomic_uint refs; // --pipeline releases lines on another thread than the cache
+    uint32_t len;
+    uint32_t cut_count; // of the line, or of the body when it defines a function
+    bool calls;  // calls user functions
+    bool writes; // assigns
+    bool arrays; // has vector literals
+} Expr;
+
 Parser* parser_create(TokenBuffer* tokens);
 void parser_destroy(Parser* parser);
 void parser_show(Parser* parser);
+bool parser_set_precision(Parser* parser, mpfr_prec_t precision);
 
 ASTNode* parse(Parser* parser);
-bool evaluate_expression(Parser* parser, ASTNode* head, mpfr_t* ans);
+Expr* parser_compile(Parser* parser, const char* text, ASTNode* head);
+void expr_release(Expr* expr);
+bool evaluate_expression(Parser* parser, Expr* expr, mpfr_t* ans);
+// Adds the node counts of the parser and its workers to 'counts' and zeroes them.
+void parser_take_op_counts(Parser* parser, uint64_t counts[TOK_INVALID]);
+
+extern const char* TokenNamesConsts[TOK_INVALID + 1];
 
 #endif
 
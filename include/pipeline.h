@@ -0,0 +1,38 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "instructions.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// --pipeline: batch mode where consecutive lines overlap in four stages, each
+// on its own thread: read and tokenize, parse and compile, evaluate, print.
+// Lines are handed from stage to stage by pointer through single-producer
+// single-consumer rings. PIPELINE_DEPTH line slots circulate (the printer gives
+// them back to the reader), so a slow stage stalls the earlier ones once every
+// slot is in flight.
+//
+// A command is a barrier: the reader waits until every earlier line was
+// printed, runs it on its own and goes on. Results come out in input order,
+// warnings and errors are not ordered with them.
+#define PIPELINE_DEPTH 64       // lines in flight, a power of two
+#define PIPELINE_SPINS 64       // polls of an empty ring before yielding the CPU
+#define PIPELINE_YIELDS 1024    // yields before sleeping between polls
+#define PIPELINE_SLEEP_NS 50000 // an idle stage (waiting for input) sleeps this long per poll
+
+// Each index is stored by one side only, 'seen' is that side's last look at
+// the other one, so a poll only touches the shared line when it has to.
+typedef struct SpscRing{
+    _Alignas(64) atomic_uint tail; // next slot to fill, producer
+    uint32_t head_seen;
+    _Alignas(64) atomic_uint head; // next slot to take, consumer
+    uint32_t tail_seen;
+    _Alignas(64) void* slots[PIPELINE_DEPTH];
+} SpscRing;
+
+// Runs stdin through the stages until EOF or -exit, false when the pipeline
+// could not be set up.
+bool pipeline_run(App* app, InstructionMap* instructions);
+
+#endif
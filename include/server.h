@@ -0,0 +1,27 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// --server <address>: independent interpreter sessions over a Unix socket (a
+// path) or loopback TCP ("tcp:<port>", bound to 127.0.0.1).
+//
+// Every message, both ways, is a 4-byte big-endian length and that many bytes.
+// A request is one input line, an expression or a session command (-precision,
+// -limit, -history, -clear-vars, -clear-funcs; the other commands are refused).
+// Each request gets one reply, in order: "OK ", what the console would have
+// printed and the diagnostics of the line, or "ERR " and the error messages the
+// console would have shown. A session's -limit memory counts only
+// what its own evaluations allocate.
+//
+// One epoll thread owns the sockets; evaluation threads take a session at a
+// time and run its requests in order, so sessions evaluate in parallel with
+// each other but each one serially (no task pool per session).
+#define SERVER_MAX_MESSAGE (1u << 20) // longer requests close the connection
+#define SERVER_MAX_EVENTS 64
+#define SERVER_BACKLOG 64
+#define SERVER_MAX_QUEUED 64          // requests waiting per session before reading pauses
+#define SERVER_SESSION_CACHE (1u << 18) // expression cache budget per session
+
+// Serves until SIGINT or SIGTERM, returns the exit status.
+int server_run(const char* address);
+
+#endif
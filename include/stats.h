@@ -0,0 +1,50 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Latencies are kept in log-linear buckets (HDR style): exact below 32 ns,
+// then 16 buckets per power of two, so any value is within 1/16 of its bucket.
+#define STATS_HISTOGRAM_BITS 40 // up to 2^40 ns (~18 min), longer goes to the last bucket
+#define STATS_SUB_BUCKETS 16
+#define STATS_BUCKETS ((STATS_HISTOGRAM_BITS - 3) * STATS_SUB_BUCKETS)
+
+#define STATS_PREC_MIN_BITS 6 // first precision class is <= 64 bits
+#define STATS_PREC_CLASSES 21 // then <= 128, <= 256, ... <= 2^26 bits
+#define STATS_OP_KINDS 32 // node kinds counted, indexed by TokenType
+
+typedef enum StatStage{
+    STAT_TOKENIZE,
+    STAT_PARSE, // parse() and compilation, lines served by the cache skip both
+    STAT_EVALUATE,
+    STAT_OUTPUT, // printing and recording the result
+    STAT_STAGES
+} StatStage;
+
+typedef struct Histogram{
+    uint64_t buckets[STATS_BUCKETS];
+    uint64_t count, total, max; // nanoseconds
+} Histogram;
+
+// Always on, a line costs a clock read per stage and one bucket increment.
+typedef struct Stats{
+    Histogram stages[STAT_STAGES];
+    uint64_t ops[STATS_PREC_CLASSES][STATS_OP_KINDS]; // evaluated nodes by precision class and kind
+    uint64_t lines;
+    uint64_t cache_hits;
+} Stats;
+
+Stats* stats_create();
+void stats_destroy(Stats* stats);
+void stats_reset(Stats* stats);
+
+// Monotonic clock in nanoseconds.
+uint64_t stats_now();
+void stats_record(Stats* stats, StatStage stage, uint64_t ns);
+// Adds node counts ('kinds' of them) evaluated at 'precision' bits.
+void stats_add_ops(Stats* stats, long precision, const uint64_t* counts, uint32_t kinds);
+// 'op_names' names each kind, NULL entries are skipped.
+void stats_show(const Stats* stats, const char* const* op_names, uint32_t kinds);
+
+#endif
@@ -1,25 +1,70 @@
 #ifndef SYMBOL_TABLE
 #define SYMBOL_TABLE
 
+#include <stdio.h> // before mpfr.h for its FILE functions
 #include <mpfr.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define PRECISION_ROUNDING_BITS 256
+#define PRECISION_ROUNDING_BITS 256 // default session precision
+#define PRECISION_MAX_BITS (1L << 26)
 #define SYMBOL_MAP_BASE_SIZE 64 
 #define THRESHOLD_MAP 0.6 // 60% of map -> resize 
 
+#define SNAPSHOT_MAGIC "MSYM"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_SCALAR 0
+#define SNAPSHOT_VECTOR 1
+#define SNAPSHOT_MATRIX 2
+
+struct Array;
+
 typedef struct Symbol{
     mpfr_t num;
+    struct Array* array; // vector value, NULL for scalars
     char* name;
     struct Symbol* next;
     uint8_t len;
 } Symbol;
 
+// Symbols are carved out of chunks owned by the table, in insertion order,
+// names out of byte chunks and significands out of limb chunks. Nothing is freed before the table is emptied.
+#define SYMBOL_CHUNK_MIN 64
+#define SYMBOL_CHUNK_MAX 65536 // symbols per chunk, chunks double up to this
+#define NAME_CHUNK_BYTES 65536
+#define LIMB_CHUNK_LIMBS 8192 // larger values get a chunk of their own
+
+typedef struct SymbolChunk{
+    struct SymbolChunk* next;
+    uint32_t used, size;
+    Symbol symbols[];
+} SymbolChunk;
+
+typedef struct NameChunk{
+    struct NameChunk* next;
+    uint32_t used, size;
+    char data[];
+} NameChunk;
+
+// Significands of the symbols (mpfr_custom values), never passed to mpfr_clear
+// or mpfr_set_prec. A reassignment at another precision takes fresh limbs.
+typedef struct LimbChunk{
+    struct LimbChunk* next;
+    size_t used, size;
+    mp_limb_t limbs[];
+} LimbChunk;
+
 typedef struct SymbolTable {
     Symbol** buckets;     
-    uint16_t capacity;
-    uint16_t count;   
+    uint32_t capacity;
+    uint32_t count;   
+    uint32_t array_count; // symbols holding a vector, 0 -> scalar-only evaluation
+    mpfr_prec_t precision; // precision of new and reassigned values
+    SymbolChunk* chunks; // oldest first
+    SymbolChunk* last_chunk;
+    NameChunk* names; // newest first
+    LimbChunk* limbs; // newest first
 } SymbolTable;
 
 
@@ -30,9 +75,55 @@ void symbol_table_empty(SymbolTable* symTable);
 
 
 mpfr_t* symbol_table_insert(SymbolTable* symTable, const char* name, const mpfr_t* num , uint8_t nameLen);
+// Lookups compare 'nameLen' bytes, 'name' does not need a terminator.
 mpfr_t* symbol_table_get(SymbolTable* symTable, const char* name , uint8_t nameLen);
+// Stores a new reference to 'array' under 'name'.
+Symbol* symbol_table_insert_array(SymbolTable* symTable, const char* name, struct Array* array, uint8_t nameLen);
+// Like symbol_table_get but returns the symbol and does not warn when missing.
+Symbol* symbol_table_find(SymbolTable* symTable, const char* name, uint8_t nameLen);
+// Sizes the buckets for 'count' more symbols at once.
+void symbol_table_reserve(SymbolTable* symTable, uint32_t count);
+
+// Binary snapshots of every variable (-save / -load), values in MPFR's
+// portable format. Loading inserts over existing names and stores the values
+// at the session precision. 'in' is read twice: the whole snapshot is checked
+// first, so a truncated or corrupt one leaves the table as it was. Only running
+// out of memory while inserting leaves the symbols inserted so far. 'loaded'
+// gets the number of symbols, 0 on failure.
+bool symbol_table_save(SymbolTable* symTable, FILE* out);
+bool symbol_table_load(SymbolTable* symTable, FILE* in, uint32_t* loaded);
+
+#define FRIENDLY_MPFR_DIGITS 11 // significant digits at most
+#define FRIENDLY_MPFR_SIZE 48 // fits any format_friendly_mpfr() output
 
 void print_friendly_mpfr(mpfr_t value, const char* label);
+void print_friendly_mpfr_inline(mpfr_t value);
+// Writes 'value' the way it is printed: fixed point with 10 significant digits
+// (at most 10 decimals), scientific when the exponent is out of [-3, 6].
+// Only the digits shown are converted. Returns snprintf's count.
+int format_friendly_mpfr(char* buffer, size_t size, mpfr_t value);
+
+#define BASE_PRINT_PAD_DIGITS 64 // more zeros around the digits switch to a 'p' exponent
+
+// Stream print_friendly_mpfr*(), print_mpfr_base() and array_print() write to,
+// stdout unless the calling thread redirected it (NULL restores stdout).
+FILE* print_output();
+void print_set_output(FILE* out);
+
+// Session output base for print_friendly_mpfr*(): 2, 8, 10 or 16. False for other bases.
+bool print_friendly_set_base(uint8_t base);
+uint8_t print_friendly_base();
+// Exact 'value' in base 2, 8 or 16 ("0x1f", "-0b1.01", "0x1.8p+200"), finite values only.
+void print_mpfr_base(mpfr_t value, uint8_t base);
+
+#define DUMP_CHUNK_DIGITS 4096 // digits converted at once by write_mpfr_digits()
+#define DUMP_LEADING_ZEROS 20 // smaller values are written as d.ddd...e-x
+
+// Writes 'digits' significant digits of 'value', rounded to nearest with ties
+// to even like MPFR, and a newline.
+// The conversion splits at powers of ten and streams the digits in chunks, so
+// memory follows the size of the number, never of its decimal string.
+bool write_mpfr_digits(FILE* out, mpfr_t value, uint64_t digits);
 
 #endif
 
@@ -0,0 +1,62 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TASK_POOL_MAX_WORKERS 16
+#define TASK_DEQUE_SIZE 256 // pending tasks per worker, a full deque runs the task inline
+
+typedef enum TaskState{
+    TASK_QUEUED,
+    TASK_RUNNING,
+    TASK_DONE
+} TaskState;
+
+// Embedded as the first member of the caller's task. 'context' is the one of
+// the worker that runs it.
+typedef struct Task{
+    void (*run)(struct Task* task, void* context);
+    atomic_int state;
+} Task;
+
+// The owner pushes and pops at the bottom, thieves take from the top.
+typedef struct TaskDeque{
+    pthread_mutex_t lock;
+    Task* items[TASK_DEQUE_SIZE];
+    uint32_t top, bottom;
+} TaskDeque;
+
+typedef struct TaskWorker{
+    struct TaskPool* pool;
+    pthread_t thread;
+    uint32_t index;
+} TaskWorker;
+
+// Worker 0 is the thread that created the pool, it only runs tasks while it
+// waits for one of its own. Workers 1..n-1 are threads stealing from everyone.
+typedef struct TaskPool{
+    TaskDeque* deques;
+    void** contexts;
+    TaskWorker* threads;
+    uint32_t workers;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    atomic_uint pending;
+    atomic_bool stop;
+} TaskPool;
+
+// 'contexts' holds one evaluation context per worker and must outlive the pool.
+TaskPool* task_pool_create(uint32_t workers, void** contexts);
+void task_pool_destroy(TaskPool* pool);
+
+// Queues 'task' on the deque of 'worker', false when it is full.
+bool task_pool_push(TaskPool* pool, uint32_t worker, Task* task);
+// Runs 'task' inline when nobody stole it, otherwise helps with other tasks until it is done.
+void task_pool_sync(TaskPool* pool, uint32_t worker, Task* task);
+
+uint32_t task_pool_cpu_count();
+
+#endif
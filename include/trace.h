@@ -0,0 +1,31 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// --trace <file>: events are kept in memory and written as Chrome Trace Event
+// JSON (chrome://tracing, ui.perfetto.dev) by trace_finish().
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_MAX_EVENTS (1u << 22) // later events are counted and dropped
+#define TRACE_NODE_MIN_NS 20000     // faster nodes are not recorded
+
+typedef struct TraceEvent{
+    const char* name;     // static string, not copied
+    const char* category;
+    const char* arg_name; // one integer argument, none when NULL
+    int64_t arg;
+    uint64_t start, duration; // stats_now() nanoseconds
+    uint32_t thread;          // 0 is the session, n the pool worker n
+} TraceEvent;
+
+// Starts recording, false when 'path' cannot be written.
+bool trace_start(const char* path);
+bool trace_enabled();
+// Complete event from 'start' to 'end', safe to call from any worker.
+void trace_event(const char* name, const char* category, uint64_t start, uint64_t end,
+                 uint32_t thread, const char* arg_name, int64_t arg);
+// Writes the buffered events and stops recording.
+bool trace_finish();
+
+#endif
@@ -0,0 +1,470 @@
+#include "array.h"
+#include "builtins.h"
+#include "symbolTable.h"
+#include "debug.h"
+#include <math.h>
+#include <mpfr.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARRAY_STORAGE(precision) ((precision) <= ARRAY_DOUBLE_MAX_PRECISION ? ARRAY_DOUBLE : ARRAY_MPFR)
+#define ALIGN_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+// Released arrays are kept here and handed out again for the same shape, a
+// vector expression evaluated in a loop stops allocating after the first run.
+static _Thread_local Array* pool = NULL; // per thread, sessions may run on any of them
+static _Thread_local uint32_t pool_count = 0;
+
+// ##############################
+// #####      STORAGE       #####
+// ##############################
+
+static Array* array_pool_take(uint32_t len, ArrayStorage storage, mpfr_prec_t precision) {
+    for (Array** link = &pool; *link; link = &(*link)->next_free) {
+        Array* array = *link;
+        if (array->len != len || array->storage != storage) continue;
+        if (storage == ARRAY_MPFR && array->precision != precision) continue;
+
+        *link = array->next_free;
+        pool_count--;
+        return array;
+    }
+    return NULL;
+}
+
+Array* array_create(uint32_t len, mpfr_prec_t precision) {
+    ArrayStorage storage = ARRAY_STORAGE(precision);
+
+    Array* array = array_pool_take(len, storage, precision);
+    if (array) {
+        array->refs = 1;
+        array->precision = precision;
+        array->rows = array->cols = 0;
+        array->next_free = NULL;
+        return array;
+    }
+
+    // Header, element data and (in MPFR mode) every limb share one aligned block
+    size_t header = ALIGN_UP(sizeof(Array), ARRAY_ALIGNMENT);
+    size_t limb_bytes = storage == ARRAY_MPFR ? mpfr_custom_get_size(precision) : 0;
+    size_t data = storage == ARRAY_DOUBLE ? (size_t)len * sizeof(double)
+                                          : (size_t)len * (sizeof(mpfr_t) + limb_bytes);
+    size_t bytes = ALIGN_UP(header + data, ARRAY_ALIGNMENT);
+
+    array = aligned_alloc(ARRAY_ALIGNMENT, bytes);
+    CHECK_NULL(array, ERROR_RETURN_NULL("Failed to allocate vector of %u elements (%zu bytes)\n", len, bytes));
+
+    array->next_free = NULL;
+    array->bytes = bytes;
+    array->precision = precision;
+    array->len = len;
+    array->rows = array->cols = 0;
+    array->refs = 1;
+    array->storage = storage;
+
+    if (storage == ARRAY_DOUBLE) {
+        array->data.d = (double*)((char*)array + header);
+    } else {
+        array->data.m = (mpfr_t*)((char*)array + header);
+        char* limbs = (char*)(array->data.m + len);
+        for (uint32_t i = 0; i < len; i++, limbs += limb_bytes) {
+            mpfr_custom_init(limbs, precision);
+            mpfr_custom_init_set(array->data.m[i], MPFR_ZERO_KIND, 0, precision, limbs);
+        }
+    }
+
+    DEBUG_PRINT("Vector created: %u elements, %s, %zu bytes\n",
+                len, storage == ARRAY_DOUBLE ? "double" : "mpfr", bytes);
+    return array;
+}
+
+Array* array_create_matrix(uint32_t rows, uint32_t cols, mpfr_prec_t precision) {
+    if (rows && cols > UINT32_MAX / rows) {
+        ERROR_RETURN_NULL("Matrix too large: %ux%u\n", rows, cols);
+    }
+    Array* matrix = array_create(rows * cols, precision);
+    CHECK_NULL(matrix, return NULL);
+    matrix->rows = rows;
+    matrix->cols = cols;
+    return matrix;
+}
+
+Array* array_coerce(Array* array, mpfr_prec_t precision) {
+    ArrayStorage storage = ARRAY_STORAGE(precision);
+    if (array->storage == storage && (storage == ARRAY_DOUBLE || array->precision == precision)) {
+        array->refs++;
+        return array;
+    }
+
+    Array* copy = array_create(array->len, precision);
+    CHECK_NULL(copy, return NULL);
+    copy->rows = array->rows;
+    copy->cols = array->cols;
+    array_copy(copy, 0, array, 0, array->len);
+    return copy;
+}
+
+void array_release(Array* array) {
+    if (!array || --array->refs > 0) return;
+
+    if (pool_count < ARRAY_POOL_LIMIT) {
+        array->next_free = pool;
+        pool = array;
+        pool_count++;
+        return;
+    }
+    free(array);
+}
+
+void array_pool_free() {
+    while (pool) {
+        Array* next = pool->next_free;
+        free(pool);
+        pool = next;
+    }
+    pool_count = 0;
+}
+
+void array_get(const Array* array, uint32_t i, mpfr_t rop) {
+    if (array->storage == ARRAY_DOUBLE) mpfr_set_d(rop, array->data.d[i], MPFR_RNDN);
+    else mpfr_set(rop, array->data.m[i], MPFR_RNDN);
+}
+
+void array_set(Array* array, uint32_t i, const mpfr_t op) {
+    if (array->storage == ARRAY_DOUBLE) array->data.d[i] = mpfr_get_d(op, MPFR_RNDN);
+    else mpfr_set(array->data.m[i], op, MPFR_RNDN);
+}
+
+void array_copy(Array* dst, uint32_t dst_offset, const Array* src, uint32_t src_offset, uint32_t count) {
+    if (dst->storage == ARRAY_MPFR) {
+        for (uint32_t i = 0; i < count; i++) array_get(src, src_offset + i, dst->data.m[dst_offset + i]);
+    } else if (src->storage == ARRAY_DOUBLE) {
+        memcpy(dst->data.d + dst_offset, src->data.d + src_offset, count * sizeof(double));
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            dst->data.d[dst_offset + i] = mpfr_get_d(src->data.m[src_offset + i], MPFR_RNDN);
+        }
+    }
+}
+
+// ##############################
+// #####     ARITHMETIC     #####
+// ##############################
+
+// Element 'i' as an MPFR operand, double storage is widened into 'tmp' (exact at 53 bits)
+static inline mpfr_srcptr array_element(const Array* array, uint32_t i, mpfr_ptr tmp) {
+    if (array->storage == ARRAY_MPFR) return array->data.m[i];
+    mpfr_set_d(tmp, array->data.d[i], MPFR_RNDN);
+    return tmp;
+}
+
+static inline mpfr_ptr array_target(Array* array, uint32_t i, mpfr_ptr tmp) {
+    return array->storage == ARRAY_MPFR ? array->data.m[i] : tmp;
+}
+
+static inline void array_commit(Array* array, uint32_t i, mpfr_srcptr value) {
+    if (array->storage == ARRAY_DOUBLE) array->data.d[i] = mpfr_get_d(value, MPFR_RNDN);
+}
+
+// A temporary operand nobody else holds is overwritten instead of allocating
+static Array* array_result(Array* a, Array* b, uint32_t len, mpfr_prec_t precision) {
+    ArrayStorage storage = ARRAY_STORAGE(precision);
+    Array* candidates[2] = { a, b };
+    for (int c = 0; c < 2; c++) {
+        Array* array = candidates[c];
+        if (array && array->refs == 1 && array->storage == storage &&
+            (storage == ARRAY_DOUBLE || array->precision == precision)) {
+            return array;
+        }
+    }
+    return array_create(len, precision);
+}
+
+static void element_op(TokenType op, mpfr_ptr rop, mpfr_srcptr x, mpfr_srcptr y) {
+    switch (op) {
+        case TOK_ADD:    mpfr_add(rop, x, y, MPFR_RNDN); break;
+        case TOK_SUB:    mpfr_sub(rop, x, y, MPFR_RNDN); break;
+        case TOK_MULT:   mpfr_mul(rop, x, y, MPFR_RNDN); break;
+        case TOK_POWER:  builtin_power(rop, x, y); break;
+        case TOK_DIVIDE:
+            if (mpfr_zero_p(y)) mpfr_set_nan(rop);
+            else mpfr_div(rop, x, y, MPFR_RNDN);
+            break;
+        case TOK_MODULE:
+            if (mpfr_zero_p(y)) mpfr_set_nan(rop);
+            else mpfr_fmod(rop, x, y, MPFR_RNDN);
+            break;
+        default:
+            mpfr_set_nan(rop);
+            break;
+    }
+}
+
+// Straight loops over contiguous doubles, one per operator so the compiler can
+// vectorize each of them. X and Y are the element expressions of the operands.
+#define DOUBLE_KERNEL(op, r, n, X, Y) do { \
+    switch (op) { \
+        case TOK_ADD:    for (uint32_t i = 0; i < (n); i++) (r)[i] = (X) + (Y); break; \
+        case TOK_SUB:    for (uint32_t i = 0; i < (n); i++) (r)[i] = (X) - (Y); break; \
+        case TOK_MULT:   for (uint32_t i = 0; i < (n); i++) (r)[i] = (X) * (Y); break; \
+        case TOK_DIVIDE: for (uint32_t i = 0; i < (n); i++) (r)[i] = (Y) == 0 ? NAN : (X) / (Y); break; \
+        case TOK_MODULE: for (uint32_t i = 0; i < (n); i++) (r)[i] = (Y) == 0 ? NAN : fmod((X), (Y)); break; \
+        case TOK_POWER:  for (uint32_t i = 0; i < (n); i++) (r)[i] = pow((X), (Y)); break; \
+        default:         for (uint32_t i = 0; i < (n); i++) (r)[i] = NAN; break; \
+    } \
+} while (0)
+
+Array* array_binary(TokenType op, Array* a, Array* b, mpfr_prec_t precision) {
+    if (a->len != b->len || a->rows != b->rows) {
+        char sa[32], sb[32];
+        ERROR_PRINT("Shape mismatch: %s vs %s\n",
+                    array_shape(a, sa, sizeof(sa)), array_shape(b, sb, sizeof(sb)));
+        array_release(a);
+        array_release(b);
+        return NULL;
+    }
+
+    uint32_t n = a->len;
+    Array* r = array_result(a, a == b ? NULL : b, n, precision);
+    if (!r) {
+        array_release(a);
+        array_release(b);
+        return NULL;
+    }
+    r->rows = a->rows;
+    r->cols = a->cols;
+
+    if (r->storage == ARRAY_DOUBLE && a->storage == ARRAY_DOUBLE && b->storage == ARRAY_DOUBLE) {
+        const double* x = a->data.d;
+        const double* y = b->data.d;
+        double* out = r->data.d;
+        DOUBLE_KERNEL(op, out, n, x[i], y[i]);
+    } else {
+        mpfr_t tx, ty, tr;
+        mpfr_inits2(ARRAY_DOUBLE_MAX_PRECISION, tx, ty, tr, (mpfr_ptr)0);
+        for (uint32_t i = 0; i < n; i++) {
+            mpfr_ptr rop = array_target(r, i, tr);
+            element_op(op, rop, array_element(a, i, tx), array_element(b, i, ty));
+            array_commit(r, i, rop);
+        }
+        mpfr_clears(tx, ty, tr, (mpfr_ptr)0);
+    }
+
+    if (a != r) array_release(a);
+    if (b != r) array_release(b);
+    return r;
+}
+
+Array* array_scalar(TokenType op, Array* a, const mpfr_t s, bool scalar_left, mpfr_prec_t precision) {
+    uint32_t n = a->len;
+    Array* r = array_result(a, NULL, n, precision);
+    if (!r) {
+        array_release(a);
+        return NULL;
+    }
+    r->rows = a->rows;
+    r->cols = a->cols;
+
+    if (r->storage == ARRAY_DOUBLE && a->storage == ARRAY_DOUBLE) {
+        const double* x = a->data.d;
+        const double sv = mpfr_get_d(s, MPFR_RNDN);
+        double* out = r->data.d;
+        if (scalar_left) DOUBLE_KERNEL(op, out, n, sv, x[i]);
+        else DOUBLE_KERNEL(op, out, n, x[i], sv);
+    } else {
+        mpfr_t tx, tr;
+        mpfr_inits2(ARRAY_DOUBLE_MAX_PRECISION, tx, tr, (mpfr_ptr)0);
+        for (uint32_t i = 0; i < n; i++) {
+            mpfr_ptr rop = array_target(r, i, tr);
+            mpfr_srcptr x = array_element(a, i, tx);
+            if (scalar_left) element_op(op, rop, s, x);
+            else element_op(op, rop, x, s);
+            array_commit(r, i, rop);
+        }
+        mpfr_clears(tx, tr, (mpfr_ptr)0);
+    }
+
+    if (a != r) array_release(a);
+    return r;
+}
+
+Array* array_negate(Array* a, mpfr_prec_t precision) {
+    uint32_t n = a->len;
+    Array* r = array_result(a, NULL, n, precision);
+    if (!r) {
+        array_release(a);
+        return NULL;
+    }
+    r->rows = a->rows;
+    r->cols = a->cols;
+
+    if (r->storage == ARRAY_DOUBLE && a->storage == ARRAY_DOUBLE) {
+        for (uint32_t i = 0; i < n; i++) r->data.d[i] = -a->data.d[i];
+    } else {
+        mpfr_t tx, tr;
+        mpfr_inits2(ARRAY_DOUBLE_MAX_PRECISION, tx, tr, (mpfr_ptr)0);
+        for (uint32_t i = 0; i < n; i++) {
+            mpfr_ptr rop = array_target(r, i, tr);
+            mpfr_neg(rop, array_element(a, i, tx), MPFR_RNDN);
+            array_commit(r, i, rop);
+        }
+        mpfr_clears(tx, tr, (mpfr_ptr)0);
+    }
+
+    if (a != r) array_release(a);
+    return r;
+}
+
+Array* array_map(uint16_t builtin, Array* a, mpfr_prec_t precision) {
+    const Builtin* fn = &builtinTable[builtin];
+    uint32_t n = a->len;
+    Array* r = array_result(a, NULL, n, precision);
+    if (!r) {
+        array_release(a);
+        return NULL;
+    }
+    r->rows = a->rows;
+    r->cols = a->cols;
+
+    if (r->storage == ARRAY_DOUBLE && a->storage == ARRAY_DOUBLE && fn->f64) {
+        for (uint32_t i = 0; i < n; i++) r->data.d[i] = fn->f64(a->data.d[i]);
+    } else {
+        mpfr_t tx, tr;
+        mpfr_inits2(ARRAY_DOUBLE_MAX_PRECISION, tx, tr, (mpfr_ptr)0);
+        for (uint32_t i = 0; i < n; i++) {
+            mpfr_ptr rop = array_target(r, i, tr);
+            fn->fn.f1(rop, array_element(a, i, tx), MPFR_RNDN);
+            array_commit(r, i, rop);
+        }
+        mpfr_clears(tx, tr, (mpfr_ptr)0);
+    }
+
+    if (a != r) array_release(a);
+    return r;
+}
+
+// ##############################
+// #####     REDUCTIONS     #####
+// ##############################
+
+void array_sum(const Array* a, mpfr_t rop) {
+    uint32_t n = a->len;
+
+    if (a->storage == ARRAY_DOUBLE) {
+        // Four independent accumulators keep the adds pipelined
+        double acc[4] = { 0, 0, 0, 0 };
+        uint32_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc[0] += a->data.d[i];
+            acc[1] += a->data.d[i + 1];
+            acc[2] += a->data.d[i + 2];
+            acc[3] += a->data.d[i + 3];
+        }
+        for (; i < n; i++) acc[0] += a->data.d[i];
+        mpfr_set_d(rop, (acc[0] + acc[1]) + (acc[2] + acc[3]), MPFR_RNDN);
+        return;
+    }
+
+    // One correctly rounded sum over the whole vector
+    mpfr_ptr* terms = malloc((n ? n : 1) * sizeof(mpfr_ptr));
+    CHECK_NULL(terms, {
+        ERROR_PRINT("Failed to allocate sum terms\n");
+        mpfr_set_nan(rop);
+        return;
+    });
+    for (uint32_t i = 0; i < n; i++) terms[i] = a->data.m[i];
+    mpfr_sum(rop, terms, n, MPFR_RNDN);
+    free(terms);
+}
+
+bool array_dot(const Array* a, const Array* b, mpfr_t rop) {
+    if (a->len != b->len || a->rows != b->rows) {
+        char sa[32], sb[32];
+        ERROR_RETURN(false, "Shape mismatch: %s vs %s\n",
+                     array_shape(a, sa, sizeof(sa)), array_shape(b, sb, sizeof(sb)));
+    }
+    uint32_t n = a->len;
+
+    if (a->storage == ARRAY_DOUBLE && b->storage == ARRAY_DOUBLE) {
+        double acc[4] = { 0, 0, 0, 0 };
+        uint32_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc[0] += a->data.d[i] * b->data.d[i];
+            acc[1] += a->data.d[i + 1] * b->data.d[i + 1];
+            acc[2] += a->data.d[i + 2] * b->data.d[i + 2];
+            acc[3] += a->data.d[i + 3] * b->data.d[i + 3];
+        }
+        for (; i < n; i++) acc[0] += a->data.d[i] * b->data.d[i];
+        mpfr_set_d(rop, (acc[0] + acc[1]) + (acc[2] + acc[3]), MPFR_RNDN);
+        return true;
+    }
+
+    // Fused multiply-add, one rounding per element
+    mpfr_t tx, ty;
+    mpfr_inits2(ARRAY_DOUBLE_MAX_PRECISION, tx, ty, (mpfr_ptr)0);
+    mpfr_set_zero(rop, 1);
+    for (uint32_t i = 0; i < n; i++) {
+        mpfr_fma(rop, array_element(a, i, tx), array_element(b, i, ty), rop, MPFR_RNDN);
+    }
+    mpfr_clears(tx, ty, (mpfr_ptr)0);
+    return true;
+}
+
+// Elements [offset, offset + count) as "[a, b, ...]", long runs show their head and tail
+static void array_print_run(const Array* array, uint32_t offset, uint32_t count, mpfr_t value) {
+    FILE* out = print_output();
+    uint32_t head = count > ARRAY_PRINT_LIMIT ? ARRAY_PRINT_LIMIT / 2 : count;
+    fprintf(out, "[");
+    for (uint32_t i = 0; i < head; i++) {
+        if (i) fprintf(out, ", ");
+        array_get(array, offset + i, value);
+        print_friendly_mpfr_inline(value);
+    }
+    if (count > ARRAY_PRINT_LIMIT) {
+        fprintf(out, ", ...");
+        for (uint32_t i = count - ARRAY_PRINT_LIMIT / 2; i < count; i++) {
+            fprintf(out, ", ");
+            array_get(array, offset + i, value);
+            print_friendly_mpfr_inline(value);
+        }
+    }
+    fprintf(out, "]");
+}
+
+void array_print(const Array* array, const char* label) {
+    FILE* out = print_output();
+    if (label) fprintf(out, "%s: ", label);
+
+    mpfr_t value;
+    mpfr_init2(value, array->storage == ARRAY_DOUBLE ? ARRAY_DOUBLE_MAX_PRECISION : array->precision);
+
+    if (array->rows == 0) {
+        array_print_run(array, 0, array->len, value);
+        if (array->len > ARRAY_PRINT_LIMIT) fprintf(out, " (%u elements)", array->len);
+    } else {
+        // One row per line
+        uint32_t rows = array->rows > ARRAY_PRINT_LIMIT ? ARRAY_PRINT_LIMIT : array->rows;
+        fprintf(out, "[");
+        for (uint32_t r = 0; r < rows; r++) {
+            if (r) fprintf(out, ",\n ");
+            array_print_run(array, r * array->cols, array->cols, value);
+        }
+        if (rows < array->rows) fprintf(out, ",\n ...");
+        fprintf(out, "]");
+        if (array->rows > ARRAY_PRINT_LIMIT || array->cols > ARRAY_PRINT_LIMIT) {
+            fprintf(out, " (%ux%u)", array->rows, array->cols);
+        }
+    }
+    fprintf(out, "\n");
+
+    mpfr_clear(value);
+}
+
+const char* array_shape(const Array* array, char* buffer, size_t size) {
+    if (array->rows) snprintf(buffer, size, "%ux%u", array->rows, array->cols);
+    else snprintf(buffer, size, "[%u]", array->len);
+    return buffer;
+}
@@ -0,0 +1,288 @@
+#include "builtins.h"
+#include "debug.h"
+#include <gmp.h>
+#include <math.h>
+#include <mpfr.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CONSTANT_CACHE_SLOTS 4
+#define POWER_Z_MAX_EXP 256 // larger integer exponents overflow anyway, mpfr_pow sorts them out
+// ns per unit of each cost model, measured on MPFR 4 and rounded up
+#define COST_ELEMENTARY_NS 2.5   // x p log2(p)^2
+#define COST_SERIES_NS 1e-3      // x p^3
+#define COST_ZETA_NS 7.5e-3      // x p^3
+#define LOG2_E 1.4426950408889634
+#define LOG2_10 3.3219280948873622
+
+static int const_e(mpfr_ptr rop, mpfr_rnd_t rnd) {
+    mpfr_set_ui(rop, 1, MPFR_RNDN);
+    return mpfr_exp(rop, rop, rnd);
+}
+
+#define FUNC1(name, f, d) { name, BUILTIN_FUNCTION, 1, { .f1 = f }, d, BUILTIN_COST_CHEAP, 0 }
+#define FUNC2(name, f) { name, BUILTIN_FUNCTION, 2, { .f2 = f }, NULL, BUILTIN_COST_CHEAP, 0 }
+// Functions whose time (cost) or result size (growth) can run away with the argument
+#define HEAVY1(name, f, d, cost, growth) { name, BUILTIN_FUNCTION, 1, { .f1 = f }, d, BUILTIN_COST_##cost, growth }
+#define HEAVY2(name, f, cost) { name, BUILTIN_FUNCTION, 2, { .f2 = f }, NULL, BUILTIN_COST_##cost, 0 }
+#define CONST(name, f) { name, BUILTIN_CONSTANT, 0, { .constant = f }, NULL, BUILTIN_COST_CHEAP, 0 }
+#define ARRAY(name, arity, op) { name, BUILTIN_ARRAY, arity, { .array = op }, NULL, BUILTIN_COST_CHEAP, 0 }
+
+const Builtin builtinTable[] = {
+    FUNC1("sqrt", mpfr_sqrt, sqrt),
+    FUNC1("cbrt", mpfr_cbrt, cbrt),
+    FUNC1("abs", mpfr_abs, fabs),
+    HEAVY1("exp", mpfr_exp, exp, ELEMENTARY, LOG2_E),
+    HEAVY1("exp2", mpfr_exp2, exp2, ELEMENTARY, 1),
+    HEAVY1("exp10", mpfr_exp10, NULL, ELEMENTARY, LOG2_10),
+    HEAVY1("expm1", mpfr_expm1, expm1, ELEMENTARY, 0),
+    HEAVY1("log", mpfr_log, log, ELEMENTARY, 0),
+    HEAVY1("ln", mpfr_log, log, ELEMENTARY, 0),
+    HEAVY1("log2", mpfr_log2, log2, ELEMENTARY, 0),
+    HEAVY1("log10", mpfr_log10, log10, ELEMENTARY, 0),
+    HEAVY1("log1p", mpfr_log1p, log1p, ELEMENTARY, 0),
+    HEAVY1("sin", mpfr_sin, sin, PERIODIC, 0),
+    HEAVY1("cos", mpfr_cos, cos, PERIODIC, 0),
+    HEAVY1("tan", mpfr_tan, tan, PERIODIC, 0),
+    HEAVY1("sec", mpfr_sec, NULL, PERIODIC, 0),
+    HEAVY1("csc", mpfr_csc, NULL, PERIODIC, 0),
+    HEAVY1("cot", mpfr_cot, NULL, PERIODIC, 0),
+    HEAVY1("asin", mpfr_asin, asin, ELEMENTARY, 0),
+    HEAVY1("acos", mpfr_acos, acos, ELEMENTARY, 0),
+    HEAVY1("atan", mpfr_atan, atan, ELEMENTARY, 0),
+    HEAVY1("sinh", mpfr_sinh, sinh, ELEMENTARY, LOG2_E),
+    HEAVY1("cosh", mpfr_cosh, cosh, ELEMENTARY, LOG2_E),
+    HEAVY1("tanh", mpfr_tanh, tanh, ELEMENTARY, 0),
+    HEAVY1("asinh", mpfr_asinh, asinh, ELEMENTARY, 0),
+    HEAVY1("acosh", mpfr_acosh, acosh, ELEMENTARY, 0),
+    HEAVY1("atanh", mpfr_atanh, atanh, ELEMENTARY, 0),
+    HEAVY1("gamma", mpfr_gamma, tgamma, GAMMA, 0),
+    HEAVY1("lngamma", mpfr_lngamma, NULL, SERIES, 0),
+    HEAVY1("digamma", mpfr_digamma, NULL, SERIES, 0),
+    HEAVY1("zeta", mpfr_zeta, NULL, ZETA, 0),
+    HEAVY1("erf", mpfr_erf, erf, ELEMENTARY, 0),
+    HEAVY1("erfc", mpfr_erfc, erfc, ELEMENTARY, 0),
+    FUNC1("floor", mpfr_rint_floor, floor),
+    FUNC1("ceil", mpfr_rint_ceil, ceil),
+    FUNC1("round", mpfr_rint_round, round),
+    FUNC1("trunc", mpfr_rint_trunc, trunc),
+    HEAVY2("atan2", mpfr_atan2, ELEMENTARY),
+    FUNC2("hypot", mpfr_hypot),
+    HEAVY2("agm", mpfr_agm, ELEMENTARY),
+    HEAVY2("fmod", mpfr_fmod, PERIODIC),
+    FUNC2("min", mpfr_min),
+    FUNC2("max", mpfr_max),
+    ARRAY("sum", 1, ARRAY_BUILTIN_SUM),
+    ARRAY("dot", 2, ARRAY_BUILTIN_DOT),
+    ARRAY("len", 1, ARRAY_BUILTIN_LEN),
+    ARRAY("transpose", 1, ARRAY_BUILTIN_TRANSPOSE),
+    ARRAY("solve", 2, ARRAY_BUILTIN_SOLVE),
+    ARRAY("det", 1, ARRAY_BUILTIN_DET),
+    CONST("pi", mpfr_const_pi),
+    CONST("e", const_e),
+    CONST("ln2", mpfr_const_log2),
+    CONST("euler", mpfr_const_euler),
+    CONST("catalan", mpfr_const_catalan),
+};
+
+const uint16_t builtinCount = sizeof(builtinTable) / sizeof(builtinTable[0]);
+
+// Open addressing over the names, slots hold index + 1 (0 -> empty)
+static uint16_t lookupSlots[BUILTIN_LOOKUP_SIZE];
+
+// Constants are computed once per precision, a few precisions are kept
+typedef struct ConstantSlot{
+    mpfr_t value;
+    bool valid;
+} ConstantSlot;
+
+static ConstantSlot constantCache[sizeof(builtinTable) / sizeof(builtinTable[0])][CONSTANT_CACHE_SLOTS];
+static uint8_t constantNext[sizeof(builtinTable) / sizeof(builtinTable[0])];
+static pthread_mutex_t constantLock = PTHREAD_MUTEX_INITIALIZER; // workers may ask concurrently
+
+static inline uint32_t hash_builtin(const char* str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void builtins_build_lookup() {
+    memset(lookupSlots, 0, sizeof(lookupSlots));
+
+    for (uint16_t i = 0; i < builtinCount; i++) {
+        const char* name = builtinTable[i].name;
+        uint32_t slot = hash_builtin(name, strlen(name)) & (BUILTIN_LOOKUP_SIZE - 1);
+        while (lookupSlots[slot]) slot = (slot + 1) & (BUILTIN_LOOKUP_SIZE - 1);
+        lookupSlots[slot] = i + 1;
+    }
+
+    DEBUG_PRINT("Built-in table ready: %u names\n", builtinCount);
+}
+
+// Every token buffer calls it, the table is built by the first one only
+void builtins_init() {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, builtins_build_lookup);
+}
+
+void builtins_free_cache() {
+    pthread_mutex_lock(&constantLock);
+    for (uint16_t i = 0; i < builtinCount; i++) {
+        for (uint8_t s = 0; s < CONSTANT_CACHE_SLOTS; s++) {
+            if (constantCache[i][s].valid) {
+                mpfr_clear(constantCache[i][s].value);
+                constantCache[i][s].valid = false;
+            }
+        }
+    }
+    pthread_mutex_unlock(&constantLock);
+}
+
+int builtin_lookup(const char* name, uint8_t len) {
+    uint32_t slot = hash_builtin(name, len) & (BUILTIN_LOOKUP_SIZE - 1);
+    while (lookupSlots[slot]) {
+        const char* candidate = builtinTable[lookupSlots[slot] - 1].name;
+        if (strncmp(candidate, name, len) == 0 && candidate[len] == '\0') {
+            return lookupSlots[slot] - 1;
+        }
+        slot = (slot + 1) & (BUILTIN_LOOKUP_SIZE - 1);
+    }
+    return -1;
+}
+
+bool builtin_call(uint16_t id, mpfr_t rop, mpfr_t* const* args) {
+    const Builtin* builtin = &builtinTable[id];
+    bool nan_input = false;
+
+    switch (builtin->arity) {
+        case 1:
+            builtin->fn.f1(rop, *args[0], MPFR_RNDN);
+            nan_input = mpfr_nan_p(*args[0]);
+            break;
+        case 2:
+            builtin->fn.f2(rop, *args[0], *args[1], MPFR_RNDN);
+            nan_input = mpfr_nan_p(*args[0]) || mpfr_nan_p(*args[1]);
+            break;
+        default:
+            ERROR_PRINT("Unsupported arity %u for %s\n", builtin->arity, builtin->name);
+            mpfr_set_nan(rop);
+            return false;
+    }
+
+    return nan_input || !mpfr_nan_p(rop);
+}
+
+void builtin_constant(uint16_t id, mpfr_t rop) {
+    mpfr_prec_t prec = mpfr_get_prec(rop);
+    ConstantSlot* slots = constantCache[id];
+
+    pthread_mutex_lock(&constantLock);
+    for (uint8_t s = 0; s < CONSTANT_CACHE_SLOTS; s++) {
+        if (slots[s].valid && mpfr_get_prec(slots[s].value) == prec) {
+            mpfr_set(rop, slots[s].value, MPFR_RNDN);
+            pthread_mutex_unlock(&constantLock);
+            return;
+        }
+    }
+
+    ConstantSlot* slot = &slots[constantNext[id]];
+    constantNext[id] = (constantNext[id] + 1) % CONSTANT_CACHE_SLOTS;
+    if (slot->valid) mpfr_set_prec(slot->value, prec);
+    else mpfr_init2(slot->value, prec);
+    slot->valid = true;
+
+    builtinTable[id].fn.constant(slot->value, MPFR_RNDN);
+    DEBUG_PRINT("Constant %s computed at %ld bits\n", builtinTable[id].name, (long)prec);
+    mpfr_set(rop, slot->value, MPFR_RNDN);
+    pthread_mutex_unlock(&constantLock);
+}
+
+void builtin_power(mpfr_ptr rop, mpfr_srcptr x, mpfr_srcptr y) {
+    if (!mpfr_integer_p(y)) {
+        mpfr_pow(rop, x, y, MPFR_RNDN);
+    } else if (mpfr_fits_slong_p(y, MPFR_RNDN)) {
+        mpfr_pow_si(rop, x, mpfr_get_si(y, MPFR_RNDN), MPFR_RNDN);
+    } else if (mpfr_get_exp(y) <= POWER_Z_MAX_EXP) {
+        mpz_t n;
+        mpz_init(n);
+        mpfr_get_z(n, y, MPFR_RNDN);
+        mpfr_pow_z(rop, x, n, MPFR_RNDN);
+        mpz_clear(n);
+    } else {
+        mpfr_pow(rop, x, y, MPFR_RNDN);
+    }
+}
+
+static inline double elementary_ns(double bits) {
+    double log_bits = log2(bits);
+    return COST_ELEMENTARY_NS * bits * log_bits * log_bits;
+}
+
+// |x| as a double, +inf beyond its range
+static inline double magnitude(mpfr_srcptr x) {
+    return fabs(mpfr_get_d(x, MPFR_RNDN));
+}
+
+BuiltinEstimate builtin_estimate(uint16_t id, mpfr_t* const* args, mpfr_prec_t precision) {
+    const Builtin* builtin = &builtinTable[id];
+    BuiltinEstimate estimate = { 0, 0 };
+    mpfr_srcptr x = *args[0];
+    if (builtin->kind != BUILTIN_FUNCTION || !mpfr_regular_p(x)) return estimate;
+
+    double p = (double)precision;
+    double size = magnitude(x);
+    if (builtin->growth) estimate.exponent = size * builtin->growth;
+    switch (builtin->cost) {
+        case BUILTIN_COST_CHEAP:
+            break;
+        case BUILTIN_COST_ELEMENTARY:
+            estimate.ns = elementary_ns(p);
+            break;
+        case BUILTIN_COST_PERIODIC: {
+            // fmod(x, y) reduces by y the way sin(x) reduces by pi
+            mpfr_exp_t exp = mpfr_get_exp(x);
+            estimate.ns = elementary_ns(p + (exp > 0 ? (double)exp : 0));
+            break;
+        }
+        case BUILTIN_COST_GAMMA:
+            if (mpfr_sgn(x) > 0) {
+                // log2 gamma(x), lgamma() is finite for any double
+                estimate.exponent = lgamma(size) * LOG2_E;
+                // Integers whose factorial fits the precision are exact products
+                if (mpfr_integer_p(x) && estimate.exponent <= p) {
+                    estimate.ns = elementary_ns(p);
+                    break;
+                }
+            }
+            // fall through
+        case BUILTIN_COST_SERIES:
+            // Arguments past the precision need fewer terms
+            estimate.ns = COST_SERIES_NS * p * p * p / (size > p ? size / p : 1);
+            break;
+        case BUILTIN_COST_ZETA: {
+            double log_p = log2(p);
+            estimate.ns = COST_ZETA_NS * p * p * p / (size > log_p ? size / log_p : 1);
+            break;
+        }
+    }
+    return estimate;
+}
+
+BuiltinEstimate builtin_power_estimate(mpfr_srcptr x, mpfr_srcptr y, mpfr_prec_t precision) {
+    BuiltinEstimate estimate = { 0, 0 };
+    if (!mpfr_regular_p(x) || !mpfr_regular_p(y)) return estimate;
+    // log2|x| from the exponent and the leading bits
+    long exp;
+    double mantissa = mpfr_get_d_2exp(&exp, x, MPFR_RNDN);
+    double log_x = (double)exp + log2(fabs(mantissa));
+    if (log_x != 0) estimate.exponent = fabs(log_x) * magnitude(y);
+    // Integer exponents are a chain of squarings, the others exp(y log x)
+    if (!mpfr_integer_p(y)) estimate.ns = 2 * elementary_ns((double)precision);
+    return estimate;
+}
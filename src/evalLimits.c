@@ -0,0 +1,107 @@
+#include "evalLimits.h"
+#include "mpMemory.h"
+#include "stats.h"
+#include "debug.h"
+#include <mpfr.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Limits* limits_create() {
+    Limits* limits = calloc(1, sizeof(Limits));
+    CHECK_NULL(limits, ERROR_RETURN_NULL("Failed to allocate Limits"));
+    atomic_init(&limits->tripped, LIMIT_NONE);
+    return limits;
+}
+
+void limits_destroy(Limits* limits) {
+    free(limits);
+}
+
+void limits_show(const Limits* limits, FILE* out) {
+    CHECK_NULL(limits, return);
+    fprintf(out, "Limits per expression:\n");
+    if (limits->time_ns) fprintf(out, "  time:     %llu ms\n", (unsigned long long)(limits->time_ns / 1000000));
+    else fprintf(out, "  time:     off\n");
+    if (limits->memory) fprintf(out, "  memory:   %lld bytes of GMP/MPFR allocations\n", (long long)limits->memory);
+    else fprintf(out, "  memory:   off\n");
+    if (limits->exponent) fprintf(out, "  exponent: 2^%ld\n", (long)limits->exponent);
+    else fprintf(out, "  exponent: off\n");
+}
+
+bool limits_set(Limits* limits, const char* name, long long value) {
+    if (value < 0) return false;
+    if (strcmp(name, "time") == 0) {
+        limits->time_ns = (uint64_t)value * 1000000;
+    } else if (strcmp(name, "memory") == 0) {
+        limits->memory = value;
+    } else if (strcmp(name, "exponent") == 0) {
+        limits->exponent = value > mpfr_get_emax_max() ? mpfr_get_emax_max() : (mpfr_exp_t)value;
+    } else {
+        return false;
+    }
+    limits->active = limits->time_ns || limits->memory || limits->exponent;
+    return true;
+}
+
+void limits_begin(Limits* limits, mpfr_prec_t precision, bool serial) {
+    atomic_store(&limits->tripped, LIMIT_NONE);
+    limits->serial = serial;
+    if (!limits->active) {
+        if (serial) mp_memory_set_thread_ceiling(0);
+        else mp_memory_set_ceiling(0);
+        return;
+    }
+    // Expensive nodes make a clock read per node negligible
+    limits->check_steps = precision > LIMITS_CHEAP_PRECISION ? 0 : LIMITS_CHECK_STEPS;
+    limits->deadline = limits->time_ns ? stats_now() + limits->time_ns : 0;
+    if (serial) mp_memory_set_thread_ceiling(limits->memory ? mp_memory_thread_current() + limits->memory : 0);
+    else mp_memory_set_ceiling(limits->memory ? mp_memory_current() + limits->memory : 0);
+}
+
+bool limits_poll(Limits* limits) {
+    if (limits->deadline && stats_now() > limits->deadline) return limits_trip(limits, LIMIT_TIME);
+    if (limits->memory && (limits->serial ? mp_memory_thread_ceiling_hit() : mp_memory_ceiling_hit())) {
+        return limits_trip(limits, LIMIT_MEMORY);
+    }
+    return true;
+}
+
+bool limits_admit(Limits* limits, double exponent, double ns) {
+    // The estimate may be off by one, the value itself is checked afterwards
+    if (limits->exponent && exponent > (double)limits->exponent + 1) return limits_trip(limits, LIMIT_EXPONENT);
+    if (limits->deadline && ns >= LIMITS_ADMIT_NS && (double)stats_now() + ns > (double)limits->deadline) {
+        return limits_trip(limits, LIMIT_TIME_AHEAD);
+    }
+    return true;
+}
+
+LimitKind limits_end(Limits* limits) {
+    return (LimitKind)atomic_load(&limits->tripped);
+}
+
+void limits_report(const Limits* limits, LimitKind kind) {
+    switch (kind) {
+        case LIMIT_TIME:
+            ERROR_PRINT("Evaluation cancelled: it ran past the time limit of %llu ms\n",
+                        (unsigned long long)(limits->time_ns / 1000000));
+            break;
+        case LIMIT_TIME_AHEAD:
+            ERROR_PRINT("Evaluation cancelled: a single function call or power would run past the time limit of %llu ms\n",
+                        (unsigned long long)(limits->time_ns / 1000000));
+            break;
+        case LIMIT_MEMORY:
+            ERROR_PRINT("Evaluation cancelled: it allocated more than the memory limit of %lld bytes\n",
+                        (long long)limits->memory);
+            break;
+        case LIMIT_EXPONENT:
+            ERROR_PRINT("Evaluation cancelled: an intermediate value had a binary exponent beyond +-%ld\n",
+                        (long)limits->exponent);
+            break;
+        case LIMIT_NONE:
+            break;
+    }
+}
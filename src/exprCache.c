@@ -0,0 +1,203 @@
+#include "exprCache.h"
+#include "parser.h"
+#include "debug.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint32_t hash_text(const char* str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static inline void lru_unlink(ExprCache* cache, ExprCacheEntry* entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else cache->lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache->lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static inline void lru_push_front(ExprCache* cache, ExprCacheEntry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) cache->lru_head->lru_prev = entry;
+    cache->lru_head = entry;
+    if (!cache->lru_tail) cache->lru_tail = entry;
+}
+
+static void expr_cache_remove(ExprCache* cache, ExprCacheEntry* entry) {
+    ExprCacheEntry** link = &cache->buckets[entry->hash % cache->capacity];
+    while (*link && *link != entry) link = &(*link)->next;
+    if (*link) *link = entry->next;
+
+    lru_unlink(cache, entry);
+    cache->used -= entry->expr->bytes;
+    cache->count--;
+
+    DEBUG_CACHE("Evicted '%s' (%zu bytes)\n", entry->expr->text, entry->expr->bytes);
+    expr_release(entry->expr);
+    free(entry);
+}
+
+static void expr_cache_trim(ExprCache* cache) {
+    while (cache->used > cache->budget && cache->lru_tail) {
+        expr_cache_remove(cache, cache->lru_tail);
+        cache->evictions++;
+    }
+}
+
+static void expr_cache_resize(ExprCache* cache, uint32_t new_capacity) {
+    DEBUG_FUNCTION_ENTER();
+
+    ExprCacheEntry** new_buckets = calloc(new_capacity, sizeof(ExprCacheEntry*));
+    CHECK_NULL(new_buckets, {
+        ERROR_PRINT("Failed to allocate new cache buckets\n");
+        return;
+    });
+
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        ExprCacheEntry* current = cache->buckets[i];
+        while (current) {
+            ExprCacheEntry* next = current->next;
+            uint32_t index = current->hash % new_capacity;
+            current->next = new_buckets[index];
+            new_buckets[index] = current;
+            current = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = new_buckets;
+    cache->capacity = new_capacity;
+
+    DEBUG_CACHE("Cache resized to %u buckets\n", new_capacity);
+    DEBUG_FUNCTION_EXIT();
+}
+
+ExprCache* expr_cache_create(size_t budget) {
+    DEBUG_FUNCTION_ENTER();
+
+    ExprCache* cache = calloc(1, sizeof(ExprCache));
+    CHECK_NULL(cache, ERROR_RETURN_NULL("Failed to allocate ExprCache"));
+
+    cache->buckets = calloc(EXPR_CACHE_BASE_SIZE, sizeof(ExprCacheEntry*));
+    CHECK_NULL(cache->buckets, {
+        free(cache);
+        ERROR_RETURN_NULL("Failed to allocate cache buckets");
+    });
+
+    cache->capacity = EXPR_CACHE_BASE_SIZE;
+    cache->budget = budget;
+
+    DEBUG_CACHE("Expression cache created: budget=%zu bytes\n", budget);
+    DEBUG_FUNCTION_EXIT();
+    return cache;
+}
+
+void expr_cache_clear(ExprCache* cache) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(cache, return);
+
+    while (cache->lru_head) expr_cache_remove(cache, cache->lru_head);
+
+    DEBUG_FUNCTION_EXIT();
+}
+
+void expr_cache_destroy(ExprCache* cache) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(cache, return);
+
+    expr_cache_clear(cache);
+    free(cache->buckets);
+    free(cache);
+
+    DEBUG_FUNCTION_EXIT();
+}
+
+void expr_cache_set_budget(ExprCache* cache, size_t budget) {
+    CHECK_NULL(cache, return);
+    cache->budget = budget;
+    expr_cache_trim(cache);
+}
+
+Expr* expr_cache_get(ExprCache* cache, const char* text, uint32_t len) {
+    CHECK_NULL(cache, ERROR_RETURN_NULL("Cache is NULL"));
+    CHECK_NULL(text, ERROR_RETURN_NULL("Text is NULL"));
+
+    uint32_t hash = hash_text(text, len);
+    ExprCacheEntry* current = cache->buckets[hash % cache->capacity];
+
+    while (current) {
+        if (current->hash == hash && current->expr->len == len &&
+            memcmp(current->expr->text, text, len) == 0) {
+            if (cache->lru_head != current) {
+                lru_unlink(cache, current);
+                lru_push_front(cache, current);
+            }
+            cache->hits++;
+            current->expr->refs++;
+            DEBUG_CACHE("Hit: '%.*s'\n", (int)len, text);
+            return current->expr;
+        }
+        current = current->next;
+    }
+
+    cache->misses++;
+    DEBUG_CACHE("Miss: '%.*s'\n", (int)len, text);
+    return NULL;
+}
+
+bool expr_cache_put(ExprCache* cache, Expr* expr) {
+    CHECK_NULL(cache, ERROR_RETURN(false, "Cache is NULL"));
+    CHECK_NULL(expr, ERROR_RETURN(false, "Expression is NULL"));
+
+    if (expr->bytes > cache->budget) {
+        DEBUG_CACHE("Not caching '%s': %zu bytes over budget\n", expr->text, expr->bytes);
+        return false;
+    }
+
+    if (cache->count > cache->capacity * THRESHOLD_CACHE) {
+        expr_cache_resize(cache, cache->capacity << 1);
+    }
+
+    ExprCacheEntry* entry = malloc(sizeof(ExprCacheEntry));
+    CHECK_NULL(entry, ERROR_RETURN(false, "Failed to allocate cache entry"));
+
+    entry->expr = expr;
+    entry->hash = hash_text(expr->text, expr->len);
+    expr->refs++;
+
+    uint32_t index = entry->hash % cache->capacity;
+    entry->next = cache->buckets[index];
+    cache->buckets[index] = entry;
+    lru_push_front(cache, entry);
+
+    cache->used += expr->bytes;
+    cache->count++;
+    expr_cache_trim(cache);
+
+    DEBUG_CACHE("Stored '%s' (%zu bytes, %zu/%zu used)\n",
+                expr->text, expr->bytes, cache->used, cache->budget);
+    return true;
+}
+
+void expr_cache_show(ExprCache* cache) {
+    CHECK_NULL(cache, return);
+
+    uint64_t lookups = cache->hits + cache->misses;
+    printf("=== === Expression cache === ===\n");
+    printf("-- entries : %u\n", cache->count);
+    printf("-- memory  : %zu / %zu bytes\n", cache->used, cache->budget);
+    printf("-- hits    : %llu (%.1f%%)\n", (unsigned long long)cache->hits,
+           lookups ? (double)cache->hits / lookups * 100 : 0.0);
+    printf("-- misses  : %llu\n", (unsigned long long)cache->misses);
+    printf("-- evicted : %llu\n", (unsigned long long)cache->evictions);
+    printf("==== === === === === === === ====\n");
+}
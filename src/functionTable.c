@@ -0,0 +1,177 @@
+#include "functionTable.h"
+#include "parser.h"
+#include "debug.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint32_t hash_name(const char* str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= str[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+FunctionTable* function_table_create() {
+    DEBUG_FUNCTION_ENTER();
+
+    FunctionTable* table = malloc(sizeof(FunctionTable));
+    CHECK_NULL(table, ERROR_RETURN_NULL("Failed to allocate FunctionTable"));
+
+    table->capacity = FUNCTION_MAP_BASE_SIZE;
+    table->count = 0;
+    table->impure_count = 0;
+    table->writer_count = 0;
+    table->buckets = calloc(FUNCTION_MAP_BASE_SIZE, sizeof(Function*));
+    CHECK_NULL(table->buckets, {
+        free(table);
+        ERROR_RETURN_NULL("Failed to allocate function buckets");
+    });
+
+    DEBUG_PRINT("Function table created: capacity=%d\n", FUNCTION_MAP_BASE_SIZE);
+    DEBUG_FUNCTION_EXIT();
+    return table;
+}
+
+void function_table_empty(FunctionTable* table) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(table, return);
+
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        Function* current = table->buckets[i];
+        while (current) {
+            Function* next = current->next;
+            DEBUG_PRINT("Freeing function: '%s'\n", current->name);
+            expr_release(current->expr);
+            free(current->name);
+            free(current);
+            current = next;
+        }
+        table->buckets[i] = NULL;
+    }
+    table->count = 0;
+    table->impure_count = 0;
+    table->writer_count = 0;
+
+    DEBUG_FUNCTION_EXIT();
+}
+
+void function_table_destroy(FunctionTable* table) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(table, return);
+
+    function_table_empty(table);
+    free(table->buckets);
+    free(table);
+
+    DEBUG_FUNCTION_EXIT();
+}
+
+static void function_table_resize(FunctionTable* table, uint32_t new_capacity) {
+    Function** new_buckets = calloc(new_capacity, sizeof(Function*));
+    CHECK_NULL(new_buckets, {
+        ERROR_PRINT("Failed to allocate new function buckets\n");
+        return;
+    });
+
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        Function* current = table->buckets[i];
+        while (current) {
+            Function* next = current->next;
+            uint32_t index = hash_name(current->name, current->len) % new_capacity;
+            current->next = new_buckets[index];
+            new_buckets[index] = current;
+            current = next;
+        }
+    }
+
+    free(table->buckets);
+    table->buckets = new_buckets;
+    table->capacity = new_capacity;
+}
+
+Function* function_table_define(FunctionTable* table, const char* name, uint8_t nameLen,
+                                Expr* expr, ASTNode* body, uint32_t param_count) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(table, ERROR_RETURN_NULL("Table is NULL"));
+    CHECK_NULL(name, ERROR_RETURN_NULL("Function name is NULL"));
+    CHECK_NULL(expr, ERROR_RETURN_NULL("Function expression is NULL"));
+
+    // The new body may come from the very line that defined the old one
+    expr->refs++;
+
+    Function* fn = function_table_get(table, name, nameLen);
+    if (fn) {
+        DEBUG_PRINT("Redefining function '%.*s'\n", nameLen, name);
+        expr_release(fn->expr);
+        if (!fn->pure) table->impure_count--;
+        if (fn->writes) table->writer_count--;
+    } else {
+        if (table->count > table->capacity * 0.75) {
+            function_table_resize(table, table->capacity << 1);
+        }
+
+        fn = malloc(sizeof(Function));
+        CHECK_NULL(fn, {
+            expr_release(expr);
+            ERROR_RETURN_NULL("Failed to allocate function");
+        });
+        fn->name = strndup(name, nameLen);
+        CHECK_NULL(fn->name, {
+            free(fn);
+            expr_release(expr);
+            ERROR_RETURN_NULL("Failed to duplicate function name");
+        });
+        fn->len = nameLen;
+
+        uint32_t index = hash_name(name, nameLen) % table->capacity;
+        fn->next = table->buckets[index];
+        table->buckets[index] = fn;
+        table->count++;
+    }
+
+    fn->expr = expr;
+    fn->body = body;
+    fn->param_count = param_count;
+    fn->pure = body->weight != 0;
+    fn->writes = expr->writes;
+    if (!fn->pure) table->impure_count++;
+    if (fn->writes) table->writer_count++;
+
+    DEBUG_PRINT("Function defined: %s/%u\n", fn->name, param_count);
+    DEBUG_FUNCTION_EXIT();
+    return fn;
+}
+
+Function* function_table_get(FunctionTable* table, const char* name, uint8_t nameLen) {
+    CHECK_NULL(table, ERROR_RETURN_NULL("Table is NULL"));
+    CHECK_NULL(name, ERROR_RETURN_NULL("Function name is NULL"));
+
+    Function* current = table->buckets[hash_name(name, nameLen) % table->capacity];
+    while (current) {
+        if (current->len == nameLen && memcmp(current->name, name, nameLen) == 0) {
+            return current;
+        }
+        current = current->next;
+    }
+    return NULL;
+}
+
+void function_table_show(FunctionTable* table) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(table, return);
+
+    printf("=== === === Functions === === ===\n");
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        for (Function* fn = table->buckets[i]; fn; fn = fn->next) {
+            printf("-- %s\n", fn->expr->text);
+        }
+    }
+    printf("==== === === === === === === ====\n");
+
+    DEBUG_FUNCTION_EXIT();
+}
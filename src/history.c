@@ -0,0 +1,129 @@
+#include "history.h"
+#include "array.h"
+#include "symbolTable.h"
+#include "debug.h"
+#include <mpfr.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static inline uint32_t slot_after(uint32_t slot) {
+    return slot + 1 == HISTORY_SLOTS ? 0 : slot + 1;
+}
+
+// Points every slot at its part of a new slab, the values are NaN
+static mp_limb_t* history_slab(mpfr_prec_t precision, HistorySlot* slots) {
+    size_t count = mpfr_custom_get_size(precision) / sizeof(mp_limb_t);
+    mp_limb_t* limbs = malloc(HISTORY_SLOTS * count * sizeof(mp_limb_t));
+    CHECK_NULL(limbs, ERROR_RETURN_NULL("Failed to allocate history limbs (%ld bits)\n", (long)precision));
+    for (uint32_t i = 0; i < HISTORY_SLOTS; i++) {
+        mpfr_custom_init_set(slots[i].num, MPFR_NAN_KIND, 0, precision, limbs + i * count);
+    }
+    return limbs;
+}
+
+History* history_create(mpfr_prec_t precision) {
+    DEBUG_FUNCTION_ENTER();
+
+    History* history = calloc(1, sizeof(History));
+    CHECK_NULL(history, ERROR_RETURN_NULL("Failed to allocate History"));
+    history->limbs = history_slab(precision, history->slots);
+    CHECK_NULL(history->limbs, {
+        free(history);
+        return NULL;
+    });
+    history->precision = precision;
+
+    DEBUG_PRINT("History created: %d results at %ld bits\n", HISTORY_SIZE, (long)precision);
+    DEBUG_FUNCTION_EXIT();
+    return history;
+}
+
+void history_destroy(History* history) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(history, return);
+    history_empty(history);
+    free(history->limbs); // custom values, nothing to clear
+    free(history);
+    DEBUG_FUNCTION_EXIT();
+}
+
+void history_empty(History* history) {
+    CHECK_NULL(history, return);
+    for (uint32_t i = 0; i < HISTORY_SLOTS; i++) {
+        array_release(history->slots[i].array);
+        history->slots[i].array = NULL;
+    }
+    history->head = 0;
+    history->count = 0;
+    history->array_count = 0;
+}
+
+bool history_set_precision(History* history, mpfr_prec_t precision) {
+    CHECK_NULL(history, ERROR_RETURN(false, "History is NULL"));
+    if (precision == history->precision) return true;
+
+    HistorySlot rounded[HISTORY_SLOTS];
+    mp_limb_t* limbs = history_slab(precision, rounded);
+    CHECK_NULL(limbs, return false);
+    for (uint32_t i = 0; i < HISTORY_SLOTS; i++) {
+        mpfr_set(rounded[i].num, history->slots[i].num, MPFR_RNDN);
+        rounded[i].array = history->slots[i].array;
+    }
+
+    free(history->limbs);
+    for (uint32_t i = 0; i < HISTORY_SLOTS; i++) history->slots[i] = rounded[i];
+    history->limbs = limbs;
+    history->precision = precision;
+    return true;
+}
+
+mpfr_t* history_next(History* history) {
+    return &history->slots[slot_after(history->head)].num;
+}
+
+void history_commit(History* history, Array* array) {
+    history->head = slot_after(history->head);
+    HistorySlot* slot = &history->slots[history->head];
+    if (array) {
+        array->refs++;
+        history->array_count++;
+    }
+    slot->array = array;
+    if (history->count < HISTORY_SIZE) history->count++;
+
+    // The result that fell off ($17) lets go of its vector now
+    HistorySlot* dropped = &history->slots[slot_after(history->head)];
+    if (dropped->array) {
+        array_release(dropped->array);
+        dropped->array = NULL;
+        history->array_count--;
+    }
+}
+
+HistorySlot* history_get(History* history, uint32_t n) {
+    if (n == 0 || n > history->count) return NULL;
+    uint32_t back = n - 1;
+    uint32_t slot = history->head >= back ? history->head - back : history->head + HISTORY_SLOTS - back;
+    return &history->slots[slot];
+}
+
+void history_show(History* history) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(history, return);
+
+    if (!history->count) {
+        fprintf(print_output(), "No results yet\n");
+        DEBUG_FUNCTION_EXIT();
+        return;
+    }
+    char label[16];
+    for (uint32_t n = 1; n <= history->count; n++) {
+        HistorySlot* slot = history_get(history, n);
+        snprintf(label, sizeof(label), "$%u", n);
+        if (slot->array) array_print(slot->array, label);
+        else print_friendly_mpfr(slot->num, label);
+    }
+    DEBUG_FUNCTION_EXIT();
+}
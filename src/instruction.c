@@ -1,6 +1,17 @@
 #include "instructions.h"
+#include "array.h"
+#include "builtins.h"
+#include "evalLimits.h"
+#include "exprCache.h"
+#include "history.h"
+#include "mpMemory.h"
+#include "pipeline.h"
+#include "server.h"
+#include "stats.h"
 #include "symbolTable.h"
+#include "trace.h"
 #include "debug.h"  // <-- Añadir esta línea
+#include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -11,15 +22,16 @@
 // ######       Special Functions       #####
 // ##########################################
 
-static void exit_command(void* args) {
+static bool exit_command(void* args) {
     DEBUG_FUNCTION_ENTER();
     App *app = (App *)args;
     app->run = false;
     DEBUG_INSTR("Exit command executed\n");
     DEBUG_FUNCTION_EXIT();
+    return true;
 }
 
-static void clear_command(void* args) {
+static bool clear_command(void* args) {
     DEBUG_FUNCTION_ENTER();
     DEBUG_INSTR("Clear command executed\n");
     #ifdef _WIN32
@@ -28,49 +40,365 @@ static void clear_command(void* args) {
         system("clear");
     #endif
     DEBUG_FUNCTION_EXIT();
+    return true;
 }
 
-static void help_command(void* args) {
+static bool help_command(void* args) {
     DEBUG_FUNCTION_ENTER();
     DEBUG_INSTR("Help command executed\n");
     printf("|(Explanation about apps) and commands :                            |\n");
     printf("| -exit : to escape from app                                        |\n");
     printf("| -clear : to clean terminal                                        |\n");
-    printf("| -clear-vars : to delete all variables, if not you can re define it|\n");
+    printf("| -clear-vars : to delete all variables and the result history      |\n");
+    printf("| -clear-funcs : to delete all user defined functions               |\n");
     printf("| -help : to see the commands                                       |\n");
-    printf("| -show : to see the current variables                              |\n");
+    printf("| -show : to see the current variables and functions                |\n");
+    printf("| -history : to see the last results, usable as $1 (last) to $%-2d    |\n", HISTORY_SIZE);
     printf("| -info : information and characteristics of the app                |\n");
+    printf("| -cache [bytes] : show the expression cache or set its memory budget|\n");
+    printf("| -precision [bits] : show or set the working precision             |\n");
+    printf("| -reassoc [on|off] : regroup long products into balanced trees     |\n");
+    printf("| -arena [on|off] : bump-allocate MPFR temporaries per evaluation   |\n");
+    printf("| -limit [time <ms>|memory <bytes>|exponent <bits>|off] : guards    |\n");
+    printf("| -base [2|8|10|16] : show or set the output base of results        |\n");
+    printf("| -hex/-bin/-oct [expr] : print expr (or the last result) once      |\n");
+    printf("| -dump <file|-> [digits] : write all digits of the last result     |\n");
+    printf("| -save <file> / -load <file> : binary snapshot of the variables    |\n");
+    printf("| -stats [reset] : latency percentiles per stage and node counts    |\n");
     printf("=====================================================================\n");
     DEBUG_FUNCTION_EXIT();
+    return true;
 }
 
-static void clear_vars_command(void* args) {
+static bool clear_vars_command(void* args) {
     DEBUG_FUNCTION_ENTER();
     App* app = (App*) args;
     DEBUG_INSTR("Clear variables command executed\n");
     symbol_table_empty(app->parser->symTable);
-    DEBUG_INSTR("Cleared variables from symbol table\n");
+    history_empty(app->parser->history);
+    DEBUG_INSTR("Cleared variables from symbol table and the result history\n");
     DEBUG_FUNCTION_EXIT();
+    return true;
 }
 
-static void info_command(void* args) {
+static bool clear_funcs_command(void* args) {
     DEBUG_FUNCTION_ENTER();
+    App* app = (App*) args;
+    DEBUG_INSTR("Clear functions command executed\n");
+    function_table_empty(app->parser->funcTable);
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+static bool info_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    App *app = (App *)args;
     DEBUG_INSTR("Info command executed\n");
     printf("=== Math Interpreter Information ===\n");
     printf("Version: 1.0\n");
-    printf("Precision: %d bits\n", PRECISION_ROUNDING_BITS);
+    printf("Precision: %ld bits\n", (long)app->parser->precision);
     printf("MPFR Version: %s\n", mpfr_get_version());
-    printf("Features: Variables, Arithmetic, Functions\n");
+    printf("Features: Variables, Arithmetic, Functions, Built-ins (%u)\n", builtinCount);
     printf("=====================================\n");
     DEBUG_FUNCTION_EXIT();
+    return true;
 }
 
-static void show_command(void* args) {
+static bool cache_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    App *app = (App *)args;
+    char* budget = strtok(NULL, " ");
+    if (budget) {
+        char* end;
+        unsigned long long bytes = strtoull(budget, &end, 10);
+        if (*end != '\0') {
+            ERROR_PRINT("Invalid cache budget: '%s'\n", budget);
+            DEBUG_FUNCTION_EXIT();
+            return false;
+        }
+        expr_cache_set_budget(app->cache, (size_t)bytes);
+        DEBUG_INSTR("Cache budget set to %llu bytes\n", bytes);
+    }
+    expr_cache_show(app->cache);
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+_Static_assert(TOK_INVALID <= STATS_OP_KINDS, "Stats cannot count every node kind");
+
+// Node counts are kept by the parser until they are filed under a precision
+static void stats_collect_ops(App* app) {
+    uint64_t counts[TOK_INVALID] = { 0 };
+    parser_take_op_counts(app->parser, counts);
+    stats_add_ops(app->stats, app->parser->precision, counts, TOK_INVALID);
+}
+
+static bool precision_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    App *app = (App *)args;
+    char* bits = strtok(NULL, " ");
+    if (bits) {
+        stats_collect_ops(app);
+        char* end;
+        long precision = strtol(bits, &end, 10);
+        if (*end != '\0' || !parser_set_precision(app->parser, precision)) {
+            ERROR_PRINT("Invalid precision: '%s'\n", bits);
+            DEBUG_FUNCTION_EXIT();
+            return false;
+        }
+    }
+    fprintf(print_output(), "Precision: %ld bits (~%zu digits)\n", (long)app->parser->precision,
+           mpfr_get_str_ndigits(10, app->parser->precision));
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+static bool reassoc_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    App *app = (App *)args;
+    char* mode = strtok(NULL, " ");
+    if (mode) {
+        bool on = strcmp(mode, "on") == 0;
+        if (!on && strcmp(mode, "off") != 0) {
+            ERROR_PRINT("Invalid reassociation mode: '%s' (on or off)\n", mode);
+            DEBUG_FUNCTION_EXIT();
+            return false;
+        }
+        // Cached lines were compiled with the previous grouping
+        if (on != app->parser->reassociate) expr_cache_clear(app->cache);
+        app->parser->reassociate = on;
+    }
+    printf("Reassociation: %s\n", app->parser->reassociate ?
+           "on (products are regrouped into balanced trees)" : "off (source order rounding)");
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+static bool arena_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    (void)args;
+    char* mode = strtok(NULL, " ");
+    if (mode) {
+        bool on = strcmp(mode, "on") == 0;
+        if (!on && strcmp(mode, "off") != 0) {
+            ERROR_PRINT("Invalid arena mode: '%s' (on or off)\n", mode);
+            DEBUG_FUNCTION_EXIT();
+            return false;
+        }
+        mp_memory_set_arena(on);
+    }
+    MpMemoryStats memory;
+    mp_memory_get(&memory);
+    printf("Arena: %s\n", memory.arena ?
+           "on (MPFR temporaries are bumped out of per-thread chunks)" : "off (malloc per allocation)");
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+// -limit time 500 memory 100000000 exponent 1000000, 0 turns one off
+static bool limit_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    Limits* limits = ((App*)args)->parser->limits;
+    char* name;
+    while ((name = strtok(NULL, " "))) {
+        if (strcmp(name, "off") == 0) {
+            limits_set(limits, "time", 0);
+            limits_set(limits, "memory", 0);
+            limits_set(limits, "exponent", 0);
+            continue;
+        }
+        char* value = strtok(NULL, " ");
+        char* end = NULL;
+        long long n = value ? strtoll(value, &end, 10) : -1;
+        if (!value || *end || n < 0) {
+            ERROR_PRINT("Usage: -limit [time <ms>|memory <bytes>|exponent <bits>|off]\n");
+            DEBUG_FUNCTION_EXIT();
+            return false;
+        }
+        if (!limits_set(limits, name, n)) {
+            ERROR_PRINT("Unknown limit: '%s' (time, memory or exponent)\n", name);
+            DEBUG_FUNCTION_EXIT();
+            return false;
+        }
+    }
+    limits_show(limits, print_output());
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+static bool base_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    (void)args;
+    char* base = strtok(NULL, " ");
+    if (base) {
+        char* end;
+        long value = strtol(base, &end, 10);
+        if (*end != '\0' || value < 0 || value > 16 || !print_friendly_set_base((uint8_t)value)) {
+            ERROR_PRINT("Invalid output base: '%s' (2, 8, 10 or 16)\n", base);
+            DEBUG_FUNCTION_EXIT();
+            return false;
+        }
+    }
+    printf("Output base: %u\n", print_friendly_base());
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+// Prints the rest of the line, or the last result when there is none, in 'base'
+static bool print_in_base(App* app, uint8_t base) {
+    char* expr = strtok(NULL, "");
+    uint8_t session = print_friendly_base();
+    print_friendly_set_base(base);
+    bool ok = true;
+    if (expr) {
+        ok = evaluate_line(app, expr, strlen(expr));
+    } else {
+        HistorySlot* last = history_get(app->parser->history, 1);
+        if (!last) printf("No result yet\n");
+        else if (last->array) array_print(last->array, "Result: ");
+        else print_friendly_mpfr(last->num, "Result: ");
+    }
+    print_friendly_set_base(session);
+    return ok;
+}
+
+static bool hex_command(void* args) {
+    return print_in_base((App*)args, 16);
+}
+
+static bool bin_command(void* args) {
+    return print_in_base((App*)args, 2);
+}
+
+static bool oct_command(void* args) {
+    return print_in_base((App*)args, 8);
+}
+
+// -dump <file|-> [digits]: the full decimal expansion of the last result
+static bool dump_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    App *app = (App *)args;
+    char* path = strtok(NULL, " ");
+    char* count = strtok(NULL, " ");
+    if (!path) {
+        ERROR_PRINT("Usage: -dump <file|-> [digits]\n");
+        DEBUG_FUNCTION_EXIT();
+        return false;
+    }
+
+    HistorySlot* last = history_get(app->parser->history, 1);
+    if (!last || last->array) {
+        ERROR_PRINT("-dump needs a scalar result first\n");
+        DEBUG_FUNCTION_EXIT();
+        return false;
+    }
+
+    // By default every digit the precision supports
+    uint64_t digits = mpfr_get_str_ndigits(10, mpfr_get_prec(last->num));
+    if (count) {
+        char* end;
+        digits = strtoull(count, &end, 10);
+        if (*end != '\0' || digits == 0) {
+            ERROR_PRINT("Invalid digit count: '%s'\n", count);
+            DEBUG_FUNCTION_EXIT();
+            return false;
+        }
+    }
+
+    bool to_stdout = strcmp(path, "-") == 0;
+    FILE* out = to_stdout ? stdout : fopen(path, "w");
+    if (!out) {
+        ERROR_PRINT("Cannot open '%s' for writing\n", path);
+        DEBUG_FUNCTION_EXIT();
+        return false;
+    }
+    bool ok = write_mpfr_digits(out, last->num, digits);
+    if (!to_stdout) ok = fclose(out) == 0 && ok;
+    if (!ok) ERROR_PRINT("Failed to write '%s'\n", path);
+    else if (!to_stdout) printf("Wrote %llu digits to %s\n", (unsigned long long)digits, path);
+    DEBUG_FUNCTION_EXIT();
+    return ok;
+}
+
+static bool save_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    App *app = (App *)args;
+    char* path = strtok(NULL, " ");
+    FILE* out = path ? fopen(path, "wb") : NULL;
+    if (!out) {
+        ERROR_PRINT("Usage: -save <file> (cannot open '%s')\n", path ? path : "");
+        DEBUG_FUNCTION_EXIT();
+        return false;
+    }
+    bool ok = symbol_table_save(app->parser->symTable, out);
+    ok = fclose(out) == 0 && ok;
+    if (ok) printf("Saved %u variables to %s\n", app->parser->symTable->count, path);
+    else ERROR_PRINT("Failed to write '%s'\n", path);
+    DEBUG_FUNCTION_EXIT();
+    return ok;
+}
+
+static bool load_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    App *app = (App *)args;
+    char* path = strtok(NULL, " ");
+    FILE* in = path ? fopen(path, "rb") : NULL;
+    if (!in) {
+        ERROR_PRINT("Usage: -load <file> (cannot open '%s')\n", path ? path : "");
+        DEBUG_FUNCTION_EXIT();
+        return false;
+    }
+    uint32_t loaded = 0;
+    bool ok = symbol_table_load(app->parser->symTable, in, &loaded);
+    fclose(in);
+    if (ok) printf("Loaded %u variables from %s\n", loaded, path);
+    DEBUG_FUNCTION_EXIT();
+    return ok;
+}
+
+static bool show_command(void* args) {
     DEBUG_FUNCTION_ENTER();
     App *app = (App *)args;
     DEBUG_INSTR("Show command executed\n");
     symbol_table_show(app->parser->symTable);
+    if (app->parser->funcTable->count > 0) {
+        function_table_show(app->parser->funcTable);
+    }
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+static bool stats_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    App *app = (App *)args;
+    char* action = strtok(NULL, " ");
+    stats_collect_ops(app);
+    if (action && strcmp(action, "reset") == 0) {
+        stats_reset(app->stats);
+        mp_memory_reset();
+        printf("Statistics reset\n");
+    } else if (action) {
+        ERROR_PRINT("Usage: -stats [reset]\n");
+        DEBUG_FUNCTION_EXIT();
+        return false;
+    } else {
+        // Kinds print without their TOK_ prefix
+        const char* names[TOK_INVALID];
+        for (uint32_t k = 0; k < TOK_INVALID; k++) names[k] = TokenNamesConsts[k] + 4;
+        stats_show(app->stats, names, TOK_INVALID);
+        mp_memory_show();
+    }
     DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+static bool history_command(void* args) {
+    DEBUG_FUNCTION_ENTER();
+    App *app = (App *)args;
+    DEBUG_INSTR("History command executed\n");
+    history_show(app->parser->history);
+    DEBUG_FUNCTION_EXIT();
+    return true;
 }
 
 // ##########################################
@@ -89,7 +417,7 @@ static inline uint32_t string_hash(const char* str, size_t len) {
     return hash;
 }
 
-static inline void instruction_map_add(InstructionMap *map, const char* inst, void (*func_name) (void* args)) {
+static inline void instruction_map_add(InstructionMap *map, const char* inst, bool (*func_name) (void* args)) {
     DEBUG_FUNCTION_ENTER();
     size_t len = strlen(inst);
     uint32_t hash = string_hash(inst, len) % INSTRUCTION_COUNT;
@@ -138,9 +466,7 @@ static inline void instruction_map_add(InstructionMap *map, const char* inst, vo
     DEBUG_FUNCTION_EXIT();
 }
 
-InstructionMap* instruction_map_creation() {
-    DEBUG_FUNCTION_ENTER();
-    
+static InstructionMap* instruction_map_alloc() {
     InstructionMap* insMap = malloc(sizeof(InstructionMap));
     CHECK_NULL(insMap, ERROR_RETURN_NULL("Failed to allocate InstructionMap"));
     
@@ -158,14 +484,55 @@ InstructionMap* instruction_map_creation() {
     });
     
     insMap->chunk_offset = 0;
+    return insMap;
+}
+
+// Every command, in the order they are added. 'session': a server session may
+// run it (no files, no terminal, no process wide settings), the others are
+// refused there.
+static const struct {
+    const char* name;
+    bool (*func)(void*);
+    bool session;
+} commandTable[] = {
+    { "-clear-vars", clear_vars_command, true },
+    { "-clear-funcs", clear_funcs_command, true },
+    { "-help", help_command, false },
+    { "-info", info_command, false },
+    { "-exit", exit_command, false },
+    { "-clear", clear_command, false },
+    { "-show", show_command, false },
+    { "-history", history_command, true },
+    { "-cache", cache_command, false },
+    { "-precision", precision_command, true },
+    { "-reassoc", reassoc_command, false },
+    { "-arena", arena_command, false },
+    { "-limit", limit_command, true },
+    { "-base", base_command, false },
+    { "-hex", hex_command, false },
+    { "-bin", bin_command, false },
+    { "-oct", oct_command, false },
+    { "-dump", dump_command, false },
+    { "-save", save_command, false },
+    { "-load", load_command, false },
+    { "-stats", stats_command, false },
+};
+
+static bool unsupported_command(void* args) {
+    (void)args;
+    ERROR_RETURN(false, "unknown or unsupported command\n");
+}
+
+InstructionMap* instruction_map_creation() {
+    DEBUG_FUNCTION_ENTER();
+    
+    InstructionMap* insMap = instruction_map_alloc();
+    CHECK_NULL(insMap, return NULL);
     
     // Add all instructions
-    instruction_map_add(insMap, "-clear-vars", clear_vars_command);
-    instruction_map_add(insMap, "-help", help_command);
-    instruction_map_add(insMap, "-info", info_command);
-    instruction_map_add(insMap, "-exit", exit_command);
-    instruction_map_add(insMap, "-clear", clear_command);
-    instruction_map_add(insMap, "-show", show_command);
+    for (size_t i = 0; i < sizeof(commandTable) / sizeof(commandTable[0]); i++) {
+        instruction_map_add(insMap, commandTable[i].name, commandTable[i].func);
+    }
     
     DEBUG_INSTR("Instruction map created with %d buckets\n", INSTRUCTION_COUNT);
     DEBUG_INSTR("Chunk usage: %d/%d bytes\n", insMap->chunk_offset, INSTRUCTION_COUNT_SIZE);
@@ -174,6 +541,23 @@ InstructionMap* instruction_map_creation() {
     return insMap;
 }
 
+// Server sessions share the process, so only commands that touch the session
+// itself run; the rest are taken and refused instead of reaching the parser.
+InstructionMap* instruction_map_session() {
+    DEBUG_FUNCTION_ENTER();
+    
+    InstructionMap* insMap = instruction_map_alloc();
+    CHECK_NULL(insMap, return NULL);
+    
+    for (size_t i = 0; i < sizeof(commandTable) / sizeof(commandTable[0]); i++) {
+        instruction_map_add(insMap, commandTable[i].name,
+                            commandTable[i].session ? commandTable[i].func : unsupported_command);
+    }
+    
+    DEBUG_FUNCTION_EXIT();
+    return insMap;
+}
+
 void instruction_map_destroy(InstructionMap* map) {
     DEBUG_FUNCTION_ENTER();
     CHECK_NULL(map, return);
@@ -201,34 +585,38 @@ void instruction_map_destroy(InstructionMap* map) {
     DEBUG_FUNCTION_EXIT();
 }
 
-bool instruction_map_execute(InstructionMap* map, const char* inst, void *args) {
+bool instruction_map_execute(InstructionMap* map, const char* inst, void *args, bool* ok) {
     DEBUG_FUNCTION_ENTER();
     CHECK_NULL(map, ERROR_RETURN(false, "Instruction map is NULL"));
     CHECK_NULL(inst, ERROR_RETURN(false, "Instruction string is NULL"));
     
     DEBUG_INSTR("Attempting to execute: %s\n", inst);
     
-    char *token = strtok((char*)inst, " ");
-    if (!token) {
+    // The input is only split once a command matches, otherwise it is left
+    // untouched for the expression parser (e.g. "-5 + 2").
+    size_t len = strcspn(inst, " ");
+    if (len == 0) {
         DEBUG_INSTR("No token found in instruction string\n");
         DEBUG_FUNCTION_EXIT();
         return false;
     }
     
-    size_t len = strlen(token);
-    uint32_t hash = string_hash(token, len) % INSTRUCTION_COUNT;
+    uint32_t hash = string_hash(inst, len) % INSTRUCTION_COUNT;
     
-    DEBUG_INSTR("Looking up: %s (hash: %u, bucket: %u)\n", token, hash, hash % INSTRUCTION_COUNT);
+    DEBUG_INSTR("Looking up: %.*s (hash: %u, bucket: %u)\n", (int)len, inst, hash, hash % INSTRUCTION_COUNT);
     
     Instruction* curr = &map->inst_map[hash];
     int chain_position = 0;
     
     while (curr) {
-        if (curr->str && strcmp(curr->str, token) == 0) {
+        if (curr->str && strncmp(curr->str, inst, len) == 0 && curr->str[len] == '\0') {
             DEBUG_INSTR("Found instruction at bucket %u, chain position %d\n", hash, chain_position);
-            DEBUG_INSTR_EXEC(token, true);
+            DEBUG_INSTR_EXEC(curr->str, true);
             
-            curr->func(args);
+            // Commands read their arguments with strtok(NULL, " ")
+            strtok((char*)inst, " ");
+            bool done = curr->func(args);
+            if (ok) *ok = done;
             DEBUG_FUNCTION_EXIT();
             return true;
         }
@@ -236,8 +624,8 @@ bool instruction_map_execute(InstructionMap* map, const char* inst, void *args)
         chain_position++;
     }
     
-    DEBUG_INSTR("Instruction not found: %s\n", token);
-    DEBUG_INSTR_EXEC(token, false);
+    DEBUG_INSTR("Instruction not found: %.*s\n", (int)len, inst);
+    DEBUG_INSTR_EXEC(inst, false);
     DEBUG_FUNCTION_EXIT();
     return false;
 }
@@ -274,106 +662,249 @@ bool instruction_map_exist(InstructionMap* map, const char* inst) {
 // ######             Main              #####
 // ##########################################
 
-int main() {
-    DEBUG_FUNCTION_ENTER();
-    
-    printf("This is a simple math interpreter of math equations. Here you can:\n"
-           "1- Get the response of a math equation.\n"
-           "2- Create variables with numeric values.\n\n");
-    
-    App *app = malloc(sizeof(App));
-    CHECK_NULL(app, ERROR_RETURN(1, "Failed to allocate App"));
-    
-    InstructionMap *instructions = instruction_map_creation();
-    CHECK_NULL(instructions, {
-        free(app);
-        ERROR_RETURN(1, "Failed to create instruction map");
-    });
+// With --trace each stage of a line is also an event, the line number is its argument
+static inline void trace_stage(App* app, const char* name, uint64_t start, uint64_t end) {
+    if (app->parser->trace) trace_event(name, "stage", start, end, 0, "line", (int64_t)app->line);
+}
+
+bool evaluate_line(App* app, const char* line, size_t len) {
+    // Every stage is timed, failed ones included
+    Stats* stats = app->stats;
+    uint64_t start = stats_now(), end;
+    stats->lines++;
+    app->line++;
+
+    // A cached line skips tokenize() and parse() entirely
+    Expr* expr = expr_cache_get(app->cache, line, len);
+    if (expr) stats->cache_hits++;
+    if (!expr) {
+        bool tokenized = tokenize(app->parser->tokens, line);
+        end = stats_now();
+        stats_record(stats, STAT_TOKENIZE, end - start);
+        trace_stage(app, "tokenize", start, end);
+        start = end;
+        if (!tokenized) {
+            ERROR_PRINT("Tokenization failed for: %s\n", line);
+            return false;
+        }
+        
+        #ifdef DEBUG
+            token_buffer_show(app->parser->tokens);
+        #endif
+        
+        ASTNode* head = parse(app->parser);
+        uint64_t parsed = stats_now();
+        trace_stage(app, "parse", start, parsed);
+        if (!head) {
+            stats_record(stats, STAT_PARSE, parsed - start);
+            ERROR_PRINT("Parsing failed for: %s\n", line);
+            return false;
+        }
+        
+        #ifdef DEBUG
+            parser_show(app->parser);
+        #endif
+        
+        expr = parser_compile(app->parser, line, head);
+        end = stats_now();
+        stats_record(stats, STAT_PARSE, end - start);
+        trace_stage(app, "optimize", parsed, end); // compilation and its rewrites
+        start = end;
+        if (!expr) {
+            ERROR_PRINT("Compilation failed for: %s\n", line);
+            return false;
+        }
+        expr_cache_put(app->cache, expr);
+    }
     
+    // The result is written straight into the next history slot, it only
+    // becomes $1 once the line succeeded
+    History* history = app->parser->history;
+    mpfr_t* result = history_next(history);
+
+    bool evaluated = evaluate_expression(app->parser, expr, result);
+    end = stats_now();
+    stats_record(stats, STAT_EVALUATE, end - start);
+    trace_stage(app, "evaluate", start, end);
+    start = end;
+
+    if (evaluated) {
+        if (expr->head->token->type == TOK_DEFINE) {
+            fprintf(print_output(), "Function defined: %s\n", expr->text);
+        } else if (app->parser->array_result) {
+            array_print(app->parser->array_result, "Result: ");
+            history_commit(history, app->parser->array_result);
+        } else {
+            print_friendly_mpfr(*result, "Result: ");
+            history_commit(history, NULL);
+        }
+        end = stats_now();
+        stats_record(stats, STAT_OUTPUT, end - start);
+        trace_stage(app, "print", start, end);
+    } else {
+        ERROR_PRINT("Evaluation failed for: %s\n", line);
+    }
+    expr_release(expr);
+    return evaluated;
+}
+
+char* trim_line(char* line, size_t* len) {
+    size_t n = strcspn(line, "\n");
+    while (n > 0 && isspace((unsigned char)line[n - 1])) n--;
+    line[n] = '\0';
+    while (isspace((unsigned char)*line)) {
+        line++;
+        n--;
+    }
+    *len = n;
+    return line;
+}
+
+App* app_create(size_t cache_budget) {
+    DEBUG_FUNCTION_ENTER();
+    App* app = calloc(1, sizeof(App));
+    CHECK_NULL(app, ERROR_RETURN_NULL("Failed to allocate App"));
+
     TokenBuffer* token_buff = token_buffer_create();
     CHECK_NULL(token_buff, {
-        instruction_map_destroy(instructions);
         free(app);
-        ERROR_RETURN(1, "Failed to create token buffer");
+        ERROR_RETURN_NULL("Failed to create token buffer");
     });
-    
+
     app->parser = parser_create(token_buff);
     CHECK_NULL(app->parser, {
         token_buffer_destroy(token_buff);
-        instruction_map_destroy(instructions);
         free(app);
-        ERROR_RETURN(1, "Failed to create parser");
+        ERROR_RETURN_NULL("Failed to create parser");
     });
-    
+
+    app->cache = expr_cache_create(cache_budget);
+    CHECK_NULL(app->cache, {
+        parser_destroy(app->parser);
+        free(app);
+        ERROR_RETURN_NULL("Failed to create expression cache");
+    });
+
+    app->stats = stats_create();
+    CHECK_NULL(app->stats, {
+        expr_cache_destroy(app->cache);
+        parser_destroy(app->parser);
+        free(app);
+        ERROR_RETURN_NULL("Failed to create statistics");
+    });
+
     app->run = true;
+    DEBUG_FUNCTION_EXIT();
+    return app;
+}
+
+void app_destroy(App* app) {
+    CHECK_NULL(app, return);
+    stats_destroy(app->stats);
+    expr_cache_destroy(app->cache);
+    parser_destroy(app->parser);
+    free(app->buffer);
+    free(app);
+}
+
+int main(int argc, char** argv) {
+    DEBUG_FUNCTION_ENTER();
+    mp_memory_install(); // before anything allocates through GMP
+
+    const char* trace_path = NULL;
+    const char* server_address = NULL;
+    bool pipeline = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            server_address = argv[++i];
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            pipeline = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--trace <file.json>] [--pipeline] [--server <socket path|tcp:port>]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (trace_path && pipeline) ERROR_RETURN(1, "--trace is not available with --pipeline\n");
+    if (server_address) {
+        if (trace_path || pipeline) ERROR_RETURN(1, "--trace and --pipeline are not available with --server\n");
+        int status = server_run(server_address);
+        mp_memory_set_arena(false);
+        return status;
+    }
+    
+    printf("This is a simple math interpreter of math equations. Here you can:\n"
+           "1- Get the response of a math equation.\n"
+           "2- Create variables with numeric values.\n\n");
+    
+    InstructionMap *instructions = instruction_map_creation();
+    CHECK_NULL(instructions, ERROR_RETURN(1, "Failed to create instruction map"));
     
-    mpfr_init2(app->result, PRECISION_ROUNDING_BITS);
+    App *app = app_create(EXPR_CACHE_DEFAULT_BUDGET);
+    CHECK_NULL(app, {
+        instruction_map_destroy(instructions);
+        return 1;
+    });
+    
+    if (trace_path) {
+        if (!trace_start(trace_path)) {
+            app_destroy(app);
+            instruction_map_destroy(instructions);
+            return 1;
+        }
+        app->parser->trace = true;
+    }
     
     DEBUG_INSTR("Application initialized successfully\n");
     DEBUG_INSTR("Precision: %d bits\n", PRECISION_ROUNDING_BITS);
     
-    while (app->run) {
-        printf(">> ");
-        if (!fgets(app->buffer, sizeof(app->buffer), stdin)) {
-            DEBUG_INSTR("EOF detected, exiting\n");
-            break;
-        }
-        
-        app->buffer[strcspn(app->buffer, "\n")] = '\0';
-        if (app->buffer[0] == '\0') {
-            DEBUG_INSTR("Empty input, skipping\n");
-            continue;
-        }
-        
-        DEBUG_INSTR("Processing input: %s\n", app->buffer);
+    int status = 0;
+    if (pipeline) {
+        if (!pipeline_run(app, instructions)) status = 1;
+    } else {
+        while (app->run) {
+            printf(">> ");
+            if (getline(&app->buffer, &app->buffer_size, stdin) < 0) {
+                DEBUG_INSTR("EOF detected, exiting\n");
+                break;
+            }
         
-        // Check for commands first
-        if (app->buffer[0] == '-') {
-            DEBUG_INSTR("Detected command prefix\n");
-            if (instruction_map_execute(instructions, app->buffer, app)) {
-                DEBUG_INSTR("Command executed successfully\n");
+            // Normalize: drop the newline and surrounding whitespace
+            size_t len;
+            char* line = trim_line(app->buffer, &len);
+            if (line[0] == '\0') {
+                DEBUG_INSTR("Empty input, skipping\n");
                 continue;
-            } else {
-                DEBUG_INSTR("No matching command found\n");
             }
-        }
-        
-        // Tokenize and parse mathematical expression
-        if (!tokenize(token_buff, app->buffer)) {
-            ERROR_PRINT("Tokenization failed for: %s\n", app->buffer);
-            continue;
-        }
         
-        #ifdef DEBUG
-            token_buffer_show(token_buff);
-        #endif
-        
-        ASTNode* head = parse(app->parser);
-        if (!head) {
-            ERROR_PRINT("Parsing failed for: %s\n", app->buffer);
-            continue;
-        }
+            DEBUG_INSTR("Processing input: %s\n", line);
         
-        #ifdef DEBUG
-            parser_show(app->parser);
-        #endif
+            // Check for commands first
+            if (line[0] == '-') {
+                DEBUG_INSTR("Detected command prefix\n");
+                if (instruction_map_execute(instructions, line, app, NULL)) {
+                    DEBUG_INSTR("Command executed successfully\n");
+                    continue;
+                } else {
+                    DEBUG_INSTR("No matching command found\n");
+                }
+            }
         
-        if (evaluate_expression(app->parser, head, &app->result)) {
-            print_friendly_mpfr(app->result, "Result: ");
-            symbol_table_insert(app->parser->symTable, "last", &app->result, 4);
-        } else {
-            ERROR_PRINT("Evaluation failed for: %s\n", app->buffer);
+            evaluate_line(app, line, len);
         }
     }
     
     DEBUG_INSTR("Shutting down application\n");
     
-    parser_destroy(app->parser);
+    trace_finish();
+    app_destroy(app);
     instruction_map_destroy(instructions);
-    mpfr_clear(app->result);
-    free(app);
+    mp_memory_set_arena(false); // the pooled chunks, once nothing uses them
     
     DEBUG_INSTR("Application terminated successfully\n");
     DEBUG_FUNCTION_EXIT();
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
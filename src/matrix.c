@@ -0,0 +1,377 @@
+#include "matrix.h"
+#include "debug.h"
+#include <math.h>
+#include <mpfr.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static inline bool is_square(const Array* a) {
+    return a->rows > 0 && a->rows == a->cols;
+}
+
+// Private copy of 'a' at 'precision', same shape
+static Array* matrix_copy(Array* a, mpfr_prec_t precision) {
+    Array* copy = array_create(a->len, precision);
+    CHECK_NULL(copy, return NULL);
+    copy->rows = a->rows;
+    copy->cols = a->cols;
+    array_copy(copy, 0, a, 0, a->len);
+    return copy;
+}
+
+Array* matrix_row(Array* a, uint32_t row, mpfr_prec_t precision) {
+    Array* vector = array_create(a->cols, precision);
+    CHECK_NULL(vector, return NULL);
+    array_copy(vector, 0, a, row * a->cols, a->cols);
+    return vector;
+}
+
+// ##############################
+// #####   MULTIPLICATION   #####
+// ##############################
+
+// C (n x m) = A (n x k) * B (k x m), restricted to rows [row_begin, row_end) of C
+typedef struct MatmulTask{
+    const Array* a;
+    const Array* b;
+    Array* c;
+    uint32_t n, k, m;
+    uint32_t row_begin, row_end;
+} MatmulTask;
+
+// Tiled i-p-j order: a tile of B stays in cache while the rows of A stream
+// over it, and the inner loop is a contiguous axpy the compiler vectorizes.
+static void matmul_double(const MatmulTask* t) {
+    const double* A = t->a->data.d;
+    const double* B = t->b->data.d;
+    double* C = t->c->data.d;
+    const uint32_t k = t->k, m = t->m;
+
+    memset(C + (size_t)t->row_begin * m, 0, (size_t)(t->row_end - t->row_begin) * m * sizeof(double));
+    for (uint32_t ii = t->row_begin; ii < t->row_end; ii += MATRIX_BLOCK) {
+        uint32_t i_end = MIN(ii + MATRIX_BLOCK, t->row_end);
+        for (uint32_t pp = 0; pp < k; pp += MATRIX_BLOCK) {
+            uint32_t p_end = MIN(pp + MATRIX_BLOCK, k);
+            for (uint32_t jj = 0; jj < m; jj += MATRIX_BLOCK) {
+                uint32_t j_end = MIN(jj + MATRIX_BLOCK, m);
+                for (uint32_t i = ii; i < i_end; i++) {
+                    double* restrict c = C + (size_t)i * m;
+                    for (uint32_t p = pp; p < p_end; p++) {
+                        const double a = A[(size_t)i * k + p];
+                        const double* restrict b = B + (size_t)p * m;
+                        for (uint32_t j = jj; j < j_end; j++) c[j] += a * b[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Same tiling with one fused multiply-add (one rounding) per term
+static void matmul_mpfr(const MatmulTask* t) {
+    mpfr_t* A = t->a->data.m;
+    mpfr_t* B = t->b->data.m;
+    mpfr_t* C = t->c->data.m;
+    const uint32_t k = t->k, m = t->m;
+
+    for (size_t i = (size_t)t->row_begin * m; i < (size_t)t->row_end * m; i++) mpfr_set_zero(C[i], 1);
+    for (uint32_t ii = t->row_begin; ii < t->row_end; ii += MATRIX_BLOCK_MPFR) {
+        uint32_t i_end = MIN(ii + MATRIX_BLOCK_MPFR, t->row_end);
+        for (uint32_t pp = 0; pp < k; pp += MATRIX_BLOCK_MPFR) {
+            uint32_t p_end = MIN(pp + MATRIX_BLOCK_MPFR, k);
+            for (uint32_t jj = 0; jj < m; jj += MATRIX_BLOCK_MPFR) {
+                uint32_t j_end = MIN(jj + MATRIX_BLOCK_MPFR, m);
+                for (uint32_t i = ii; i < i_end; i++) {
+                    for (uint32_t p = pp; p < p_end; p++) {
+                        mpfr_srcptr a = A[(size_t)i * k + p];
+                        if (mpfr_zero_p(a)) continue;
+                        for (uint32_t j = jj; j < j_end; j++) {
+                            mpfr_ptr c = C[(size_t)i * m + j];
+                            mpfr_fma(c, a, B[(size_t)p * m + j], c, MPFR_RNDN);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void* matmul_worker(void* arg) {
+    matmul_double((const MatmulTask*)arg);
+    return NULL;
+}
+
+// Large double products are split into bands of whole row tiles, one per
+// thread. The calling thread takes the first band.
+static void matmul_run(const MatmulTask* task) {
+    if (task->c->storage == ARRAY_MPFR) {
+        matmul_mpfr(task);
+        return;
+    }
+
+    uint64_t work = (uint64_t)task->n * task->k * task->m;
+    uint32_t tiles = (task->n + MATRIX_BLOCK - 1) / MATRIX_BLOCK;
+    uint32_t threads = 1;
+    if (work >= MATRIX_THREAD_MIN_WORK) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 1 ? (uint32_t)MIN(cpus, MATRIX_MAX_THREADS) : 1;
+        threads = MIN(threads, tiles);
+    }
+    if (threads <= 1) {
+        matmul_double(task);
+        return;
+    }
+
+    MatmulTask bands[MATRIX_MAX_THREADS];
+    pthread_t ids[MATRIX_MAX_THREADS];
+    bool started[MATRIX_MAX_THREADS] = { false };
+    uint32_t rows_per_band = (tiles + threads - 1) / threads * MATRIX_BLOCK;
+
+    for (uint32_t t = 0; t < threads; t++) {
+        bands[t] = *task;
+        bands[t].row_begin = MIN(t * rows_per_band, task->n);
+        bands[t].row_end = MIN(bands[t].row_begin + rows_per_band, task->n);
+    }
+    for (uint32_t t = 1; t < threads; t++) {
+        if (bands[t].row_begin == bands[t].row_end) continue;
+        started[t] = pthread_create(&ids[t], NULL, matmul_worker, &bands[t]) == 0;
+        if (!started[t]) matmul_double(&bands[t]); // no thread, do it here
+    }
+    matmul_double(&bands[0]);
+    for (uint32_t t = 1; t < threads; t++) {
+        if (started[t]) pthread_join(ids[t], NULL);
+    }
+
+    DEBUG_PRINT("Matrix product %ux%u * %ux%u on %u threads\n", task->n, task->k, task->k, task->m, threads);
+}
+
+Array* matrix_multiply(Array* a, Array* b, mpfr_prec_t precision) {
+    uint32_t n = a->rows ? a->rows : 1;
+    uint32_t k = a->rows ? a->cols : a->len;
+    uint32_t k2 = b->rows ? b->rows : b->len;
+    uint32_t m = b->rows ? b->cols : 1;
+
+    if (k != k2 || (!a->rows && !b->rows)) {
+        char sa[32], sb[32];
+        ERROR_RETURN_NULL("Shape mismatch for product: %s * %s\n",
+                          array_shape(a, sa, sizeof(sa)), array_shape(b, sb, sizeof(sb)));
+    }
+
+    // Both operands in the storage of the result so the kernels never convert
+    Array* ca = array_coerce(a, precision);
+    Array* cb = array_coerce(b, precision);
+    Array* c = NULL;
+    if (ca && cb) {
+        c = a->rows && b->rows ? array_create_matrix(n, m, precision)
+                               : array_create(a->rows ? n : m, precision);
+    }
+    if (c) {
+        MatmulTask task = { ca, cb, c, n, k, m, 0, n };
+        matmul_run(&task);
+    }
+    array_release(ca);
+    array_release(cb);
+    return c;
+}
+
+Array* matrix_transpose(Array* a, mpfr_prec_t precision) {
+    // A vector has no orientation
+    if (!a->rows) return array_coerce(a, precision);
+
+    Array* t = array_create_matrix(a->cols, a->rows, precision);
+    CHECK_NULL(t, return NULL);
+    for (uint32_t i = 0; i < a->rows; i++) {
+        for (uint32_t j = 0; j < a->cols; j++) {
+            array_copy(t, j * a->rows + i, a, i * a->cols + j, 1);
+        }
+    }
+    return t;
+}
+
+// ##############################
+// #####    ELIMINATION     #####
+// ##############################
+
+// Gaussian elimination with partial pivoting of the n x n matrix M, the same
+// row operations are applied to the r columns of R (R may be NULL). Leaves M
+// upper triangular. Returns false when a pivot is zero (singular matrix).
+static bool eliminate_double(double* M, double* R, uint32_t n, uint32_t r, int* sign) {
+    *sign = 1;
+    for (uint32_t col = 0; col < n; col++) {
+        uint32_t pivot = col;
+        for (uint32_t i = col + 1; i < n; i++) {
+            if (fabs(M[(size_t)i * n + col]) > fabs(M[(size_t)pivot * n + col])) pivot = i;
+        }
+        if (M[(size_t)pivot * n + col] == 0) return false;
+
+        if (pivot != col) {
+            for (uint32_t j = 0; j < n; j++) {
+                double tmp = M[(size_t)col * n + j];
+                M[(size_t)col * n + j] = M[(size_t)pivot * n + j];
+                M[(size_t)pivot * n + j] = tmp;
+            }
+            for (uint32_t j = 0; j < r; j++) {
+                double tmp = R[(size_t)col * r + j];
+                R[(size_t)col * r + j] = R[(size_t)pivot * r + j];
+                R[(size_t)pivot * r + j] = tmp;
+            }
+            *sign = -*sign;
+        }
+
+        const double diag = M[(size_t)col * n + col];
+        for (uint32_t i = col + 1; i < n; i++) {
+            const double f = M[(size_t)i * n + col] / diag;
+            if (f == 0) continue;
+            M[(size_t)i * n + col] = 0;
+            for (uint32_t j = col + 1; j < n; j++) M[(size_t)i * n + j] -= f * M[(size_t)col * n + j];
+            for (uint32_t j = 0; j < r; j++) R[(size_t)i * r + j] -= f * R[(size_t)col * r + j];
+        }
+    }
+    return true;
+}
+
+static void back_substitute_double(const double* M, double* R, uint32_t n, uint32_t r) {
+    for (uint32_t i = n; i-- > 0;) {
+        for (uint32_t j = 0; j < r; j++) {
+            double x = R[(size_t)i * r + j];
+            for (uint32_t p = i + 1; p < n; p++) x -= M[(size_t)i * n + p] * R[(size_t)p * r + j];
+            R[(size_t)i * r + j] = x / M[(size_t)i * n + i];
+        }
+    }
+}
+
+static bool eliminate_mpfr(mpfr_t* M, mpfr_t* R, uint32_t n, uint32_t r, int* sign, mpfr_prec_t precision) {
+    mpfr_t f;
+    mpfr_init2(f, precision);
+    *sign = 1;
+
+    for (uint32_t col = 0; col < n; col++) {
+        uint32_t pivot = col;
+        for (uint32_t i = col + 1; i < n; i++) {
+            if (mpfr_cmpabs(M[(size_t)i * n + col], M[(size_t)pivot * n + col]) > 0) pivot = i;
+        }
+        if (mpfr_zero_p(M[(size_t)pivot * n + col])) {
+            mpfr_clear(f);
+            return false;
+        }
+
+        if (pivot != col) {
+            for (uint32_t j = 0; j < n; j++) mpfr_swap(M[(size_t)col * n + j], M[(size_t)pivot * n + j]);
+            for (uint32_t j = 0; j < r; j++) mpfr_swap(R[(size_t)col * r + j], R[(size_t)pivot * r + j]);
+            *sign = -*sign;
+        }
+
+        for (uint32_t i = col + 1; i < n; i++) {
+            if (mpfr_zero_p(M[(size_t)i * n + col])) continue;
+            // f = -M[i][col] / M[col][col], then row_i += f * row_col
+            mpfr_div(f, M[(size_t)i * n + col], M[(size_t)col * n + col], MPFR_RNDN);
+            mpfr_neg(f, f, MPFR_RNDN);
+            mpfr_set_zero(M[(size_t)i * n + col], 1);
+            for (uint32_t j = col + 1; j < n; j++) {
+                mpfr_ptr x = M[(size_t)i * n + j];
+                mpfr_fma(x, f, M[(size_t)col * n + j], x, MPFR_RNDN);
+            }
+            for (uint32_t j = 0; j < r; j++) {
+                mpfr_ptr x = R[(size_t)i * r + j];
+                mpfr_fma(x, f, R[(size_t)col * r + j], x, MPFR_RNDN);
+            }
+        }
+    }
+
+    mpfr_clear(f);
+    return true;
+}
+
+static void back_substitute_mpfr(mpfr_t* M, mpfr_t* R, uint32_t n, uint32_t r) {
+    for (uint32_t i = n; i-- > 0;) {
+        for (uint32_t j = 0; j < r; j++) {
+            // x = (b - sum M[i][p] * x[p]) / M[i][i], accumulated as -b + sum
+            mpfr_ptr x = R[(size_t)i * r + j];
+            mpfr_neg(x, x, MPFR_RNDN);
+            for (uint32_t p = i + 1; p < n; p++) {
+                mpfr_fma(x, M[(size_t)i * n + p], R[(size_t)p * r + j], x, MPFR_RNDN);
+            }
+            mpfr_neg(x, x, MPFR_RNDN);
+            mpfr_div(x, x, M[(size_t)i * n + i], MPFR_RNDN);
+        }
+    }
+}
+
+bool matrix_det(Array* a, mpfr_t rop) {
+    if (!is_square(a)) {
+        char sa[32];
+        ERROR_RETURN(false, "det() expects a square matrix, got %s\n", array_shape(a, sa, sizeof(sa)));
+    }
+
+    uint32_t n = a->rows;
+    mpfr_prec_t precision = mpfr_get_prec(rop);
+    Array* work = matrix_copy(a, precision);
+    CHECK_NULL(work, return false);
+
+    int sign;
+    if (work->storage == ARRAY_DOUBLE) {
+        if (!eliminate_double(work->data.d, NULL, n, 0, &sign)) {
+            mpfr_set_zero(rop, 1);
+        } else {
+            double det = sign;
+            for (uint32_t i = 0; i < n; i++) det *= work->data.d[(size_t)i * n + i];
+            mpfr_set_d(rop, det, MPFR_RNDN);
+        }
+    } else {
+        if (!eliminate_mpfr(work->data.m, NULL, n, 0, &sign, precision)) {
+            mpfr_set_zero(rop, 1);
+        } else {
+            mpfr_set_si(rop, sign, MPFR_RNDN);
+            for (uint32_t i = 0; i < n; i++) mpfr_mul(rop, rop, work->data.m[(size_t)i * n + i], MPFR_RNDN);
+        }
+    }
+
+    array_release(work);
+    return true;
+}
+
+Array* matrix_solve(Array* a, Array* b, mpfr_prec_t precision) {
+    char sa[32], sb[32];
+    if (!is_square(a)) {
+        ERROR_RETURN_NULL("solve() expects a square matrix, got %s\n", array_shape(a, sa, sizeof(sa)));
+    }
+    uint32_t n = a->rows;
+    uint32_t b_rows = b->rows ? b->rows : b->len;
+    if (b_rows != n) {
+        ERROR_RETURN_NULL("Shape mismatch for solve: %s and %s\n",
+                          array_shape(a, sa, sizeof(sa)), array_shape(b, sb, sizeof(sb)));
+    }
+    uint32_t r = b->rows ? b->cols : 1;
+
+    Array* M = matrix_copy(a, precision);
+    Array* X = matrix_copy(b, precision);
+    if (!M || !X) {
+        array_release(M);
+        array_release(X);
+        return NULL;
+    }
+
+    int sign;
+    bool regular;
+    if (M->storage == ARRAY_DOUBLE) {
+        regular = eliminate_double(M->data.d, X->data.d, n, r, &sign);
+        if (regular) back_substitute_double(M->data.d, X->data.d, n, r);
+    } else {
+        regular = eliminate_mpfr(M->data.m, X->data.m, n, r, &sign, precision);
+        if (regular) back_substitute_mpfr(M->data.m, X->data.m, n, r);
+    }
+    array_release(M);
+
+    if (!regular) {
+        array_release(X);
+        ERROR_RETURN_NULL("Matrix is singular\n");
+    }
+    return X;
+}
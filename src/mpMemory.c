@@ -0,0 +1,288 @@
+#include "mpMemory.h"
+#include "debug.h"
+#include <gmp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ArenaChunk{
+    struct ArenaChunk* next; // pool link
+    size_t used;             // bytes bumped so far, only the owning thread moves it
+    atomic_uint_fast64_t live; // blocks not freed yet, any thread counts down
+    atomic_bool retired;     // no thread bumps from it anymore
+    atomic_bool claimed;     // set once by whoever hands it back to the pool
+    _Alignas(16) unsigned char data[];
+} ArenaChunk;
+
+// In front of every block, NULL 'chunk' means the block came from malloc
+typedef struct MpBlock{
+    ArenaChunk* chunk;
+    uint64_t padding; // keeps the data 16-byte aligned
+} MpBlock;
+
+#define ARENA_CAPACITY (MP_ARENA_CHUNK_BYTES - sizeof(ArenaChunk))
+
+static struct {
+    atomic_int_fast64_t current, peak;
+    atomic_int_fast64_t ceiling; // 0 for none
+    atomic_bool ceiling_hit;
+    atomic_uint_fast64_t allocations, arena_blocks, arena_resets;
+    atomic_uint chunks;
+    atomic_bool active; // inside an arena scope
+    bool arena;
+    ArenaChunk* pool;
+    uint32_t pooled;
+    pthread_mutex_t lock; // pool
+    pthread_key_t key;    // retires the chunk of an exiting thread
+} mem = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static _Thread_local ArenaChunk* current;
+
+// What the calling thread allocated minus what it freed, whoever allocated
+// the blocks. Only meaningful as a difference over an evaluation that never
+// leaves the thread.
+static _Thread_local struct {
+    int64_t current;
+    int64_t ceiling; // 0 for none
+    bool ceiling_hit;
+} own;
+
+static inline void account(int64_t bytes) {
+    int64_t now = atomic_fetch_add_explicit(&mem.current, bytes, memory_order_relaxed) + bytes;
+    int64_t peak = atomic_load_explicit(&mem.peak, memory_order_relaxed);
+    while (now > peak && !atomic_compare_exchange_weak_explicit(&mem.peak, &peak, now,
+                                                                memory_order_relaxed, memory_order_relaxed));
+    int64_t ceiling = atomic_load_explicit(&mem.ceiling, memory_order_relaxed);
+    if (ceiling && now > ceiling) atomic_store_explicit(&mem.ceiling_hit, true, memory_order_relaxed);
+    own.current += bytes;
+    if (own.ceiling && own.current > own.ceiling) own.ceiling_hit = true;
+}
+
+static void out_of_memory(size_t size) {
+    // GMP has no way to report a failed allocation
+    ERROR_PRINT("GMP allocation of %zu bytes failed\n", size);
+    abort();
+}
+
+static void chunk_reclaim(ArenaChunk* chunk) {
+    if (atomic_exchange(&chunk->claimed, true)) return;
+    pthread_mutex_lock(&mem.lock);
+    if (mem.pooled < MP_ARENA_POOL_CHUNKS) {
+        chunk->next = mem.pool;
+        mem.pool = chunk;
+        mem.pooled++;
+        chunk = NULL;
+    }
+    pthread_mutex_unlock(&mem.lock);
+    if (chunk) {
+        free(chunk);
+        atomic_fetch_sub(&mem.chunks, 1);
+    }
+}
+
+// The last free of a retired chunk gives it back, whichever side comes last
+static void chunk_retire(ArenaChunk* chunk) {
+    if (!chunk) return;
+    atomic_store(&chunk->retired, true);
+    if (atomic_load(&chunk->live) == 0) chunk_reclaim(chunk);
+}
+
+static ArenaChunk* chunk_take() {
+    pthread_mutex_lock(&mem.lock);
+    ArenaChunk* chunk = mem.pool;
+    if (chunk) {
+        mem.pool = chunk->next;
+        mem.pooled--;
+    }
+    pthread_mutex_unlock(&mem.lock);
+    if (!chunk) {
+        chunk = malloc(MP_ARENA_CHUNK_BYTES);
+        if (!chunk) return NULL;
+        atomic_fetch_add(&mem.chunks, 1);
+    }
+    chunk->next = NULL;
+    chunk->used = 0;
+    atomic_init(&chunk->live, 0);
+    atomic_init(&chunk->retired, false);
+    atomic_init(&chunk->claimed, false);
+    return chunk;
+}
+
+static void set_current(ArenaChunk* chunk) {
+    current = chunk;
+    pthread_setspecific(mem.key, chunk);
+}
+
+static void thread_exit(void* chunk) {
+    chunk_retire(chunk);
+}
+
+static MpBlock* arena_block(size_t total) {
+    ArenaChunk* chunk = current;
+    if (chunk && chunk->used && atomic_load_explicit(&chunk->live, memory_order_acquire) == 0) {
+        chunk->used = 0; // everything bumped out of it was freed
+        atomic_fetch_add_explicit(&mem.arena_resets, 1, memory_order_relaxed);
+    }
+    if (!chunk || chunk->used + total > ARENA_CAPACITY) {
+        ArenaChunk* next = chunk_take();
+        if (!next) return NULL;
+        chunk_retire(chunk);
+        set_current(chunk = next);
+    }
+    MpBlock* block = (MpBlock*)(chunk->data + chunk->used);
+    chunk->used += total;
+    atomic_fetch_add_explicit(&chunk->live, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&mem.arena_blocks, 1, memory_order_relaxed);
+    block->chunk = chunk;
+    return block;
+}
+
+static void* mp_allocate(size_t size) {
+    size_t total = (sizeof(MpBlock) + size + 15) & ~(size_t)15;
+    MpBlock* block = NULL;
+    if (atomic_load_explicit(&mem.active, memory_order_relaxed) && total <= MP_ARENA_MAX_BLOCK) {
+        block = arena_block(total);
+    }
+    if (!block) {
+        block = malloc(total);
+        if (!block) out_of_memory(size);
+        block->chunk = NULL;
+    }
+    account((int64_t)size);
+    atomic_fetch_add_explicit(&mem.allocations, 1, memory_order_relaxed);
+    return block + 1;
+}
+
+static void mp_free(void* ptr, size_t size) {
+    if (!ptr) return;
+    MpBlock* block = (MpBlock*)ptr - 1;
+    account(-(int64_t)size);
+    ArenaChunk* chunk = block->chunk;
+    if (!chunk) {
+        free(block);
+        return;
+    }
+    if (atomic_fetch_sub_explicit(&chunk->live, 1, memory_order_acq_rel) == 1 &&
+        atomic_load(&chunk->retired)) {
+        chunk_reclaim(chunk);
+    }
+}
+
+static void* mp_reallocate(void* ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return mp_allocate(new_size);
+    MpBlock* block = (MpBlock*)ptr - 1;
+    if (!block->chunk) {
+        size_t total = (sizeof(MpBlock) + new_size + 15) & ~(size_t)15;
+        block = realloc(block, total);
+        if (!block) out_of_memory(new_size);
+        account((int64_t)new_size - (int64_t)old_size);
+        atomic_fetch_add_explicit(&mem.allocations, 1, memory_order_relaxed);
+        return block + 1;
+    }
+    // Arena blocks cannot grow in place, they move
+    void* moved = mp_allocate(new_size);
+    memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    mp_free(ptr, old_size);
+    return moved;
+}
+
+void mp_memory_install() {
+    DEBUG_FUNCTION_ENTER();
+    pthread_key_create(&mem.key, thread_exit);
+    mp_set_memory_functions(mp_allocate, mp_reallocate, mp_free);
+    DEBUG_FUNCTION_EXIT();
+}
+
+void mp_memory_set_arena(bool on) {
+    mem.arena = on;
+    if (on) return;
+
+    // Only the calling thread's chunk can be retired here, workers retire
+    // theirs when they exit
+    chunk_retire(current);
+    set_current(NULL);
+    pthread_mutex_lock(&mem.lock);
+    ArenaChunk* pool = mem.pool;
+    mem.pool = NULL;
+    mem.pooled = 0;
+    pthread_mutex_unlock(&mem.lock);
+    while (pool) {
+        ArenaChunk* next = pool->next;
+        free(pool);
+        atomic_fetch_sub(&mem.chunks, 1);
+        pool = next;
+    }
+}
+
+void mp_memory_scope_begin() {
+    if (mem.arena) atomic_store_explicit(&mem.active, true, memory_order_relaxed);
+}
+
+void mp_memory_scope_end() {
+    atomic_store_explicit(&mem.active, false, memory_order_relaxed);
+    // Usually every temporary is gone by now and the chunk starts over
+    ArenaChunk* chunk = current;
+    if (chunk && chunk->used && atomic_load_explicit(&chunk->live, memory_order_acquire) == 0) {
+        chunk->used = 0;
+        atomic_fetch_add_explicit(&mem.arena_resets, 1, memory_order_relaxed);
+    }
+}
+
+void mp_memory_get(MpMemoryStats* stats) {
+    stats->current = atomic_load(&mem.current);
+    stats->peak = atomic_load(&mem.peak);
+    stats->allocations = atomic_load(&mem.allocations);
+    stats->arena_blocks = atomic_load(&mem.arena_blocks);
+    stats->arena_resets = atomic_load(&mem.arena_resets);
+    stats->arena_chunks = atomic_load(&mem.chunks);
+    stats->arena = mem.arena;
+}
+
+int64_t mp_memory_current() {
+    return atomic_load_explicit(&mem.current, memory_order_relaxed);
+}
+
+void mp_memory_set_ceiling(int64_t bytes) {
+    atomic_store(&mem.ceiling_hit, false);
+    atomic_store(&mem.ceiling, bytes);
+}
+
+bool mp_memory_ceiling_hit() {
+    return atomic_load_explicit(&mem.ceiling_hit, memory_order_relaxed);
+}
+
+int64_t mp_memory_thread_current() {
+    return own.current;
+}
+
+void mp_memory_set_thread_ceiling(int64_t bytes) {
+    own.ceiling_hit = false;
+    own.ceiling = bytes;
+}
+
+bool mp_memory_thread_ceiling_hit() {
+    return own.ceiling_hit;
+}
+
+void mp_memory_reset() {
+    atomic_store(&mem.peak, atomic_load(&mem.current));
+    atomic_store(&mem.allocations, 0);
+    atomic_store(&mem.arena_blocks, 0);
+    atomic_store(&mem.arena_resets, 0);
+}
+
+void mp_memory_show() {
+    MpMemoryStats stats;
+    mp_memory_get(&stats);
+    printf("GMP/MPFR memory: %lld bytes in use, peak %lld bytes, %llu allocations\n",
+           (long long)stats.current, (long long)stats.peak, (unsigned long long)stats.allocations);
+    if (stats.arena || stats.arena_chunks) {
+        printf("Arena %s: %llu blocks, %llu resets, %u chunk(s) of %u KiB\n", stats.arena ? "on" : "off",
+               (unsigned long long)stats.arena_blocks, (unsigned long long)stats.arena_resets,
+               stats.arena_chunks, MP_ARENA_CHUNK_BYTES / 1024);
+    }
+}
@@ -1,10 +1,22 @@
+#define _GNU_SOURCE // pthread_getattr_np
 #include "parser.h"
+#include "array.h"
+#include "builtins.h"
+#include "evalLimits.h"
+#include "history.h"
+#include "matrix.h"
+#include "mpMemory.h"
 #include "symbolTable.h"
+#include "taskPool.h"
+#include "stats.h"
+#include "trace.h"
 #include "debug.h"
 #include <assert.h>
 #include <ctype.h>
 #include <gmp.h>
+#include <math.h>
 #include <mpfr.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -17,19 +29,27 @@
 // ##############################
 
 static bool lookupTable[256];
-char bufferNames[TOKEN_LEXEME_LEN_LIMIT];
-const char* TokenNamesConsts[20] = {
+
+// Identifier characters, filled once for every token buffer
+static void tokenizer_init() {
+    for (uint8_t i = 'a'; i <= 'z'; i++) lookupTable[i] = true;
+    for (uint8_t i = 'A'; i <= 'Z'; i++) lookupTable[i] = true;
+    lookupTable['_'] = true;
+}
+_Thread_local char bufferNames[TOKEN_LEXEME_LEN_LIMIT]; // sessions may report errors concurrently
+const char* TokenNamesConsts[TOK_INVALID + 1] = {
     "TOK_NUM", "TOK_VAR", "TOK_ASSING", "TOK_ADD", "TOK_SUB",
-    "TOK_DIVIDE", "TOK_MODULE", "TOK_MULT", "TOK_POWER", "TOK_SQUARE",
-    "TOK_LPAR", "TOK_RPAR", "TOK_COMM", "TOK_LCOR", "TOK_RCOR",
-    "TOK_INVALID"
+    "TOK_DIVIDE", "TOK_MODULE", "TOK_MULT", "TOK_POWER", "TOK_FUNC",
+    "TOK_CONST", "TOK_HISTORY", "TOK_LPAR", "TOK_RPAR", "TOK_COMM", "TOK_LCOR", "TOK_RCOR",
+    "TOK_NEG", "TOK_CALL", "TOK_PARAM", "TOK_DEFINE", "TOK_VECTOR", "TOK_INDEX",
+    "TOK_FMA", "TOK_FMS", "TOK_SUM", "TOK_POWI", "TOK_INVALID"
 };
 
 static inline bool token_buffer_add(TokenBuffer* buff, TokenType type, const char* start, uint8_t len) {
     DEBUG_FUNCTION_ENTER();
     
     if (buff->count >= buff->size) {
-        size_t new_size = buff->size + TOKEN_BUFFER_SIZE;
+        size_t new_size = buff->size * 2;
         Token* new_buff = realloc(buff->token_buff, new_size * sizeof(Token));
         if (!new_buff) {
             ERROR_PRINT("Out of memory for tokens (requested: %zu bytes)\n", new_size * sizeof(Token));
@@ -38,7 +58,7 @@ static inline bool token_buffer_add(TokenBuffer* buff, TokenType type, const cha
         }
         buff->token_buff = new_buff;
         buff->size = new_size;
-        DEBUG_TOKENIZE("Token buffer resized: %d -> %zu\n", buff->size - TOKEN_BUFFER_SIZE, new_size);
+        DEBUG_TOKENIZE("Token buffer resized: %u -> %zu\n", buff->size / 2, new_size);
     }
     
     Token* tok = &buff->token_buff[buff->count++];
@@ -46,6 +66,7 @@ static inline bool token_buffer_add(TokenBuffer* buff, TokenType type, const cha
     tok->type = type;
     tok->len = len;
     tok->negative = false;
+    tok->id = 0;
     
     DEBUG_TOKEN(type, start, len);
     DEBUG_FUNCTION_EXIT();
@@ -53,9 +74,11 @@ static inline bool token_buffer_add(TokenBuffer* buff, TokenType type, const cha
 }
 
 static inline const char* token_adjust_lexeme(Token* tok) {
-    if (tok->type > TOK_VAR) return tok->lexeme;
-    snprintf(bufferNames, tok->len + 1 + tok->negative, "%s%s", 
-             tok->negative ? "-" : "", tok->lexeme);
+    if (tok->type > TOK_VAR && tok->type != TOK_CALL && tok->type != TOK_PARAM &&
+        tok->type != TOK_FUNC && tok->type != TOK_CONST && tok->type != TOK_HISTORY) return tok->lexeme;
+    // %.*s: the lexeme points into the whole line, never scan past it
+    snprintf(bufferNames, tok->len + 1 + tok->negative, "%s%.*s", 
+             tok->negative ? "-" : "", tok->len, tok->lexeme);
     return bufferNames;
 }
 
@@ -74,10 +97,9 @@ TokenBuffer* token_buffer_create() {
     buff->size = TOKEN_BUFFER_SIZE;
     buff->count = 0;
 
-    // Initialize lookup table
-    for (uint8_t i = 'a'; i <= 'z'; i++) lookupTable[i] = true;
-    for (uint8_t i = 'A'; i <= 'Z'; i++) lookupTable[i] = true;
-    lookupTable['_'] = true;
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, tokenizer_init);
+    builtins_init();
 
     DEBUG_TOKENIZE("Token buffer created: size=%d\n", TOKEN_BUFFER_SIZE);
     DEBUG_FUNCTION_EXIT();
@@ -100,7 +122,7 @@ void token_buffer_show(TokenBuffer* tokBuff) {
     CHECK_NULL(tokBuff, return);
     
     printf("Tokens (%d):\n", tokBuff->count);
-    for (uint16_t i = 0; i < tokBuff->count; i++) {
+    for (uint32_t i = 0; i < tokBuff->count; i++) {
         Token* currTok = &tokBuff->token_buff[i];
         printf("  %2d: %-12s [%s] (len: %d%s)\n", 
                i, TokenNamesConsts[currTok->type], 
@@ -121,6 +143,7 @@ bool tokenize(TokenBuffer* tokBuff, const char* buff) {
     tokBuff->count = 0;
     const char* p = buff;
     int token_count = 0;
+    uint32_t depth = 0; // inside () or [] a ',' separates arguments
 
     while (*p) {
         if (isspace(*p)) {
@@ -134,7 +157,7 @@ bool tokenize(TokenBuffer* tokBuff, const char* buff) {
 
             while (1) {
                 if (isdigit(*p)) p++;
-                else if (!isFloat && (*p == '.' || *p == ',')) {
+                else if (!isFloat && (*p == '.' || (*p == ',' && depth == 0))) {
                     isFloat = true; 
                     p++;
                 } else break;
@@ -157,7 +180,7 @@ bool tokenize(TokenBuffer* tokBuff, const char* buff) {
 
         if (isascii(*p) && lookupTable[*p]) {
             const char* n = p++;
-            while (isascii(*p) && lookupTable[*p]) p++;
+            while (isascii(*p) && (lookupTable[*p] || isdigit(*p))) p++;
 
             if (p - n > TOKEN_LEXEME_LEN_LIMIT) {
                 ERROR_PRINT("Identifier too long: '%.*s...' (max %d)\n", 
@@ -166,19 +189,45 @@ bool tokenize(TokenBuffer* tokBuff, const char* buff) {
                 return false;
             }
 
-            if (p - n == 4 && strncmp(n, "sqrt", 4) == 0) {
-                if (!token_buffer_add(tokBuff, TOK_SQUARE, "sqrt", 4)) {
+            int builtin = builtin_lookup(n, p - n);
+            if (builtin >= 0) {
+                TokenType type = builtinTable[builtin].kind == BUILTIN_CONSTANT ? TOK_CONST : TOK_FUNC;
+                if (!token_buffer_add(tokBuff, type, n, p - n)) {
                     DEBUG_FUNCTION_EXIT();
                     return false;
                 }
+                tokBuff->token_buff[tokBuff->count-1].id = builtin;
                 token_count++;
                 continue;
             }
 
-            if (!token_buffer_add(tokBuff, TOK_VAR, n, p - n)) {
+            // 'last' is $1
+            bool last = p - n == 4 && memcmp(n, "last", 4) == 0;
+            if (!token_buffer_add(tokBuff, last ? TOK_HISTORY : TOK_VAR, n, p - n)) {
+                DEBUG_FUNCTION_EXIT();
+                return false;
+            }
+            if (last) tokBuff->token_buff[tokBuff->count-1].id = 1;
+            token_count++;
+            continue;
+        }
+
+        if (*p == '$') {
+            // $n, resolved to its ring slot when evaluated
+            const char* n = p++;
+            while (isdigit(*p)) p++;
+            long index = p - n > 1 && p - n <= 6 ? strtol(n + 1, NULL, 10) : 0;
+            if (index < 1 || index > HISTORY_SIZE) {
+                ERROR_PRINT("Unknown result '%.*s', the history goes from $1 to $%d\n",
+                           (int)(p - n), n, HISTORY_SIZE);
                 DEBUG_FUNCTION_EXIT();
                 return false;
             }
+            if (!token_buffer_add(tokBuff, TOK_HISTORY, n, p - n)) {
+                DEBUG_FUNCTION_EXIT();
+                return false;
+            }
+            tokBuff->token_buff[tokBuff->count-1].id = index;
             token_count++;
             continue;
         }
@@ -197,14 +246,34 @@ bool tokenize(TokenBuffer* tokBuff, const char* buff) {
                 }
                 break;
             case '-': {
-                if (tokBuff->count == 0 || 
-                    (tokBuff->token_buff[tokBuff->count-1].type != TOK_NUM &&
-                     tokBuff->token_buff[tokBuff->count-1].type != TOK_RPAR &&
-                     tokBuff->token_buff[tokBuff->count-1].type != TOK_VAR)) {
-                    p++;
-                    while (*p == ' ') p++;
-                    const char* n = p;
-                    while (isdigit(*p)) p++;
+                // A '-' that cannot be a binary operator and is followed by a
+                // digit is folded into the literal, otherwise the parser
+                // decides between subtraction and negation.
+                const char* n = p + 1;
+                while (*n == ' ') n++;
+                bool after_operand = tokBuff->count > 0 &&
+                    (tokBuff->token_buff[tokBuff->count-1].type == TOK_NUM ||
+                     tokBuff->token_buff[tokBuff->count-1].type == TOK_RPAR ||
+                     tokBuff->token_buff[tokBuff->count-1].type == TOK_RCOR ||
+                     tokBuff->token_buff[tokBuff->count-1].type == TOK_VAR ||
+                     tokBuff->token_buff[tokBuff->count-1].type == TOK_CONST ||
+                     tokBuff->token_buff[tokBuff->count-1].type == TOK_HISTORY);
+                if (!after_operand && isdigit(*n)) {
+                    p = n;
+                    bool isFloat = false;
+                    while (1) {
+                        if (isdigit(*p)) p++;
+                        else if (!isFloat && (*p == '.' || (*p == ',' && depth == 0))) {
+                            isFloat = true;
+                            p++;
+                        } else break;
+                    }
+                    if (p - n > TOKEN_LEXEME_LEN_LIMIT) {
+                        ERROR_PRINT("Number too long: '%.*s...' (max %d)\n",
+                                   TOKEN_LEXEME_LEN_LIMIT, n, TOKEN_LEXEME_LEN_LIMIT);
+                        DEBUG_FUNCTION_EXIT();
+                        return false;
+                    }
                     if (!token_buffer_add(tokBuff, TOK_NUM, n, p - n)) {
                         DEBUG_FUNCTION_EXIT();
                         return false;
@@ -237,24 +306,28 @@ bool tokenize(TokenBuffer* tokBuff, const char* buff) {
                     DEBUG_FUNCTION_EXIT();
                     return false;
                 }
+                depth++;
                 break;
             case ')': 
                 if (!token_buffer_add(tokBuff, TOK_RPAR, ")", 1)) {
                     DEBUG_FUNCTION_EXIT();
                     return false;
                 }
+                if (depth > 0) depth--;
                 break;
             case '[': 
                 if (!token_buffer_add(tokBuff, TOK_LCOR, "[", 1)) {
                     DEBUG_FUNCTION_EXIT();
                     return false;
                 }
+                depth++;
                 break;
             case ']': 
                 if (!token_buffer_add(tokBuff, TOK_RCOR, "]", 1)) {
                     DEBUG_FUNCTION_EXIT();
                     return false;
                 }
+                if (depth > 0) depth--;
                 break;
             case '%': 
                 if (!token_buffer_add(tokBuff, TOK_MODULE, "%", 1)) {
@@ -290,38 +363,39 @@ bool tokenize(TokenBuffer* tokBuff, const char* buff) {
 }
 
 // ##############################
-// #####       PARSER       ##### 
+// #####       PARSER       #####
 // ##############################
 
+// Lower number binds weaker. Rows left at zero are not operators.
+static const OperatorInfo operatorTable[TOK_INVALID + 1] = {
+    [TOK_ASSING] = { .precedence = 1, .right_assoc = true },
+    [TOK_ADD]    = { .precedence = 2 },
+    [TOK_SUB]    = { .precedence = 2, .prefix_precedence = 4, .prefix_kind = TOK_NEG },
+    [TOK_MULT]   = { .precedence = 3 },
+    [TOK_DIVIDE] = { .precedence = 3 },
+    [TOK_MODULE] = { .precedence = 3 },
+    [TOK_POWER]  = { .precedence = 5, .right_assoc = true },
+    [TOK_FUNC]   = { .call = true },
+};
+
 static inline Token* peek(Parser* parser) {
     if (parser->curr_tok >= parser->tokens->count) return NULL;
     return &parser->tokens->token_buff[parser->curr_tok];
 }
 
-static inline Token* peek_next(Parser* parser) {
-    if (parser->curr_tok + 1 >= parser->tokens->count) return NULL;
-    return &parser->tokens->token_buff[parser->curr_tok + 1];
-}
-
 static inline Token* consume(Parser* parser) {
     if (parser->curr_tok >= parser->tokens->count) return NULL;
     Token* token = &parser->tokens->token_buff[parser->curr_tok++];
-    parser->nodesBuffer[parser->curr_node].token = token;
-    DEBUG_PARSE("Consumed: %s [%s]\n", 
+    DEBUG_PARSE("Consumed: %s [%s]\n",
                TokenNamesConsts[token->type], token_adjust_lexeme(token));
     return token;
 }
 
-static inline bool match(Parser* parser, TokenType type) {
-    Token* token = peek(parser);
-    return token && token->type == type;
-}
-
 static inline bool expect(Parser* parser, TokenType type) {
     Token* token = peek(parser);
     if (token && token->type == type) return true;
-    
-    ERROR_PRINT("Expected %s, got %s [%s]\n", 
+
+    ERROR_PRINT("Expected %s, got %s [%s]\n",
                TokenNamesConsts[type],
                token ? TokenNamesConsts[token->type] : "EOF",
                token ? token_adjust_lexeme(token) : "EOF");
@@ -331,29 +405,32 @@ static inline bool expect(Parser* parser, TokenType type) {
 
 static inline ASTNode* create_leaf_node(Parser* p, Token* token) {
     if (p->curr_node >= p->size) {
-        ERROR_PRINT("AST node buffer overflow (size: %d)\n", p->size);
+        ERROR_PRINT("AST node buffer overflow (size: %u)\n", p->size);
         return NULL;
     }
-    
+
     ASTNode* node = &p->nodesBuffer[p->curr_node++];
     node->token = token;
-    node->left = node->right = NULL;
-    
+    node->left = node->right = node->next = NULL;
+    node->aux = 0;
+
     DEBUG_AST_NODE(node, "leaf");
     return node;
 }
 
 static inline ASTNode* create_binary_node(Parser* p, Token* op, ASTNode* left, ASTNode* right) {
     if (p->curr_node >= p->size) {
-        ERROR_PRINT("AST node buffer overflow (size: %d)\n", p->size);
+        ERROR_PRINT("AST node buffer overflow (size: %u)\n", p->size);
         return NULL;
     }
-    
+
     ASTNode* node = &p->nodesBuffer[p->curr_node++];
     node->token = op;
     node->left = left;
     node->right = right;
-    
+    node->next = NULL;
+    node->aux = 0;
+
     DEBUG_AST_NODE(node, "binary");
     DEBUG_PARSE("  Left: %s, Right: %s\n",
                left ? TokenNamesConsts[left->token->type] : "NULL",
@@ -361,210 +438,187 @@ static inline ASTNode* create_binary_node(Parser* p, Token* op, ASTNode* left, A
     return node;
 }
 
+// Both stacks are sized to the token count in parse(), every token pushes at
+// most once so the pushes below never need a bounds check.
+static inline void push_value(Parser* p, uint32_t* top, ASTNode* node) {
+    p->valStack[(*top)++] = node;
+}
 
-static ASTNode* parse_statement(Parser* p);     // Level 0
-static ASTNode* parse_assignment(Parser* p);    // Level 1
-static ASTNode* parse_expression(Parser* p);    // Level 2
-static ASTNode* parse_term(Parser* p);          // Level 3
-static ASTNode* parse_power(Parser* p);         // Level 4
-static ASTNode* parse_primary(Parser* p);       // Level 5
+static inline void push_op(Parser* p, uint32_t* top, Token* tok, ParserEntryKind kind) {
+    ParserEntry* entry = &p->opStack[(*top)++];
+    entry->token = tok;
+    entry->kind = kind;
+    entry->argc = 0;
+}
 
-static ASTNode* parse_primary(Parser* p) {
-    DEBUG_PARSE_LEVEL(5, "Entering parse_primary()\n");
-    Token* curr = peek(p);
-    CHECK_NULL(curr, ERROR_RETURN_NULL("Unexpected EOF in primary expression"));
-    
-    switch (curr->type) {
-        case TOK_NUM: {
-            ASTNode* node = create_leaf_node(p, consume(p));
-            DEBUG_PARSE_LEVEL(5, "Number literal: %s\n", token_adjust_lexeme(curr));
-            DEBUG_FUNCTION_EXIT();
-            return node;
-        }
-        case TOK_VAR: {
-            ASTNode* node = create_leaf_node(p, consume(p));
-            DEBUG_PARSE_LEVEL(5, "Variable: %s\n", token_adjust_lexeme(curr));
-            DEBUG_FUNCTION_EXIT();
-            return node;
-        }
-        case TOK_LPAR: {
-            DEBUG_PARSE_LEVEL(5, "Parenthesized expression\n");
-            consume(p); // Consume '('
-            ASTNode* expr = parse_expression(p);
-            if (!expr) {
-                ERROR_RETURN_NULL("Failed to parse expression inside parentheses");
-            }
-            if (!expect(p, TOK_RPAR)) {
-                ERROR_RETURN_NULL("Missing closing parenthesis");
-            }
-            consume(p); // Consume ')'
-            DEBUG_PARSE_LEVEL(5, "Parenthesized expression completed\n");
-            DEBUG_FUNCTION_EXIT();
-            return expr;
-        }
-        case TOK_SQUARE: {
-            DEBUG_PARSE_LEVEL(5, "Square root function\n");
-            ASTNode* sqrt = create_leaf_node(p, consume(p));
-            if (!expect(p, TOK_LPAR)) {
-                ERROR_RETURN_NULL("Expected '(' after sqrt");
-            }
-            consume(p);
-            sqrt->left = parse_expression(p);
-            if (!sqrt->left) {
-                ERROR_RETURN_NULL("Invalid sqrt argument");
-            }
-            if (!expect(p, TOK_RPAR)) {
-                ERROR_RETURN_NULL("Missing closing parenthesis for sqrt");
+static inline uint8_t entry_precedence(const ParserEntry* entry) {
+    const OperatorInfo* info = &operatorTable[entry->token->type];
+    return entry->kind == ENTRY_PREFIX ? info->prefix_precedence : info->precedence;
+}
+
+// Pops one operator from the stack and turns it into a node.
+static bool reduce(Parser* p, uint32_t* ops, uint32_t* vals) {
+    ParserEntry* entry = &p->opStack[--(*ops)];
+
+    switch (entry->kind) {
+        case ENTRY_BINARY: {
+            if (*vals < 2) ERROR_RETURN(false, "Missing operand for %s\n", TokenNamesConsts[entry->token->type]);
+            ASTNode* right = p->valStack[--(*vals)];
+            ASTNode* left = p->valStack[--(*vals)];
+
+            if (entry->token->type == TOK_ASSING && left->token->type == TOK_CALL) {
+                // f(x, y) = body: every argument must be a distinct plain name
+                for (ASTNode* param = left->left; param; param = param->next) {
+                    if (param->token->type != TOK_VAR) {
+                        ERROR_RETURN(false, "Function parameters must be names: %s\n", TokenNamesConsts[param->token->type]);
+                    }
+                    for (ASTNode* other = param->next; other; other = other->next) {
+                        if (other->token->type == TOK_VAR && other->token->len == param->token->len &&
+                            memcmp(other->token->lexeme, param->token->lexeme, param->token->len) == 0) {
+                            ERROR_RETURN(false, "Duplicate parameter: '%.*s'\n", param->token->len, param->token->lexeme);
+                        }
+                    }
+                }
+                entry->token->type = TOK_DEFINE;
+            } else if (entry->token->type == TOK_ASSING && left->token->type != TOK_VAR) {
+                ERROR_RETURN(false, "Invalid assignment target: %s\n", TokenNamesConsts[left->token->type]);
             }
-            consume(p);
-            DEBUG_PARSE_LEVEL(5, "Square root function completed\n");
-            DEBUG_FUNCTION_EXIT();
-            return sqrt;
+
+            ASTNode* node = create_binary_node(p, entry->token, left, right);
+            CHECK_NULL(node, return false);
+            push_value(p, vals, node);
+            return true;
         }
-        default: {
-            ERROR_PRINT("Unexpected token in primary expression: %s [%s]\n",
-                       TokenNamesConsts[curr->type], token_adjust_lexeme(curr));
-            DEBUG_FUNCTION_EXIT();
-            return NULL;
+        case ENTRY_PREFIX: {
+            if (*vals < 1) ERROR_RETURN(false, "Missing operand for prefix %s\n", TokenNamesConsts[entry->token->type]);
+            ASTNode* operand = p->valStack[--(*vals)];
+
+            entry->token->type = operatorTable[entry->token->type].prefix_kind;
+            ASTNode* node = create_leaf_node(p, entry->token);
+            CHECK_NULL(node, return false);
+            node->left = operand;
+            push_value(p, vals, node);
+            return true;
         }
+        case ENTRY_VECTOR:
+        case ENTRY_INDEX:
+            ERROR_RETURN(false, "Missing closing bracket\n");
+        default:
+            ERROR_RETURN(false, "Missing closing parenthesis\n");
     }
 }
 
-static ASTNode* parse_power(Parser* p) {
-    DEBUG_PARSE_LEVEL(4, "Entering parse_power()\n");
-    ASTNode* left = parse_primary(p);
-    CHECK_NULL(left, ERROR_RETURN_NULL("Failed to parse left operand for power"));
-    
-    if (match(p, TOK_POWER)) {
-        DEBUG_PARSE_LEVEL(4, "Power operator found\n");
-        Token* op = consume(p);
-        ASTNode* right = parse_power(p);
-        CHECK_NULL(right, ERROR_RETURN_NULL("Failed to parse right operand for power"));
-        
-        ASTNode* node = create_binary_node(p, op, left, right);
-        DEBUG_PARSE_LEVEL(4, "Power expression completed\n");
-        DEBUG_FUNCTION_EXIT();
-        return node;
-    }
-    
-    DEBUG_PARSE_LEVEL(4, "No power operator, returning primary\n");
-    DEBUG_FUNCTION_EXIT();
-    return left;
+static inline bool entry_is_group(const ParserEntry* entry) {
+    return entry->kind != ENTRY_BINARY && entry->kind != ENTRY_PREFIX;
 }
 
-static ASTNode* parse_term(Parser* p) {
-    DEBUG_PARSE_LEVEL(3, "Entering parse_term()\n");
-    ASTNode* left = parse_power(p);
-    CHECK_NULL(left, ERROR_RETURN_NULL("Failed to parse left operand for term"));
-    
-    while (match(p, TOK_MULT) || match(p, TOK_DIVIDE) || match(p, TOK_MODULE)) {
-        TokenType op_type = peek(p)->type;
-        DEBUG_PARSE_LEVEL(3, "Operator found: %s\n", TokenNamesConsts[op_type]);
-        
-        Token* op = consume(p);
-        ASTNode* right = parse_power(p);
-        CHECK_NULL(right, {
-            ERROR_PRINT("Failed to parse right operand for %s\n", TokenNamesConsts[op_type]);
-            return NULL;
-        });
-        
-        left = create_binary_node(p, op, left, right);
-        DEBUG_PARSE_LEVEL(3, "Updated term with %s operation\n", TokenNamesConsts[op_type]);
+// Closes the innermost '(' or '[' matching 'closer'. A function call or a
+// vector literal becomes one node with its operands chained through 'next' in
+// source order, an index becomes a binary node (vector, index).
+static bool close_group(Parser* p, uint32_t* ops, uint32_t* vals, TokenType closer, bool empty) {
+    while (*ops > 0 && !entry_is_group(&p->opStack[*ops - 1])) {
+        if (!reduce(p, ops, vals)) return false;
+    }
+    if (*ops == 0) {
+        ERROR_RETURN(false, "Unmatched closing %s\n", closer == TOK_RPAR ? "parenthesis" : "bracket");
     }
-    
-    DEBUG_PARSE_LEVEL(3, "Term parsing completed\n");
-    DEBUG_FUNCTION_EXIT();
-    return left;
-}
 
-static ASTNode* parse_expression(Parser* p) {
-    DEBUG_PARSE_LEVEL(2, "Entering parse_expression()\n");
-    ASTNode* left = parse_term(p);
-    CHECK_NULL(left, ERROR_RETURN_NULL("Failed to parse left operand for expression"));
-    
-    while (match(p, TOK_ADD) || match(p, TOK_SUB)) {
-        TokenType op_type = peek(p)->type;
-        DEBUG_PARSE_LEVEL(2, "Operator found: %s\n", TokenNamesConsts[op_type]);
-        
-        Token* op = consume(p);
-        ASTNode* right = parse_term(p);
-        CHECK_NULL(right, {
-            ERROR_PRINT("Failed to parse right operand for %s\n", TokenNamesConsts[op_type]);
-            return NULL;
-        });
-        
-        left = create_binary_node(p, op, left, right);
-        DEBUG_PARSE_LEVEL(2, "Updated expression with %s operation\n", TokenNamesConsts[op_type]);
+    ParserEntry* entry = &p->opStack[--(*ops)];
+    bool bracket = entry->kind == ENTRY_VECTOR || entry->kind == ENTRY_INDEX;
+    if (bracket != (closer == TOK_RCOR)) {
+        ERROR_RETURN(false, "Mismatched '%c'\n", closer == TOK_RPAR ? ')' : ']');
     }
-    
-    DEBUG_PARSE_LEVEL(2, "Expression parsing completed\n");
-    DEBUG_FUNCTION_EXIT();
-    return left;
-}
+    if (entry->kind == ENTRY_GROUP) return true;
 
-static ASTNode* parse_assignment(Parser* p) {
-    DEBUG_PARSE_LEVEL(1, "Entering parse_assignment()\n");
-    
-    // Solo variables pueden ser asignadas
-    if (peek(p)->type != TOK_VAR) {
-        DEBUG_PARSE_LEVEL(1, "Not a variable, falling back to expression\n");
-        return parse_expression(p);
+    if (entry->kind == ENTRY_INDEX) {
+        if (empty) ERROR_RETURN(false, "Missing index inside '[]'\n");
+        ASTNode* index = p->valStack[--(*vals)];
+        ASTNode* target = p->valStack[--(*vals)];
+        entry->token->type = TOK_INDEX;
+        ASTNode* node = create_binary_node(p, entry->token, target, index);
+        CHECK_NULL(node, return false);
+        push_value(p, vals, node);
+        return true;
     }
-    
-    ASTNode* left = create_leaf_node(p, consume(p));
-    CHECK_NULL(left, ERROR_RETURN_NULL("Failed to parse variable for assignment"));
-    
-    if (match(p, TOK_ASSING)) {
-        DEBUG_PARSE_LEVEL(1, "Assignment operator found\n");
-        Token* op = consume(p);
-        ASTNode* right = parse_expression(p);
-        CHECK_NULL(right, ERROR_RETURN_NULL("Failed to parse right side of assignment"));
-        
-        ASTNode* node = create_binary_node(p, op, left, right);
-        DEBUG_PARSE_LEVEL(1, "Assignment parsing completed\n");
-        DEBUG_FUNCTION_EXIT();
-        return node;
+
+    if (!empty) entry->argc++; // the operand closed by ')' or ']'
+
+    if (entry->kind == ENTRY_VECTOR) {
+        if (entry->argc == 0) ERROR_RETURN(false, "Empty vector\n");
+        entry->token->type = TOK_VECTOR;
+    } else if (entry->token->type == TOK_VAR) {
+        // User function, its arity is checked against the definition when called
+        entry->token->type = TOK_CALL;
+    } else {
+        uint8_t arity = builtinTable[entry->token->id].arity;
+        if (entry->argc != arity) {
+            ERROR_RETURN(false, "%s expects %u argument(s), got %u\n",
+                         builtinTable[entry->token->id].name, arity, entry->argc);
+        }
     }
-    
-    DEBUG_PARSE_LEVEL(1, "No assignment operator, returning variable\n");
-    DEBUG_FUNCTION_EXIT();
-    return left;
+
+    ASTNode* node = create_leaf_node(p, entry->token);
+    CHECK_NULL(node, return false);
+    node->aux = entry->argc;
+
+    *vals -= entry->argc;
+    ASTNode** operands = &p->valStack[*vals];
+    node->left = entry->argc ? operands[0] : NULL;
+    for (uint32_t i = 0; i + 1 < entry->argc; i++) operands[i]->next = operands[i + 1];
+    push_value(p, vals, node);
+
+    DEBUG_PARSE("%s completed: %u operand(s)\n", TokenNamesConsts[entry->token->type], entry->argc);
+    return true;
 }
 
-static ASTNode* parse_statement(Parser* p) {
-    DEBUG_PARSE_LEVEL(0, "Entering parse_statement()\n");
-    
-    // Verifica si es asignación
-    if (peek(p) && peek(p)->type == TOK_VAR && peek_next(p) && peek_next(p)->type == TOK_ASSING) {
-        DEBUG_PARSE_LEVEL(0, "Assignment statement detected\n");
-        ASTNode* var = create_leaf_node(p, consume(p));
-        CHECK_NULL(var, ERROR_RETURN_NULL("Failed to parse variable in assignment"));
-        
-        Token* op = consume(p);
-        ASTNode* right = parse_expression(p);
-        CHECK_NULL(right, ERROR_RETURN_NULL("Failed to parse assignment value"));
-        
-        ASTNode* node = create_binary_node(p, op, var, right);
-        DEBUG_PARSE_LEVEL(0, "Assignment statement completed\n");
-        DEBUG_FUNCTION_EXIT();
-        return node;
-    } else {
-        DEBUG_PARSE_LEVEL(0, "Expression statement detected\n");
-        ASTNode* expr = parse_expression(p);
-        DEBUG_PARSE_LEVEL(0, "Expression statement completed\n");
-        DEBUG_FUNCTION_EXIT();
-        return expr;
+// Turns the body references to the parameters of 'def' into frame slots.
+// A definition is only valid as a whole statement.
+static bool resolve_parameters(Parser* p, ASTNode* root) {
+    for (uint32_t i = 0; i < p->curr_node; i++) {
+        ASTNode* node = &p->nodesBuffer[i];
+        if (node->token->type == TOK_DEFINE && node != root) {
+            ERROR_RETURN(false, "Function definitions are only allowed as a whole statement\n");
+        }
     }
+    if (root->token->type != TOK_DEFINE) return true;
+
+    ASTNode* call = root->left;
+    for (uint32_t i = 0; i < p->curr_node; i++) {
+        ASTNode* node = &p->nodesBuffer[i];
+        if (node->token->type != TOK_VAR) continue;
+
+        uint32_t slot = 0;
+        for (ASTNode* param = call->left; param; param = param->next, slot++) {
+            if (param == node) break;
+            if (param->token->len == node->token->len &&
+                memcmp(param->token->lexeme, node->token->lexeme, node->token->len) == 0) {
+                node->token->type = TOK_PARAM;
+                node->aux = slot;
+                break;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < p->curr_node; i++) {
+        ASTNode* node = &p->nodesBuffer[i];
+        if (node->token->type == TOK_ASSING && node->left->token->type == TOK_PARAM) {
+            ERROR_RETURN(false, "Cannot assign to parameter '%.*s'\n",
+                         node->left->token->len, node->left->token->lexeme);
+        }
+    }
+
+    DEBUG_PARSE("Function definition: %.*s/%u\n", call->token->len, call->token->lexeme, call->aux);
+    return true;
 }
 
 ASTNode* parse(Parser* parser) {
     DEBUG_FUNCTION_ENTER();
     CHECK_NULL(parser, ERROR_RETURN_NULL("Parser is NULL"));
     CHECK_NULL(parser->tokens, ERROR_RETURN_NULL("Token buffer is NULL"));
-    
+
     parser->curr_node = 0;
     parser->curr_tok = 0;
-    
+
     // Ensure enough space for AST nodes
     if (parser->size < parser->tokens->count + 1) {
         size_t new_size = parser->tokens->size;
@@ -574,150 +628,1365 @@ ASTNode* parse(Parser* parser) {
         parser->size = new_size;
         DEBUG_PARSE("AST node buffer resized to %zu\n", new_size);
     }
-    
-    ASTNode* ans = parse_statement(parser);
-    
-    DEBUG_PARSE("Parsing completed - Tokens consumed: %d/%d, Nodes created: %d\n",
-               parser->curr_tok, parser->tokens->count, parser->curr_node);
-    
-    if (ans) {
-        DEBUG_PARSE("Root node: %s [%s]\n",
-                   TokenNamesConsts[ans->token->type],
-                   token_adjust_lexeme(ans->token));
-    } else {
-        ERROR_PRINT("Failed to parse statement\n");
+
+    // Ensure enough space for the operator and operand stacks
+    if (parser->stack_size < parser->tokens->count + 1) {
+        size_t new_size = parser->tokens->size;
+        ParserEntry* newOps = realloc(parser->opStack, new_size * sizeof(ParserEntry));
+        CHECK_NULL(newOps, ERROR_RETURN_NULL("Failed to reallocate operator stack"));
+        parser->opStack = newOps;
+        ASTNode** newVals = realloc(parser->valStack, new_size * sizeof(ASTNode*));
+        CHECK_NULL(newVals, ERROR_RETURN_NULL("Failed to reallocate operand stack"));
+        parser->valStack = newVals;
+        parser->stack_size = new_size;
+        DEBUG_PARSE("Parser stacks resized to %zu\n", new_size);
     }
-    
+
+    uint32_t ops = 0, vals = 0;
+    bool expect_operand = true;
+    Token* tok;
+
+    while ((tok = consume(parser))) {
+        const OperatorInfo* info = &operatorTable[tok->type];
+
+        if (expect_operand) {
+            switch (tok->type) {
+                case TOK_VAR:
+                    if (peek(parser) && peek(parser)->type == TOK_LPAR) {
+                        consume(parser);
+                        push_op(parser, &ops, tok, ENTRY_CALL);
+                        continue;
+                    }
+                    // fall through
+                case TOK_NUM:
+                case TOK_CONST:
+                case TOK_HISTORY: {
+                    ASTNode* leaf = create_leaf_node(parser, tok);
+                    CHECK_NULL(leaf, goto fail);
+                    push_value(parser, &vals, leaf);
+                    expect_operand = false;
+                    continue;
+                }
+                case TOK_LPAR:
+                    push_op(parser, &ops, tok, ENTRY_GROUP);
+                    continue;
+                case TOK_LCOR:
+                    push_op(parser, &ops, tok, ENTRY_VECTOR);
+                    continue;
+                case TOK_RPAR:
+                case TOK_RCOR: {
+                    // f() is a call without arguments, [] and v[] are reported by close_group
+                    TokenType opener = tok->type == TOK_RPAR ? TOK_LPAR : TOK_LCOR;
+                    if (ops > 0 && entry_is_group(&parser->opStack[ops - 1]) &&
+                        parser->opStack[ops - 1].kind != ENTRY_GROUP &&
+                        parser->tokens->token_buff[parser->curr_tok - 2].type == opener) {
+                        if (!close_group(parser, &ops, &vals, tok->type, true)) goto fail;
+                        expect_operand = false;
+                        continue;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+
+            if (info->call) {
+                if (!expect(parser, TOK_LPAR)) {
+                    ERROR_PRINT("Expected '(' after %s\n", builtinTable[tok->id].name);
+                    goto fail;
+                }
+                consume(parser);
+                push_op(parser, &ops, tok, ENTRY_CALL);
+                continue;
+            }
+
+            if (info->prefix_precedence) {
+                push_op(parser, &ops, tok, ENTRY_PREFIX);
+                continue;
+            }
+
+            ERROR_PRINT("Unexpected token, expected an operand: %s [%s]\n",
+                       TokenNamesConsts[tok->type], token_adjust_lexeme(tok));
+            goto fail;
+        }
+
+        if (info->precedence) {
+            while (ops > 0) {
+                ParserEntry* top = &parser->opStack[ops - 1];
+                if (top->kind != ENTRY_BINARY && top->kind != ENTRY_PREFIX) break;
+                uint8_t top_prec = entry_precedence(top);
+                if (top_prec < info->precedence || (top_prec == info->precedence && info->right_assoc)) break;
+                if (!reduce(parser, &ops, &vals)) goto fail;
+            }
+            push_op(parser, &ops, tok, ENTRY_BINARY);
+            expect_operand = true;
+            continue;
+        }
+
+        switch (tok->type) {
+            case TOK_RPAR:
+            case TOK_RCOR:
+                if (!close_group(parser, &ops, &vals, tok->type, false)) goto fail;
+                continue;
+            case TOK_LCOR:
+                // v[i]: the index applies to the operand just completed
+                push_op(parser, &ops, tok, ENTRY_INDEX);
+                expect_operand = true;
+                continue;
+            case TOK_COMM: {
+                while (ops > 0 && !entry_is_group(&parser->opStack[ops - 1])) {
+                    if (!reduce(parser, &ops, &vals)) goto fail;
+                }
+                if (ops == 0 || (parser->opStack[ops - 1].kind != ENTRY_CALL &&
+                                 parser->opStack[ops - 1].kind != ENTRY_VECTOR)) {
+                    ERROR_PRINT("Unexpected ',' outside of a function call or vector\n");
+                    goto fail;
+                }
+                parser->opStack[ops - 1].argc++;
+                expect_operand = true;
+                continue;
+            }
+            default:
+                ERROR_PRINT("Unexpected token, expected an operator: %s [%s]\n",
+                           TokenNamesConsts[tok->type], token_adjust_lexeme(tok));
+                goto fail;
+        }
+    }
+
+    if (expect_operand) {
+        ERROR_PRINT("Unexpected end of input\n");
+        goto fail;
+    }
+
+    while (ops > 0) {
+        if (!reduce(parser, &ops, &vals)) goto fail;
+    }
+
+    if (vals != 1) {
+        ERROR_PRINT("Malformed expression (%u operands left)\n", vals);
+        goto fail;
+    }
+
+    ASTNode* ans = parser->valStack[0];
+    if (!resolve_parameters(parser, ans)) goto fail;
+
+    DEBUG_PARSE("Parsing completed - Tokens consumed: %u/%u, Nodes created: %u\n",
+               parser->curr_tok, parser->tokens->count, parser->curr_node);
+    DEBUG_PARSE("Root node: %s [%s]\n",
+               TokenNamesConsts[ans->token->type],
+               token_adjust_lexeme(ans->token));
     DEBUG_FUNCTION_EXIT();
     return ans;
+
+fail:
+    ERROR_PRINT("Failed to parse statement\n");
+    DEBUG_FUNCTION_EXIT();
+    return NULL;
 }
 
-static mpfr_t* evaluate_node(Parser* p, ASTNode* node) {
-    DEBUG_EVAL("Entering evaluate_node(): %s [%s]\n",
-              TokenNamesConsts[node->token->type],
-              token_adjust_lexeme(node->token));
-    
-    if (p->mpfrBuffer->count >= p->mpfrBuffer->size) {
-        size_t new_size = p->mpfrBuffer->size * 2;
-        mpfr_t* new_buff = realloc(p->mpfrBuffer->buffer, new_size * sizeof(mpfr_t));
-        CHECK_NULL(new_buff, ERROR_RETURN_NULL("Failed to reallocate MPFR buffer"));
-        
-        // Initialize new MPFR variables
-        for (uint16_t i = p->mpfrBuffer->size; i < new_size; i++) {
-            mpfr_init2(new_buff[i], PRECISION_ROUNDING_BITS);
-        }
-        
-        p->mpfrBuffer->buffer = new_buff;
-        p->mpfrBuffer->size = new_size;
-        DEBUG_EVAL("MPFR buffer resized to %zu\n", new_size);
-    }
-    
-    mpfr_t* result = &p->mpfrBuffer->buffer[p->mpfrBuffer->count++];
-    mpfr_set_d(*result, 0, MPFR_RNDN);
+// ##############################
+// #####      COMPILER      #####
+// ##############################
+
+static inline bool is_add_sub(const ASTNode* node) {
+    return node->token->type == TOK_ADD || node->token->type == TOK_SUB;
+}
 
+// Weight of a subtree from its children's: what the node itself costs, in
+// NODE_WEIGHT_MUL units, plus theirs. Nodes that write the symbol table or
+// touch vectors get 0 and so does everything above them.
+static uint32_t node_weight(const ASTNode* node) {
+    uint64_t total;
+    uint32_t calls = 0;
     switch (node->token->type) {
-        case TOK_NUM: {
-            int status = mpfr_set_str(*result, token_adjust_lexeme(node->token), 10, MPFR_RNDN);
-            CHECK_CONDITION(status == 0, {
-                ERROR_PRINT("Failed to convert number: %s\n", token_adjust_lexeme(node->token));
-                mpfr_set_nan(*result);
-            }, "MPFR set_str failed");
+        case TOK_ASSING:
+        case TOK_DEFINE:
+        case TOK_VECTOR:
+        case TOK_INDEX:
+            return 0;
+        case TOK_FUNC:
+            if (builtinTable[node->token->id].kind == BUILTIN_ARRAY) return 0;
+            total = 16 * NODE_WEIGHT_MUL;
             break;
-        }
-        case TOK_VAR: {
-            mpfr_t* var_value = symbol_table_get(p->symTable,
-                token_adjust_lexeme(node->token), node->token->len);
-            if (var_value) {
-                mpfr_set(*result, *var_value, MPFR_RNDN);
-            } else {
-                ERROR_PRINT("Undefined variable: '%s'\n", token_adjust_lexeme(node->token));
-                mpfr_set_nan(*result);
-            }
+        case TOK_CALL:
+            total = 16 * NODE_WEIGHT_MUL;
+            calls = NODE_WEIGHT_CALLS;
             break;
-        }
-        case TOK_ADD: {
-            mpfr_t* left_val = evaluate_node(p, node->left);
-            mpfr_t* right_val = evaluate_node(p, node->right);
-            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
-            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
-            mpfr_add(*result, *left_val, *right_val, MPFR_RNDN);
+        case TOK_POWER:
+            total = 16 * NODE_WEIGHT_MUL;
             break;
-        }
-        case TOK_SUB: {
-            mpfr_t* left_val = evaluate_node(p, node->left);
-            mpfr_t* right_val = evaluate_node(p, node->right);
-            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
-            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
-            mpfr_sub(*result, *left_val, *right_val, MPFR_RNDN);
+        case TOK_POWI: {
+            // A squaring per bit of the exponent, plus a product per set bit
+            uint32_t n = (int32_t)node->aux < 0 ? -node->aux : node->aux;
+            total = NODE_WEIGHT_MUL;
+            while (n >>= 1) total += 2 * NODE_WEIGHT_MUL;
             break;
         }
-        case TOK_DIVIDE: {
-            mpfr_t* left_val = evaluate_node(p, node->left);
-            mpfr_t* right_val = evaluate_node(p, node->right);
-            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
-            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
-            
-            if (mpfr_zero_p(*right_val)) {
-                ERROR_PRINT("Division by zero\n");
-                mpfr_set_nan(*result);
-            } else {
-                mpfr_div(*result, *left_val, *right_val, MPFR_RNDN);
-            }
+        case TOK_MULT:
+        case TOK_FMA:
+        case TOK_FMS:
+            total = NODE_WEIGHT_MUL;
             break;
-        }
-        case TOK_MODULE: {
-            mpfr_t* left_val = evaluate_node(p, node->left);
-            mpfr_t* right_val = evaluate_node(p, node->right);
-            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
-            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
-            
-            if (mpfr_zero_p(*right_val)) {
-                ERROR_PRINT("Modulo by zero\n");
-                mpfr_set_nan(*result);
-            } else {
-                mpfr_modf(*result, *left_val, *right_val, MPFR_RNDN);
-            }
+        case TOK_DIVIDE:
+        case TOK_MODULE:
+            total = 2 * NODE_WEIGHT_MUL;
             break;
-        }
-        case TOK_MULT: {
-            mpfr_t* left_val = evaluate_node(p, node->left);
-            mpfr_t* right_val = evaluate_node(p, node->right);
-            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
-            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
-            mpfr_mul(*result, *left_val, *right_val, MPFR_RNDN);
+        default:
+            total = 1; // leaves, additions, negation
             break;
+    }
+
+    // Arguments hang from 'left' through 'next'
+    for (const ASTNode* child = node->left; child; child = child->next) {
+        if (!child->weight) return 0;
+        total += child->weight & NODE_WEIGHT_MASK;
+        calls |= child->weight & NODE_WEIGHT_CALLS;
+    }
+    if (node->right) {
+        if (!node->right->weight) return 0;
+        total += node->right->weight & NODE_WEIGHT_MASK;
+        calls |= node->right->weight & NODE_WEIGHT_CALLS;
+    }
+    return (total < NODE_WEIGHT_MASK ? (uint32_t)total : NODE_WEIGHT_MASK) | calls;
+}
+
+static ASTNode* balance_product(ASTNode** factors, uint32_t count, ASTNode** links, uint32_t* used) {
+    if (count == 1) return factors[0];
+    ASTNode* node = links[(*used)++];
+    uint32_t half = count / 2;
+    node->left = balance_product(factors, half, links, used);
+    node->right = balance_product(factors + half, count - half, links, used);
+    node->aux = 1;
+    node->weight = node_weight(node);
+    return node;
+}
+
+// Regroups left-deep '*' chains of three or more factors into balanced trees,
+// so the longest dependency is log2(n) products instead of n - 1. Factors keep
+// their order and the root of the chain stays the same node; only the
+// grouping, hence the rounding, changes. Explicit a*(b*c) groups are kept.
+static void reassociate_products(Expr* expr) {
+    ASTNode** factors = NULL;
+    uint32_t capacity = 0, chains = 0;
+
+    for (uint32_t i = expr->node_count; i-- > 0;) {
+        ASTNode* node = &expr->nodes[i];
+        if (node->token->type != TOK_MULT || node->aux) continue;
+
+        uint32_t count = 2;
+        ASTNode* link = node->left;
+        for (; link->token->type == TOK_MULT && !link->aux; link = link->left) count++;
+        if (count < 3) continue;
+
+        if (2 * count > capacity) {
+            ASTNode** grown = realloc(factors, 2 * count * sizeof(ASTNode*));
+            CHECK_NULL(grown, { ERROR_PRINT("Failed to reassociate products\n"); break; });
+            factors = grown;
+            capacity = 2 * count;
         }
-        case TOK_POWER: {
-            mpfr_t* left_val = evaluate_node(p, node->left);
-            mpfr_t* right_val = evaluate_node(p, node->right);
-            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
-            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
-            mpfr_pow(*result, *left_val, *right_val, MPFR_RNDN);
-            break;
+
+        // factors[0..count) in source order, links[0] is the chain root
+        ASTNode** links = factors + count;
+        uint32_t k = count, used = 0;
+        for (link = node; k > 1; link = link->left) {
+            factors[--k] = link->right;
+            links[count - 1 - k] = link;
         }
-        case TOK_SQUARE: {
-            mpfr_t* arg = evaluate_node(p, node->left);
-            CHECK_NULL(arg, ERROR_RETURN_NULL("Square root argument evaluation failed"));
-            
-            if (mpfr_cmp_d(*arg, 0) < 0) {
-                ERROR_PRINT("Square root of negative number\n");
-                mpfr_set_nan(*result);
-            } else {
-                mpfr_sqrt(*result, *arg, MPFR_RNDN);
+        factors[0] = link;
+
+        balance_product(factors, count, links, &used);
+        node->aux = 2;
+        chains++;
+    }
+
+    free(factors);
+    DEBUG_PARSE("Reassociated %u product chain(s)\n", chains);
+}
+
+// Retags nodes so the evaluator rounds once where it used to round per operator:
+//  - a +/- chain of three or more terms becomes TOK_SUM at its root, summed by
+//    mpfr_sum; the chain keeps its links, marked with aux = 1
+//  - a*b + c, c + a*b become TOK_FMA, a*b - c and c - a*b TOK_FMS
+// Sum terms may be evaluated in any order, so chains with an assignment are left alone.
+// Parents are created after their children: walking forwards sees every child
+// first, walking backwards meets a chain at its root.
+static void fuse_nodes(Expr* expr) {
+    uint32_t sums = 0, fmas = 0;
+
+    // Whether each subtree assigns, in one pass
+    bool* assigns = malloc(expr->node_count * sizeof(bool));
+    CHECK_NULL(assigns, { ERROR_PRINT("Failed to fuse nodes\n"); return; });
+    for (uint32_t i = 0; i < expr->node_count; i++) {
+        const ASTNode* node = &expr->nodes[i];
+        bool assign = node->token->type == TOK_ASSING || node->token->type == TOK_DEFINE;
+        for (const ASTNode* child = node->left; child && !assign; child = child->next) {
+            assign = assigns[child - expr->nodes];
+        }
+        assigns[i] = assign || (node->right && assigns[node->right - expr->nodes]);
+    }
+
+    for (uint32_t i = expr->node_count; i-- > 0;) {
+        ASTNode* node = &expr->nodes[i];
+        if (!is_add_sub(node) || node->aux) continue;
+
+        // The links are +/-, only the terms can assign
+        uint32_t terms = 2;
+        ASTNode* link = node->left;
+        if (!assigns[i]) {
+            for (; is_add_sub(link) && !link->aux; link = link->left) terms++;
+        }
+
+        if (terms >= 3) {
+            for (link = node->left; is_add_sub(link) && !link->aux; link = link->left) link->aux = 1;
+            node->aux = node->token->type;
+            node->token->type = TOK_SUM;
+            sums++;
+        } else if (node->left->token->type == TOK_MULT || node->right->token->type == TOK_MULT) {
+            node->token->type = node->token->type == TOK_ADD ? TOK_FMA : TOK_FMS;
+            fmas++;
+        }
+    }
+    free(assigns);
+
+    DEBUG_PARSE("Fused %u sum(s), %u multiply-add(s)\n", sums, fmas);
+}
+
+// x^n with an integer literal n (up to 9 digits) becomes TOK_POWI, n in aux:
+// the exponent is never evaluated and mpfr_pow_si squares its way up instead
+// of going through exp and log. Other integer exponents are caught at run time.
+static void specialize_powers(Expr* expr) {
+    uint32_t powers = 0;
+
+    for (uint32_t i = 0; i < expr->node_count; i++) {
+        ASTNode* node = &expr->nodes[i];
+        if (node->token->type != TOK_POWER || node->right->token->type != TOK_NUM) continue;
+
+        const Token* exponent = node->right->token;
+        if (exponent->len > 9) continue;
+        int32_t n = 0;
+        uint8_t k = 0;
+        for (; k < exponent->len && isdigit((unsigned char)exponent->lexeme[k]); k++) {
+            n = n * 10 + (exponent->lexeme[k] - '0');
+        }
+        if (k < exponent->len) continue;
+
+        node->token->type = TOK_POWI;
+        node->aux = (uint32_t)(exponent->negative ? -n : n);
+        node->weight = node_weight(node);
+        powers++;
+    }
+
+    DEBUG_PARSE("Specialized %u integer power(s)\n", powers);
+}
+
+// The children the evaluator reaches through evaluate_node() or evaluate_value(),
+// in evaluation order: the terms of a sum but not its links, the factors under
+// a multiply-add, the target and the indices of M[i][j].
+static uint32_t evaluated_children(ASTNode* node, ASTNode** children) {
+    uint32_t count = 0;
+    switch (node->token->type) {
+        case TOK_SUM: {
+            ASTNode* link = node;
+            for (; is_add_sub(link) || link == node; link = link->left) children[count++] = link->right;
+            children[count++] = link;
+            return count;
+        }
+        case TOK_FMA:
+        case TOK_FMS: {
+            bool product_left = node->left->token->type == TOK_MULT;
+            ASTNode* product = product_left ? node->left : node->right;
+            if (!product_left) children[count++] = node->left;
+            children[count++] = product->left;
+            children[count++] = product->right;
+            if (product_left) children[count++] = node->right;
+            return count;
+        }
+        case TOK_ASSING:
+            children[count++] = node->right;
+            return count;
+        case TOK_DEFINE:
+            return 0;
+        case TOK_INDEX:
+            if (node->left->token->type == TOK_INDEX) {
+                children[count++] = node->left->left;
+                children[count++] = node->left->right;
+                children[count++] = node->right;
+                return count;
+            }
+            break;
+        default:
+            break;
+    }
+    for (ASTNode* child = node->left; child; child = child->next) children[count++] = child;
+    if (node->right) children[count++] = node->right;
+    return count;
+}
+
+// Cuts the evaluation of the line, or of the body it defines, every
+// EVAL_CUT_LEVELS levels. Nodes are visited from an
+// explicit stack, regrouped products no longer come after their factors. The
+// links of a regrouped product are folded without being evaluated on their own
+// and cannot be cut. Cut nodes run before the rest, so a line that assigns
+// below its head keeps its order and is never cut.
+static void measure_levels(Expr* expr) {
+    ASTNode* root = expr->head->token->type == TOK_DEFINE ? expr->head->right : expr->head;
+    expr->cut_count = 0;
+    expr->calls = expr->writes = false;
+
+    // order: every node before its children, stack and children: scratch
+    uint32_t n = expr->node_count;
+    ASTNode** order = malloc(3 * n * sizeof(ASTNode*) + n * sizeof(uint32_t));
+    CHECK_NULL(order, { ERROR_PRINT("Failed to measure expression depth\n"); return; });
+    ASTNode** stack = order + n;
+    ASTNode** children = stack + n;
+    uint32_t* depth = (uint32_t*)(children + n); // levels down to the next cut
+
+    uint32_t count = 0, top = 0;
+    bool writes_below = false;
+    stack[top++] = root;
+    while (top) {
+        ASTNode* node = stack[--top];
+        order[count++] = node;
+        TokenType type = node->token->type;
+        expr->calls |= type == TOK_CALL;
+        if (type == TOK_ASSING || type == TOK_DEFINE) {
+            expr->writes = true;
+            writes_below |= node != root;
+        }
+        uint32_t k = evaluated_children(node, children);
+        while (k) stack[top++] = children[--k];
+    }
+
+    while (count--) {
+        ASTNode* node = order[count];
+        uint32_t i = node - expr->nodes;
+        uint32_t k = evaluated_children(node, children);
+        depth[i] = 1;
+        while (k--) {
+            uint32_t child = children[k] - expr->nodes;
+            if (depth[child] + 1 > depth[i]) depth[i] = depth[child] + 1;
+        }
+
+        bool link = node->token->type == TOK_MULT && node->aux == 1;
+        if (depth[i] >= EVAL_CUT_LEVELS && node != root && !link && !writes_below) {
+            node->cut = ++expr->cut_count;
+            depth[i] = 1;
+        }
+    }
+
+    DEBUG_PARSE("%u cut(s)\n", expr->cut_count);
+    free(order);
+}
+
+// Copies the tokens and nodes of the last parse() into one allocation owned by
+// the returned Expr. Lexemes pointing into 'text' are rebased onto the copy.
+Expr* parser_compile(Parser* parser, const char* text, ASTNode* head) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(parser, ERROR_RETURN_NULL("Parser is NULL"));
+    CHECK_NULL(text, ERROR_RETURN_NULL("Source text is NULL"));
+    CHECK_NULL(head, ERROR_RETURN_NULL("AST head is NULL"));
+
+    size_t len = strlen(text);
+    uint32_t token_count = parser->tokens->count;
+    uint32_t node_count = parser->curr_node;
+    size_t bytes = sizeof(Expr) + node_count * sizeof(ASTNode) +
+                   token_count * sizeof(Token) + len + 1;
+
+    Expr* expr = malloc(bytes);
+    CHECK_NULL(expr, ERROR_RETURN_NULL("Failed to allocate compiled expression (%zu bytes)", bytes));
+
+    expr->nodes = (ASTNode*)(expr + 1);
+    expr->tokens = (Token*)(expr->nodes + node_count);
+    expr->text = (char*)(expr->tokens + token_count);
+    expr->bytes = bytes;
+    expr->token_count = token_count;
+    expr->node_count = node_count;
+    expr->refs = 1;
+    expr->len = len;
+    memcpy(expr->text, text, len + 1);
+
+    const Token* src_tokens = parser->tokens->token_buff;
+    for (uint32_t i = 0; i < token_count; i++) {
+        expr->tokens[i] = src_tokens[i];
+        const char* lexeme = src_tokens[i].lexeme;
+        if (lexeme >= text && lexeme <= text + len) {
+            expr->tokens[i].lexeme = expr->text + (lexeme - text);
+        }
+    }
+
+    const ASTNode* src_nodes = parser->nodesBuffer;
+    for (uint32_t i = 0; i < node_count; i++) {
+        ASTNode* node = &expr->nodes[i];
+        node->token = expr->tokens + (src_nodes[i].token - src_tokens);
+        node->left = src_nodes[i].left ? expr->nodes + (src_nodes[i].left - src_nodes) : NULL;
+        node->right = src_nodes[i].right ? expr->nodes + (src_nodes[i].right - src_nodes) : NULL;
+        node->next = src_nodes[i].next ? expr->nodes + (src_nodes[i].next - src_nodes) : NULL;
+        node->aux = src_nodes[i].aux;
+        node->weight = node_weight(node); // children come first in the buffer
+        node->cut = 0;
+    }
+    expr->head = expr->nodes + (head - src_nodes);
+
+    // Fusing comes before regrouping, which breaks the children-first order
+    specialize_powers(expr);
+    fuse_nodes(expr);
+    if (parser->reassociate) reassociate_products(expr);
+    measure_levels(expr);
+
+    // Lines without vector syntax take the scalar evaluator
+    expr->arrays = false;
+    for (uint32_t i = 0; i < node_count && !expr->arrays; i++) {
+        expr->arrays = expr->nodes[i].token->type == TOK_VECTOR;
+    }
+
+    DEBUG_PARSE("Compiled '%s': %u tokens, %u nodes, %zu bytes\n",
+               expr->text, token_count, node_count, bytes);
+    DEBUG_FUNCTION_EXIT();
+    return expr;
+}
+
+void expr_release(Expr* expr) {
+    if (expr && --expr->refs == 0) free(expr);
+}
+
+// ##############################
+// #####     EVALUATOR      #####
+// ##############################
+
+static inline size_t mpfr_buffer_stride(mpfr_prec_t precision) {
+    return sizeof(mpfr_t) + mpfr_custom_get_size(precision);
+}
+
+static uint8_t* mpfr_buffer_chunk(MpfrBuffer* buff) {
+    uint8_t* chunk = malloc(MPRF_BUFFER_SIZE * buff->stride);
+    CHECK_NULL(chunk, ERROR_RETURN_NULL("Failed to allocate MPFR chunk"));
+
+    // Initialize new MPFR variables, the limbs follow each one
+    for (uint32_t i = 0; i < MPRF_BUFFER_SIZE; i++) {
+        mpfr_ptr slot = (mpfr_ptr)(chunk + i * buff->stride);
+        mpfr_custom_init_set(slot, MPFR_NAN_KIND, 0, buff->precision, slot + 1);
+    }
+    return chunk;
+}
+
+static inline mpfr_t* mpfr_buffer_next(MpfrBuffer* buff) {
+    if (buff->count >= buff->size) {
+        uint8_t** new_chunks = realloc(buff->chunks, (buff->chunk_count + 1) * sizeof(uint8_t*));
+        CHECK_NULL(new_chunks, ERROR_RETURN_NULL("Failed to reallocate MPFR chunk list"));
+        buff->chunks = new_chunks;
+
+        uint8_t* chunk = mpfr_buffer_chunk(buff);
+        CHECK_NULL(chunk, return NULL);
+
+        buff->chunks[buff->chunk_count++] = chunk;
+        buff->size += MPRF_BUFFER_SIZE;
+        DEBUG_EVAL("MPFR buffer grown to %u\n", buff->size);
+    }
+
+    uint32_t i = buff->count++;
+    return (mpfr_t*)(buff->chunks[i / MPRF_BUFFER_SIZE] + (i % MPRF_BUFFER_SIZE) * buff->stride);
+}
+
+static MpfrBuffer* mpfr_buffer_create(mpfr_prec_t precision) {
+    MpfrBuffer* buff = calloc(1, sizeof(MpfrBuffer));
+    CHECK_NULL(buff, ERROR_RETURN_NULL("Failed to allocate MPFR buffer"));
+    buff->precision = precision;
+    buff->stride = mpfr_buffer_stride(precision);
+
+    // Allocate the first chunk up front
+    CHECK_NULL(mpfr_buffer_next(buff), {
+        free(buff->chunks);
+        free(buff);
+        ERROR_RETURN_NULL("Failed to allocate MPFR variables");
+    });
+    buff->count = 0;
+    return buff;
+}
+
+static void mpfr_buffer_destroy(MpfrBuffer* buff) {
+    if (!buff) return;
+    // Custom values, nothing to clear
+    for (uint32_t c = 0; c < buff->chunk_count; c++) free(buff->chunks[c]);
+    free(buff->chunks);
+    free(buff);
+}
+
+// Slots are rebuilt at the new stride, so only between evaluations
+static void mpfr_buffer_set_precision(MpfrBuffer* buff, mpfr_prec_t precision) {
+    buff->precision = precision;
+    buff->stride = mpfr_buffer_stride(precision);
+    for (uint32_t c = 0; c < buff->chunk_count; c++) {
+        free(buff->chunks[c]);
+        buff->chunks[c] = mpfr_buffer_chunk(buff);
+        if (!buff->chunks[c]) {
+            // Drop the rest, mpfr_buffer_next() grows back on demand
+            for (uint32_t k = c + 1; k < buff->chunk_count; k++) free(buff->chunks[k]);
+            buff->chunk_count = c;
+            buff->size = c * MPRF_BUFFER_SIZE;
+            break;
+        }
+    }
+}
+
+static bool frame_reserve(Parser* p, uint32_t count) {
+    if (p->frame_top + count <= p->frame_size) return true;
+    uint32_t new_size = (p->frame_top + count) * 2;
+    mpfr_t** new_frame = realloc(p->frame, new_size * sizeof(mpfr_t*));
+    CHECK_NULL(new_frame, ERROR_RETURN(false, "Failed to grow call frames"));
+    p->frame = new_frame;
+    p->frame_size = new_size;
+    return true;
+}
+
+// Result of a node that may be a vector, exactly one member is set. The
+// vector reference belongs to the caller.
+typedef struct Value{
+    mpfr_t* num;
+    Array* array;
+} Value;
+
+static inline mpfr_t* evaluate_node(Parser* p, ASTNode* node);
+static mpfr_t* evaluate_node_op(Parser* p, ASTNode* node);
+static inline bool evaluate_value(Parser* p, ASTNode* node, Value* out);
+static bool evaluate_value_op(Parser* p, ASTNode* node, Value* out);
+
+// Lowest frame address the calling thread evaluates at. Its bounds are looked
+// up once per thread, a thread without them is not checked.
+static uintptr_t stack_floor() {
+    static _Thread_local uintptr_t floor;
+    static _Thread_local bool known;
+    if (!known) {
+        known = true;
+        pthread_attr_t attr;
+        void* addr;
+        size_t size;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) return 0;
+        if (pthread_attr_getstack(&attr, &addr, &size) == 0) floor = (uintptr_t)addr + EVAL_STACK_RESERVE;
+        pthread_attr_destroy(&attr);
+    }
+    return floor;
+}
+
+static inline bool stack_exhausted(const Parser* p, const void* frame) {
+    return (uintptr_t)frame < p->stack_floor;
+}
+
+// Evaluating the cut nodes first reorders the evaluation, not done while a
+// function that assigns could be called.
+static inline bool expr_uses_cuts(const Parser* p, const Expr* expr) {
+    return expr->cut_count && !(expr->calls && p->funcTable->writer_count);
+}
+
+// Starts the line or body of 'expr': its cut nodes get slots above the
+// caller's and are evaluated, in node order so the deeper ones come first.
+// Without cuts the slots stay empty and the nodes are evaluated in place.
+// The caller restores cut_base and cut_top with end_cuts() once it is done.
+static bool begin_cuts(Parser* p, const Expr* expr, bool values) {
+    p->cut_base = p->cut_top;
+    if (!expr->cut_count) return true;
+    if (p->cut_top + expr->cut_count > p->cut_size) {
+        uint32_t new_size = (p->cut_top + expr->cut_count) * 2;
+        Value* new_cuts = realloc(p->cuts, new_size * sizeof(Value));
+        CHECK_NULL(new_cuts, ERROR_RETURN(false, "Failed to grow cut values"));
+        p->cuts = new_cuts;
+        p->cut_size = new_size;
+    }
+    memset(p->cuts + p->cut_top, 0, expr->cut_count * sizeof(Value));
+    p->cut_top += expr->cut_count;
+    if (!expr_uses_cuts(p, expr)) return true;
+
+    for (uint32_t i = 0, done = 0; done < expr->cut_count; i++) {
+        ASTNode* node = &expr->nodes[i];
+        if (!node->cut) continue;
+        Value value = { NULL, NULL };
+        bool ok = values ? evaluate_value(p, node, &value) : (value.num = evaluate_node(p, node)) != NULL;
+        if (!ok) return false;
+        p->cuts[p->cut_base + node->cut - 1] = value; // nested calls may have moved the slots
+        done++;
+    }
+    return true;
+}
+
+static void end_cuts(Parser* p, uint32_t base, uint32_t top) {
+    for (uint32_t i = p->cut_base; i < p->cut_top; i++) array_release(p->cuts[i].array);
+    p->cut_base = base;
+    p->cut_top = top;
+}
+
+// With -limit, before a built-in or a power: false (the limit is tripped) when
+// the estimated result or running time of the call is already past a limit
+static inline bool admit_builtin(Parser* p, uint16_t id, mpfr_t* const* args) {
+    if (!p->limits->active) return true;
+    BuiltinEstimate estimate = builtin_estimate(id, args, p->precision);
+    return limits_admit(p->limits, estimate.exponent, estimate.ns);
+}
+
+static inline bool admit_power(Parser* p, mpfr_srcptr x, mpfr_srcptr y) {
+    if (!p->limits->active) return true;
+    BuiltinEstimate estimate = builtin_power_estimate(x, y, p->precision);
+    return limits_admit(p->limits, estimate.exponent, estimate.ns);
+}
+
+static void scalar_binary(TokenType op, mpfr_t rop, mpfr_t left, mpfr_t right) {
+    switch (op) {
+        case TOK_ADD:   mpfr_add(rop, left, right, MPFR_RNDN); break;
+        case TOK_SUB:   mpfr_sub(rop, left, right, MPFR_RNDN); break;
+        case TOK_MULT:  mpfr_mul(rop, left, right, MPFR_RNDN); break;
+        case TOK_POWER: builtin_power(rop, left, right); break;
+        case TOK_DIVIDE:
+            if (mpfr_zero_p(right)) {
+                ERROR_PRINT("Division by zero\n");
+                mpfr_set_nan(rop);
+            } else {
+                mpfr_div(rop, left, right, MPFR_RNDN);
+            }
+            break;
+        case TOK_MODULE:
+            if (mpfr_zero_p(right)) {
+                ERROR_PRINT("Modulo by zero\n");
+                mpfr_set_nan(rop);
+            } else {
+                mpfr_fmod(rop, left, right, MPFR_RNDN);
+            }
+            break;
+        default:
+            mpfr_set_nan(rop);
+            break;
+    }
+}
+
+static bool push_term(Parser* p, mpfr_ptr term) {
+    if (p->terms_top >= p->terms_size) {
+        uint32_t new_size = p->terms_size ? p->terms_size * 2 : 64;
+        mpfr_ptr* new_terms = realloc(p->terms, new_size * sizeof(mpfr_ptr));
+        CHECK_NULL(new_terms, ERROR_RETURN(false, "Failed to grow sum terms"));
+        p->terms = new_terms;
+        p->terms_size = new_size;
+    }
+    p->terms[p->terms_top++] = term;
+    return true;
+}
+
+// Nodes whose value may be storage they do not own (a variable, an argument,
+// what a call or an assignment returns), it is only read.
+static inline bool node_borrows(const ASTNode* node) {
+    TokenType type = node->token->type;
+    return type == TOK_VAR || type == TOK_PARAM || type == TOK_CALL || type == TOK_ASSING ||
+           type == TOK_HISTORY;
+}
+
+// Rounds the terms pushed since 'base' once and pops them.
+static void sum_terms(Parser* p, mpfr_t rop, uint32_t base) {
+    mpfr_sum(rop, p->terms + base, p->terms_top - base, MPFR_RNDN);
+    p->terms_top = base;
+}
+
+// A subtree handed to another worker. The forker owns 'result' and the
+// arguments, both stay untouched until the task is synced. The argument list
+// is copied since the forker's frame array may move meanwhile.
+typedef struct EvalTask{
+    Task task;
+    ASTNode* node;
+    mpfr_t* result;
+    mpfr_t* frame[EVAL_TASK_FRAME]; // arguments of the forker's innermost call
+    uint32_t frame_count;
+    uint32_t call_depth;
+    bool borrow;
+    bool ok;
+} EvalTask;
+
+static void run_eval_task(Task* task, void* context) {
+    EvalTask* t = (EvalTask*)task;
+    Parser* p = context;
+
+    // Runs on top of whatever this worker is in the middle of
+    uint32_t mark = p->mpfrBuffer->count;
+    uint32_t saved_base = p->frame_base, saved_top = p->frame_top, saved_depth = p->call_depth;
+    uint32_t saved_cut_base = p->cut_base;
+    bool saved_borrow = p->borrow;
+    t->ok = false;
+    p->stack_floor = stack_floor();
+    if (frame_reserve(p, t->frame_count)) {
+        if (t->frame_count) memcpy(p->frame + p->frame_top, t->frame, t->frame_count * sizeof(mpfr_t*));
+        p->frame_base = p->frame_top;
+        p->frame_top += t->frame_count;
+        p->call_depth = t->call_depth;
+        p->cut_base = p->cut_top; // nothing forked was cut
+        p->borrow = t->borrow;
+
+        mpfr_t* value = evaluate_node(p, t->node);
+        if (value) mpfr_set(*t->result, *value, MPFR_RNDN);
+        t->ok = value != NULL;
+    }
+    p->frame_base = saved_base;
+    p->frame_top = saved_top;
+    p->call_depth = saved_depth;
+    p->cut_base = saved_cut_base;
+    p->borrow = saved_borrow;
+    p->mpfrBuffer->count = mark;
+}
+
+static inline bool worth_forking(const Parser* p, const ASTNode* node) {
+    uint32_t weight = node->weight & NODE_WEIGHT_MASK;
+    if (!p->pool || weight < p->fork_weight) return false;
+    // Cut values are in the forker's slots
+    if (p->cut_top != p->cut_base) return false;
+    // Any user function could be the one a call reaches
+    return !(node->weight & NODE_WEIGHT_CALLS) || !p->funcTable->impure_count;
+}
+
+// Queues 'node' for another worker, false when it has to run inline.
+static bool fork_node(Parser* p, ASTNode* node, EvalTask* t) {
+    t->frame_count = p->frame_top - p->frame_base;
+    if (t->frame_count > EVAL_TASK_FRAME) return false;
+    if (t->frame_count) memcpy(t->frame, p->frame + p->frame_base, t->frame_count * sizeof(mpfr_t*));
+    t->task.run = run_eval_task;
+    t->node = node;
+    t->result = mpfr_buffer_next(p->mpfrBuffer);
+    t->call_depth = p->call_depth;
+    t->borrow = p->borrow;
+    t->ok = false;
+    return t->result && task_pool_push(p->pool, p->worker, &t->task);
+}
+
+static mpfr_t* join_node(Parser* p, EvalTask* t) {
+    task_pool_sync(p->pool, p->worker, &t->task);
+    return t->ok ? t->result : NULL;
+}
+
+// Runs 'b' on another worker while this one does 'a', false when they are too
+// light or it cannot be queued. The task lives on the heap and this function
+// is never inlined, so the recursion through evaluate_node_op() carries no fork
+// state; both operands are worth far more than the allocation.
+static __attribute__((noinline)) bool evaluate_forked(Parser* p, ASTNode* a, ASTNode* b, mpfr_t** va, mpfr_t** vb) {
+    if (!p->pool || !worth_forking(p, a) || !worth_forking(p, b)) return false;
+    EvalTask* t = malloc(sizeof(EvalTask));
+    if (!t || !fork_node(p, b, t)) {
+        free(t);
+        return false;
+    }
+    *va = evaluate_node(p, a);
+    *vb = join_node(p, t);
+    free(t);
+    return true;
+}
+
+// Evaluates both operands, in parallel when both are heavy enough. Either
+// result may be NULL on failure. A macro so the serial path recurses straight
+// from evaluate_node.
+#define EVALUATE_OPERANDS(p, a, b, va, vb) do { \
+    if (!evaluate_forked(p, a, b, &(va), &(vb))) { \
+        (va) = evaluate_node(p, a); \
+        (vb) = evaluate_node(p, b); \
+    } \
+} while (0)
+
+// TOK_SUM: walks the chain from the last term, heavy terms go to other
+// workers. Subtracted terms are negated in place once they are known. Out of
+// line so its fork state stays off the frames of the recursion.
+static __attribute__((noinline)) bool evaluate_sum(Parser* p, ASTNode* node, mpfr_t rop) {
+    EvalTask* tasks = p->pool ? malloc(EVAL_SUM_TASKS * sizeof(EvalTask)) : NULL;
+    bool negate[EVAL_SUM_TASKS];
+    uint32_t forked = 0, base = p->terms_top;
+    bool ok = true;
+    TokenType op = (TokenType)node->aux;
+    ASTNode* link = node;
+    while (ok) {
+        ASTNode* term_node = link->right;
+        if (tasks && forked < EVAL_SUM_TASKS && worth_forking(p, term_node) &&
+            fork_node(p, term_node, &tasks[forked])) {
+            negate[forked] = op == TOK_SUB;
+            ok = push_term(p, *tasks[forked++].result);
+        } else {
+            mpfr_t* term = evaluate_node(p, term_node);
+            if (term && op == TOK_SUB && node_borrows(term_node)) {
+                mpfr_t* negated = mpfr_buffer_next(p->mpfrBuffer);
+                if (negated) mpfr_neg(*negated, *term, MPFR_RNDN);
+                term = negated;
+            } else if (term && op == TOK_SUB) {
+                mpfr_neg(*term, *term, MPFR_RNDN);
+            }
+            ok = term && push_term(p, *term);
+        }
+        link = link->left;
+        if (!is_add_sub(link)) break;
+        op = link->token->type;
+    }
+    if (ok) {
+        mpfr_t* first = evaluate_node(p, link);
+        ok = first && push_term(p, *first);
+    }
+    // Every forked task must be synced, even after a failure
+    while (forked--) {
+        mpfr_t* term = join_node(p, &tasks[forked]);
+        ok = ok && term;
+        if (term && negate[forked]) mpfr_neg(*term, *term, MPFR_RNDN);
+    }
+    free(tasks);
+    if (!ok) {
+        p->terms_top = base;
+        return false;
+    }
+    sum_terms(p, rop, base);
+    return true;
+}
+
+// Built-ins over vectors and matrices (sum, dot, len, det, transpose, solve),
+// every argument must be one.
+static bool evaluate_array_builtin(Parser* p, ASTNode* node, Value* out) {
+    const Builtin* builtin = &builtinTable[node->token->id];
+    Value args[BUILTIN_MAX_ARITY] = { { NULL, NULL } };
+    uint32_t argc = 0;
+    bool ok = true;
+
+    out->num = NULL;
+    out->array = NULL;
+    for (ASTNode* arg = node->left; arg && ok; arg = arg->next) {
+        ok = evaluate_value(p, arg, &args[argc]);
+        if (ok) argc++;
+        if (ok && !args[argc - 1].array) {
+            ERROR_PRINT("%s() expects vector or matrix arguments\n", builtin->name);
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        Array* a = args[0].array;
+        switch (builtin->fn.array) {
+            case ARRAY_BUILTIN_TRANSPOSE:
+                out->array = matrix_transpose(a, p->precision);
+                ok = out->array != NULL;
+                break;
+            case ARRAY_BUILTIN_SOLVE:
+                out->array = matrix_solve(a, args[1].array, p->precision);
+                ok = out->array != NULL;
+                break;
+            default:
+                out->num = mpfr_buffer_next(p->mpfrBuffer);
+                ok = out->num != NULL;
+                break;
+        }
+        if (ok && out->num) {
+            switch (builtin->fn.array) {
+                case ARRAY_BUILTIN_SUM: array_sum(a, *out->num); break;
+                case ARRAY_BUILTIN_DOT: ok = array_dot(a, args[1].array, *out->num); break;
+                case ARRAY_BUILTIN_LEN: mpfr_set_ui(*out->num, a->rows ? a->rows : a->len, MPFR_RNDN); break;
+                case ARRAY_BUILTIN_DET: ok = matrix_det(a, *out->num); break;
+                default: break;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < argc; i++) array_release(args[i].array);
+    return ok;
+}
+
+static bool evaluate_index(Parser* p, ASTNode* node, uint32_t bound, uint32_t* index) {
+    mpfr_t* value = evaluate_node(p, node);
+    if (!value) return false;
+    if (!mpfr_integer_p(*value) || mpfr_sgn(*value) < 0 || mpfr_cmp_ui(*value, bound) >= 0) {
+        ERROR_RETURN(false, "Index %g out of range [0, %u)\n", mpfr_get_d(*value, MPFR_RNDN), bound);
+    }
+    *index = mpfr_get_ui(*value, MPFR_RNDN);
+    return true;
+}
+
+// [[a, b], [c, d]] or [v, w]: 'first' is the already evaluated first row, every
+// row must be a vector of the same length.
+static bool evaluate_matrix(Parser* p, ASTNode* node, Array* first, Value* out) {
+    if (first->rows) {
+        array_release(first);
+        ERROR_RETURN(false, "Matrix rows must be vectors\n");
+    }
+
+    uint32_t cols = first->len;
+    Array* matrix = array_create_matrix(node->aux, cols, p->precision);
+    if (!matrix) {
+        array_release(first);
+        return false;
+    }
+    array_copy(matrix, 0, first, 0, cols);
+    array_release(first);
+
+    uint32_t r = 1;
+    for (ASTNode* row = node->left->next; row; row = row->next, r++) {
+        Value value;
+        if (!evaluate_value(p, row, &value)) {
+            array_release(matrix);
+            return false;
+        }
+        if (!value.array || value.array->rows || value.array->len != cols) {
+            ERROR_PRINT("Row %u of the matrix must be a vector of %u elements\n", r, cols);
+            array_release(value.array);
+            array_release(matrix);
+            return false;
+        }
+        array_copy(matrix, r * cols, value.array, 0, cols);
+        array_release(value.array);
+    }
+
+    out->array = matrix;
+    return true;
+}
+
+// With --trace every node is timed and the slow ones become events, nested
+// under their parents. Built-ins are named after the function. With -limit
+// every node first checks that the line may go on, after a limit is hit nodes
+// are NaN so the evaluation unwinds without more work or error reports.
+
+static inline mpfr_t* cancelled_node(Parser* p) {
+    mpfr_t* nan = mpfr_buffer_next(p->mpfrBuffer);
+    if (nan) mpfr_set_nan(*nan);
+    return nan;
+}
+
+static inline const char* trace_node_name(const ASTNode* node) {
+    if (node->token->type == TOK_FUNC) return builtinTable[node->token->id].name;
+    return TokenNamesConsts[node->token->type] + 4; // without TOK_
+}
+
+static inline void trace_node(Parser* p, const ASTNode* node, uint64_t start) {
+    uint64_t end = stats_now();
+    if (end - start >= TRACE_NODE_MIN_NS) {
+        trace_event(trace_node_name(node), "node", start, end, p->worker, "bits", p->precision);
+    }
+}
+
+// The checked paths are out of line: evaluate_node() and evaluate_value() add
+// no frame of their own to the recursion.
+static __attribute__((noinline)) mpfr_t* evaluate_node_checked(Parser* p, ASTNode* node) {
+    Limits* limits = p->limits;
+    if (limits->active && !limits_step(limits, &p->limit_steps)) return cancelled_node(p);
+    if (limits->exponent) mpfr_clear_overflow(); // see limits_check_value()
+    uint64_t start = p->trace ? stats_now() : 0;
+    mpfr_t* result = evaluate_node_op(p, node);
+    if (p->trace) trace_node(p, node, start);
+    if (result && limits->active && !limits_check_value(limits, *result)) return cancelled_node(p);
+    return result;
+}
+
+static __attribute__((noinline)) bool evaluate_value_checked(Parser* p, ASTNode* node, Value* out) {
+    Limits* limits = p->limits;
+    if (limits->active && !limits_step(limits, &p->limit_steps)) {
+        out->num = cancelled_node(p);
+        out->array = NULL;
+        return out->num != NULL;
+    }
+    if (limits->exponent) mpfr_clear_overflow();
+    uint64_t start = p->trace ? stats_now() : 0;
+    bool ok = evaluate_value_op(p, node, out);
+    if (p->trace) trace_node(p, node, start);
+    if (ok && out->num && limits->active && !limits_check_value(limits, *out->num)) {
+        out->num = cancelled_node(p);
+        return out->num != NULL;
+    }
+    return ok;
+}
+
+// A cut node reads the value it was evaluated to, the first time it is reached
+// is that evaluation. Each node is read once, a vector reference moves out.
+static __attribute__((noinline)) mpfr_t* evaluate_node_cut(Parser* p, ASTNode* node) {
+    Value* slot = &p->cuts[p->cut_base + node->cut - 1];
+    if (slot->array) {
+        array_release(slot->array);
+        slot->array = NULL;
+        ERROR_RETURN_NULL("Vector value where a scalar is expected\n");
+    }
+    if (slot->num) return slot->num;
+    return p->trace || p->limits->active ? evaluate_node_checked(p, node) : evaluate_node_op(p, node);
+}
+
+static __attribute__((noinline)) bool evaluate_value_cut(Parser* p, ASTNode* node, Value* out) {
+    Value* slot = &p->cuts[p->cut_base + node->cut - 1];
+    if (slot->num || slot->array) {
+        *out = *slot;
+        slot->array = NULL;
+        return true;
+    }
+    return p->trace || p->limits->active ? evaluate_value_checked(p, node, out) : evaluate_value_op(p, node, out);
+}
+
+static inline mpfr_t* evaluate_node(Parser* p, ASTNode* node) {
+    if (node->cut) return evaluate_node_cut(p, node);
+    if (!p->trace && !p->limits->active) return evaluate_node_op(p, node);
+    return evaluate_node_checked(p, node);
+}
+
+static inline bool evaluate_value(Parser* p, ASTNode* node, Value* out) {
+    if (node->cut) return evaluate_value_cut(p, node, out);
+    if (!p->trace && !p->limits->active) return evaluate_value_op(p, node, out);
+    return evaluate_value_checked(p, node, out);
+}
+
+static mpfr_t* evaluate_node_op(Parser* p, ASTNode* node) {
+    DEBUG_EVAL("Entering evaluate_node(): %s [%.*s]\n",
+              TokenNamesConsts[node->token->type],
+              (int)node->token->len, node->token->lexeme);
+    if (stack_exhausted(p, __builtin_frame_address(0))) {
+        ERROR_RETURN_NULL("Expression nested too deeply for the stack\n");
+    }
+    
+    // Every case writes the result or returns another value
+    mpfr_t* result = mpfr_buffer_next(p->mpfrBuffer);
+    CHECK_NULL(result, return NULL);
+    p->op_counts[node->token->type]++;
+
+    switch (node->token->type) {
+        case TOK_NUM: {
+            // The lexeme is not terminated, the number has to end where the token does
+            const Token* tok = node->token;
+            char* end;
+            mpfr_strtofr(*result, tok->lexeme, &end, 10, MPFR_RNDN);
+            CHECK_CONDITION(end == tok->lexeme + tok->len, {
+                ERROR_PRINT("Failed to convert number: %.*s\n", (int)tok->len, tok->lexeme);
+                mpfr_set_nan(*result);
+            }, "MPFR strtofr failed");
+            if (tok->negative) mpfr_neg(*result, *result, MPFR_RNDN);
+            break;
+        }
+        case TOK_VAR: {
+            const Token* tok = node->token;
+            if (p->symTable->array_count) {
+                Symbol* symbol = symbol_table_find(p->symTable, tok->lexeme, tok->len);
+                if (symbol && symbol->array) {
+                    ERROR_RETURN_NULL("'%s' is a vector, a scalar is expected here\n", symbol->name);
+                }
+            }
+            mpfr_t* var_value = symbol_table_get(p->symTable, tok->lexeme, tok->len);
+            if (var_value && p->borrow && mpfr_get_prec(*var_value) == p->precision) {
+                // Same rounding as a copy, nothing can write it before it is used
+                result = var_value;
+            } else if (var_value) {
+                mpfr_set(*result, *var_value, MPFR_RNDN);
+            } else {
+                ERROR_PRINT("Undefined variable: '%.*s'\n", (int)tok->len, tok->lexeme);
+                mpfr_set_nan(*result);
             }
             break;
         }
+        case TOK_ADD: {
+            mpfr_t *left_val, *right_val;
+            EVALUATE_OPERANDS(p, node->left, node->right, left_val, right_val);
+            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
+            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
+            mpfr_add(*result, *left_val, *right_val, MPFR_RNDN);
+            break;
+        }
+        case TOK_SUB: {
+            mpfr_t *left_val, *right_val;
+            EVALUATE_OPERANDS(p, node->left, node->right, left_val, right_val);
+            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
+            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
+            mpfr_sub(*result, *left_val, *right_val, MPFR_RNDN);
+            break;
+        }
+        case TOK_DIVIDE: {
+            mpfr_t *left_val, *right_val;
+            EVALUATE_OPERANDS(p, node->left, node->right, left_val, right_val);
+            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
+            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
+            
+            if (mpfr_zero_p(*right_val)) {
+                ERROR_PRINT("Division by zero\n");
+                mpfr_set_nan(*result);
+            } else {
+                mpfr_div(*result, *left_val, *right_val, MPFR_RNDN);
+            }
+            break;
+        }
+        case TOK_MODULE: {
+            mpfr_t *left_val, *right_val;
+            EVALUATE_OPERANDS(p, node->left, node->right, left_val, right_val);
+            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
+            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
+            
+            if (mpfr_zero_p(*right_val)) {
+                ERROR_PRINT("Modulo by zero\n");
+                mpfr_set_nan(*result);
+            } else {
+                mpfr_fmod(*result, *left_val, *right_val, MPFR_RNDN);
+            }
+            break;
+        }
+        case TOK_MULT: {
+            mpfr_t *left_val, *right_val;
+            EVALUATE_OPERANDS(p, node->left, node->right, left_val, right_val);
+            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
+            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
+            mpfr_mul(*result, *left_val, *right_val, MPFR_RNDN);
+            break;
+        }
+        case TOK_POWER: {
+            mpfr_t *left_val, *right_val;
+            EVALUATE_OPERANDS(p, node->left, node->right, left_val, right_val);
+            CHECK_NULL(left_val, ERROR_RETURN_NULL("Left operand evaluation failed"));
+            CHECK_NULL(right_val, ERROR_RETURN_NULL("Right operand evaluation failed"));
+            if (!admit_power(p, *left_val, *right_val)) mpfr_set_nan(*result);
+            else builtin_power(*result, *left_val, *right_val);
+            break;
+        }
+        case TOK_POWI: {
+            mpfr_t* base = evaluate_node(p, node->left);
+            CHECK_NULL(base, ERROR_RETURN_NULL("Left operand evaluation failed"));
+            mpfr_pow_si(*result, *base, (int32_t)node->aux, MPFR_RNDN);
+            break;
+        }
+        case TOK_FMA:
+        case TOK_FMS: {
+            // Operands in source order, the '*' node only holds a and b
+            bool product_left = node->left->token->type == TOK_MULT;
+            ASTNode* product = product_left ? node->left : node->right;
+            mpfr_t *a, *b;
+            mpfr_t* addend = product_left ? NULL : evaluate_node(p, node->left);
+            EVALUATE_OPERANDS(p, product->left, product->right, a, b);
+            if (product_left) addend = evaluate_node(p, node->right);
+            CHECK_NULL(a, ERROR_RETURN_NULL("Left factor evaluation failed"));
+            CHECK_NULL(b, ERROR_RETURN_NULL("Right factor evaluation failed"));
+            CHECK_NULL(addend, ERROR_RETURN_NULL("Addend evaluation failed"));
+
+            if (node->token->type == TOK_FMA) {
+                mpfr_fma(*result, *a, *b, *addend, MPFR_RNDN);
+            } else {
+                // c - a*b is -(a*b - c), round to nearest is symmetric
+                mpfr_fms(*result, *a, *b, *addend, MPFR_RNDN);
+                if (!product_left) mpfr_neg(*result, *result, MPFR_RNDN);
+            }
+            break;
+        }
+        case TOK_SUM: {
+            if (!evaluate_sum(p, node, *result)) return NULL;
+            break;
+        }
+        case TOK_FUNC: {
+            if (builtinTable[node->token->id].kind == BUILTIN_ARRAY) {
+                Value value;
+                if (!evaluate_array_builtin(p, node, &value)) return NULL;
+                if (value.array) {
+                    array_release(value.array);
+                    ERROR_RETURN_NULL("%s() gives a vector or matrix, a scalar is expected here\n",
+                                      builtinTable[node->token->id].name);
+                }
+                mpfr_set(*result, *value.num, MPFR_RNDN);
+                break;
+            }
+
+            mpfr_t* args[BUILTIN_MAX_ARITY];
+            if (node->aux == 2) {
+                EVALUATE_OPERANDS(p, node->left, node->left->next, args[0], args[1]);
+                CHECK_NULL(args[0], ERROR_RETURN_NULL("Argument evaluation failed"));
+                CHECK_NULL(args[1], ERROR_RETURN_NULL("Argument evaluation failed"));
+            } else {
+                uint32_t argc = 0;
+                for (ASTNode* arg = node->left; arg; arg = arg->next) {
+                    args[argc] = evaluate_node(p, arg);
+                    CHECK_NULL(args[argc], ERROR_RETURN_NULL("Argument evaluation failed"));
+                    argc++;
+                }
+            }
+            
+            if (!admit_builtin(p, node->token->id, args)) {
+                mpfr_set_nan(*result);
+            } else if (!builtin_call(node->token->id, *result, args)) {
+                ERROR_PRINT("Domain error in %s()\n", builtinTable[node->token->id].name);
+            }
+            break;
+        }
+        case TOK_CONST: {
+            builtin_constant(node->token->id, *result);
+            break;
+        }
+        case TOK_HISTORY: {
+            HistorySlot* slot = history_get(p->history, node->token->id);
+            if (!slot) ERROR_RETURN_NULL("No result $%u yet\n", node->token->id);
+            if (slot->array) ERROR_RETURN_NULL("$%u is a vector, a scalar is expected here\n", node->token->id);
+            // Results are at the session precision and only written between lines
+            result = &slot->num;
+            break;
+        }
+        case TOK_NEG: {
+            mpfr_t* operand = evaluate_node(p, node->left);
+            CHECK_NULL(operand, ERROR_RETURN_NULL("Negation operand evaluation failed"));
+            mpfr_neg(*result, *operand, MPFR_RNDN);
+            break;
+        }
+        case TOK_PARAM: {
+            // Arguments are temporaries of the caller or variables it borrowed
+            result = p->frame[p->frame_base + node->aux];
+            break;
+        }
+        case TOK_CALL: {
+            Token* name = node->token;
+            Function* fn = function_table_get(p->funcTable, name->lexeme, name->len);
+            if (!fn) ERROR_RETURN_NULL("Undefined function: '%.*s'\n", name->len, name->lexeme);
+            if (fn->param_count != node->aux) {
+                ERROR_RETURN_NULL("%.*s expects %u argument(s), got %u\n",
+                                  name->len, name->lexeme, fn->param_count, node->aux);
+            }
+            if (p->call_depth >= FUNCTION_CALL_DEPTH_LIMIT) {
+                ERROR_RETURN_NULL("Call depth limit reached (%d) in '%.*s'\n",
+                                  FUNCTION_CALL_DEPTH_LIMIT, name->len, name->lexeme);
+            }
+
+            // Arguments are evaluated in the caller's frame, then become the callee's
+            uint32_t base = p->frame_top;
+            if (!frame_reserve(p, node->aux)) return NULL;
+            for (ASTNode* arg = node->left; arg; arg = arg->next) {
+                mpfr_t* value = evaluate_node(p, arg);
+                if (!value) return NULL;
+                p->frame[p->frame_top++] = value;
+            }
+
+            uint32_t saved_base = p->frame_base;
+            uint32_t cut_base = p->cut_base, cut_top = p->cut_top;
+            p->frame_base = base;
+            p->call_depth++;
+            mpfr_t* value = begin_cuts(p, fn->expr, false) ? evaluate_node(p, fn->body) : NULL;
+            end_cuts(p, cut_base, cut_top);
+            p->call_depth--;
+            p->frame_base = saved_base;
+            p->frame_top = base;
+            if (!value) return NULL; // already reported where it failed
+
+            // The body's slots stay until the caller's expression is done
+            result = value;
+            break;
+        }
+        case TOK_DEFINE: {
+            ASTNode* call = node->left;
+            Function* fn = function_table_define(p->funcTable, call->token->lexeme, call->token->len,
+                                                 p->expr, node->right, call->aux);
+            CHECK_NULL(fn, ERROR_RETURN_NULL("Failed to define function"));
+            mpfr_set_nan(*result);
+            break;
+        }
+        case TOK_INDEX: {
+            Value value;
+            if (!evaluate_value_op(p, node, &value)) return NULL;
+            if (value.array) {
+                array_release(value.array);
+                ERROR_RETURN_NULL("Matrix row where a scalar is expected\n");
+            }
+            mpfr_set(*result, *value.num, MPFR_RNDN);
+            break;
+        }
+        case TOK_VECTOR: {
+            ERROR_RETURN_NULL("Vector value where a scalar is expected\n");
+        }
         case TOK_ASSING: {
             mpfr_t* right_val = evaluate_node(p, node->right);
             CHECK_NULL(right_val, ERROR_RETURN_NULL("Assignment value evaluation failed"));
+            if (limits_tripped(p->limits)) return NULL; // the value is a cancelled NaN
             
+            // The table copies 'len' bytes of the lexeme, no terminated copy needed
             mpfr_t* stored = symbol_table_insert(p->symTable,
-                token_adjust_lexeme(node->left->token),
+                node->left->token->lexeme,
                 right_val,
                 node->left->token->len);
             CHECK_NULL(stored, ERROR_RETURN_NULL("Failed to store variable in symbol table"));
             
-            mpfr_set(*result, *right_val, MPFR_RNDN);
+            // Only the head assigns when borrowing, nothing can overwrite it after
+            if (p->borrow) result = stored;
+            else mpfr_set(*result, *right_val, MPFR_RNDN);
             DEBUG_EVAL("Assignment: %s = ", token_adjust_lexeme(node->left->token));
             DEBUG_MPFR_VALUE(*result, "");
             break;
@@ -735,16 +2004,393 @@ static mpfr_t* evaluate_node(Parser* p, ASTNode* node) {
     return result;
 }
 
-bool evaluate_expression(Parser* parser, ASTNode* head, mpfr_t* ans) {
+// Applies a binary operator to two values, consuming their vector references.
+static bool combine_values(Parser* p, TokenType op, Value* left, Value* right, Value* out) {
+    Array* result = NULL;
+    if (op == TOK_MULT && left->array && right->array && (left->array->rows || right->array->rows)) {
+        // '*' with a matrix operand is the matrix product
+        result = matrix_multiply(left->array, right->array, p->precision);
+        array_release(left->array);
+        array_release(right->array);
+    } else if (left->array && right->array) {
+        result = array_binary(op, left->array, right->array, p->precision);
+    } else if (left->array) {
+        result = array_scalar(op, left->array, *right->num, false, p->precision);
+    } else if (right->array) {
+        result = array_scalar(op, right->array, *left->num, true, p->precision);
+    } else {
+        mpfr_t* num = mpfr_buffer_next(p->mpfrBuffer);
+        CHECK_NULL(num, return false);
+        if (op == TOK_POWER && !admit_power(p, *left->num, *right->num)) mpfr_set_nan(*num);
+        else scalar_binary(op, *num, *left->num, *right->num);
+        out->num = num;
+        out->array = NULL;
+        return true;
+    }
+    out->num = NULL;
+    out->array = result;
+    return result != NULL;
+}
+
+// Factors of a regrouped '*' chain in source order: element-wise and matrix
+// products do not associate with each other, so vectors never see the new grouping.
+static bool fold_product(Parser* p, ASTNode* node, Value* acc, bool* empty) {
+    if (node->token->type == TOK_MULT && node->aux == 1) {
+        return fold_product(p, node->left, acc, empty) && fold_product(p, node->right, acc, empty);
+    }
+
+    Value factor;
+    if (!evaluate_value(p, node, &factor)) return false;
+    if (*empty) {
+        *acc = factor;
+        *empty = false;
+        return true;
+    }
+    bool ok = combine_values(p, TOK_MULT, acc, &factor, acc);
+    *empty = !ok;
+    return ok;
+}
+
+// Evaluator for lines that involve vectors. Vector-producing nodes are handled
+// here, everything else is handed to evaluate_node().
+static bool evaluate_value_op(Parser* p, ASTNode* node, Value* out) {
+    out->num = NULL;
+    out->array = NULL;
+    if (stack_exhausted(p, __builtin_frame_address(0))) {
+        ERROR_RETURN(false, "Expression nested too deeply for the stack\n");
+    }
+    TokenType type = node->token->type;
+
+    switch (type) {
+        case TOK_VECTOR: {
+            // The first element decides: scalars make a vector, vectors the rows of a matrix
+            uint32_t mark = p->mpfrBuffer->count;
+            Value first;
+            if (!evaluate_value(p, node->left, &first)) return false;
+            if (first.array) return evaluate_matrix(p, node, first.array, out);
+
+            Array* array = array_create(node->aux, p->precision);
+            CHECK_NULL(array, return false);
+            array_set(array, 0, *first.num);
+            p->mpfrBuffer->count = mark;
+
+            // Every element is copied out at once, its temporaries can be reused
+            uint32_t i = 1;
+            for (ASTNode* element = node->left->next; element; element = element->next, i++) {
+                mpfr_t* value = evaluate_node(p, element);
+                if (!value) {
+                    array_release(array);
+                    return false;
+                }
+                array_set(array, i, *value);
+                p->mpfrBuffer->count = mark;
+            }
+            out->array = array;
+            return true;
+        }
+        case TOK_INDEX: {
+            // M[i][j] reads the element without copying row i
+            ASTNode* target_node = node->left->token->type == TOK_INDEX ? node->left->left : node->left;
+            Value target;
+            if (!evaluate_value(p, target_node, &target)) return false;
+            Array* array = target.array;
+            if (!array || (target_node != node->left && !array->rows)) {
+                array_release(array);
+                ERROR_RETURN(false, "Only vectors and matrices can be indexed\n");
+            }
+
+            uint32_t i, j = 0;
+            bool ok;
+            if (target_node != node->left) {
+                ok = evaluate_index(p, node->left->right, array->rows, &i) &&
+                     evaluate_index(p, node->right, array->cols, &j);
+                i = i * array->cols + j;
+            } else {
+                ok = evaluate_index(p, node->right, array->rows ? array->rows : array->len, &i);
+            }
+
+            if (ok && array->rows && target_node == node->left) {
+                out->array = matrix_row(array, i, p->precision);
+                ok = out->array != NULL;
+            } else if (ok) {
+                out->num = mpfr_buffer_next(p->mpfrBuffer);
+                ok = out->num != NULL;
+                if (ok) array_get(array, i, *out->num);
+            }
+            array_release(array);
+            return ok;
+        }
+        case TOK_HISTORY: {
+            HistorySlot* slot = history_get(p->history, node->token->id);
+            if (slot && slot->array) {
+                slot->array->refs++;
+                out->array = slot->array;
+                return true;
+            }
+            break;
+        }
+        case TOK_VAR: {
+            if (!p->symTable->array_count) break;
+            Symbol* symbol = symbol_table_find(p->symTable, node->token->lexeme, node->token->len);
+            if (symbol && symbol->array) {
+                symbol->array->refs++;
+                out->array = symbol->array;
+                return true;
+            }
+            break;
+        }
+        case TOK_ADD:
+        case TOK_SUB:
+        case TOK_MULT:
+        case TOK_DIVIDE:
+        case TOK_MODULE:
+        case TOK_POWER:
+        case TOK_POWI: {
+            // With vectors around, the literal exponent of x^n is evaluated like any operand
+            if (type == TOK_POWI) type = TOK_POWER;
+            if (type == TOK_MULT && node->aux == 2) {
+                bool empty = true;
+                if (!fold_product(p, node->left, out, &empty) || !fold_product(p, node->right, out, &empty)) {
+                    if (!empty) array_release(out->array);
+                    return false;
+                }
+                return true;
+            }
+
+            Value left, right;
+            if (!evaluate_value(p, node->left, &left)) return false;
+            if (!evaluate_value(p, node->right, &right)) {
+                array_release(left.array);
+                return false;
+            }
+            return combine_values(p, type, &left, &right, out);
+        }
+        case TOK_FMA:
+        case TOK_FMS: {
+            // Fused for scalars, with a vector it is the product then the sum
+            bool product_left = node->left->token->type == TOK_MULT;
+            ASTNode* product = product_left ? node->left : node->right;
+            Value a, b, addend = { NULL, NULL };
+            if (!product_left && !evaluate_value(p, node->left, &addend)) return false;
+            if (!evaluate_value(p, product->left, &a)) {
+                array_release(addend.array);
+                return false;
+            }
+            if (!evaluate_value(p, product->right, &b)) {
+                array_release(addend.array);
+                array_release(a.array);
+                return false;
+            }
+            if (product_left && !evaluate_value(p, node->right, &addend)) {
+                array_release(a.array);
+                array_release(b.array);
+                return false;
+            }
+
+            if (!a.array && !b.array && !addend.array) {
+                out->num = mpfr_buffer_next(p->mpfrBuffer);
+                CHECK_NULL(out->num, return false);
+                if (type == TOK_FMA) {
+                    mpfr_fma(*out->num, *a.num, *b.num, *addend.num, MPFR_RNDN);
+                } else {
+                    mpfr_fms(*out->num, *a.num, *b.num, *addend.num, MPFR_RNDN);
+                    if (!product_left) mpfr_neg(*out->num, *out->num, MPFR_RNDN);
+                }
+                return true;
+            }
+
+            Value ab;
+            if (!combine_values(p, TOK_MULT, &a, &b, &ab)) {
+                array_release(addend.array);
+                return false;
+            }
+            TokenType op = type == TOK_FMA ? TOK_ADD : TOK_SUB;
+            return product_left ? combine_values(p, op, &ab, &addend, out)
+                                : combine_values(p, op, &addend, &ab, out);
+        }
+        case TOK_SUM: {
+            // Scalar terms are summed once, with a vector they fold left to right
+            uint32_t count = 2;
+            for (ASTNode* link = node->left; is_add_sub(link); link = link->left) count++;
+            Value* terms = malloc(count * (sizeof(Value) + sizeof(TokenType) + sizeof(bool)));
+            CHECK_NULL(terms, ERROR_RETURN(false, "Failed to allocate sum terms"));
+            TokenType* ops = (TokenType*)(terms + count);
+            bool* borrowed = (bool*)(ops + count); // the term may be a variable or a result, not a temporary
+
+            uint32_t k = count, arrays = 0;
+            TokenType op = (TokenType)node->aux;
+            ASTNode* link = node;
+            bool ok;
+            while (true) {
+                ok = evaluate_value(p, link->right, &terms[--k]);
+                if (!ok) break;
+                ops[k] = op;
+                borrowed[k] = node_borrows(link->right);
+                arrays += terms[k].array != NULL;
+                link = link->left;
+                if (!is_add_sub(link)) break;
+                op = link->token->type;
+            }
+            if (ok) {
+                ok = evaluate_value(p, link, &terms[--k]);
+                arrays += ok && terms[k].array;
+            }
+            if (!ok) {
+                for (uint32_t i = k + 1; i < count; i++) array_release(terms[i].array);
+                free(terms);
+                return false;
+            }
+
+            if (!arrays) {
+                uint32_t base = p->terms_top;
+                out->num = mpfr_buffer_next(p->mpfrBuffer);
+                for (uint32_t i = 0; i < count && ok; i++) {
+                    mpfr_t* term = terms[i].num;
+                    if (i && ops[i] == TOK_SUB) {
+                        if (borrowed[i]) term = mpfr_buffer_next(p->mpfrBuffer);
+                        ok = term != NULL;
+                        if (ok) mpfr_neg(*term, *terms[i].num, MPFR_RNDN);
+                    }
+                    ok = ok && push_term(p, *term);
+                }
+                if (ok && out->num) sum_terms(p, *out->num, base);
+                p->terms_top = base;
+                free(terms);
+                return ok && out->num;
+            }
+
+            Value acc = terms[0];
+            for (uint32_t i = 1; i < count; i++) {
+                if (!ok) {
+                    array_release(terms[i].array);
+                    continue;
+                }
+                ok = combine_values(p, ops[i], &acc, &terms[i], &acc);
+            }
+            free(terms);
+            if (!ok) return false;
+            *out = acc;
+            return true;
+        }
+        case TOK_NEG: {
+            Value operand;
+            if (!evaluate_value(p, node->left, &operand)) return false;
+            if (operand.array) {
+                out->array = array_negate(operand.array, p->precision);
+                return out->array != NULL;
+            }
+            out->num = mpfr_buffer_next(p->mpfrBuffer);
+            CHECK_NULL(out->num, return false);
+            mpfr_neg(*out->num, *operand.num, MPFR_RNDN);
+            return true;
+        }
+        case TOK_FUNC: {
+            // One-argument functions apply element-wise to a vector
+            const Builtin* builtin = &builtinTable[node->token->id];
+            if (builtin->kind == BUILTIN_ARRAY) return evaluate_array_builtin(p, node, out);
+            if (builtin->kind != BUILTIN_FUNCTION || builtin->arity != 1) break;
+
+            Value arg;
+            if (!evaluate_value(p, node->left, &arg)) return false;
+            if (arg.array) {
+                out->array = array_map(node->token->id, arg.array, p->precision);
+                return out->array != NULL;
+            }
+            out->num = mpfr_buffer_next(p->mpfrBuffer);
+            CHECK_NULL(out->num, return false);
+            if (!admit_builtin(p, node->token->id, &arg.num)) {
+                mpfr_set_nan(*out->num);
+            } else if (!builtin_call(node->token->id, *out->num, &arg.num)) {
+                ERROR_PRINT("Domain error in %s()\n", builtin->name);
+            }
+            return true;
+        }
+        case TOK_ASSING: {
+            Value value;
+            if (!evaluate_value(p, node->right, &value)) return false;
+            if (limits_tripped(p->limits)) {
+                array_release(value.array);
+                return false;
+            }
+            const char* name = node->left->token->lexeme;
+
+            if (value.array) {
+                if (!symbol_table_insert_array(p->symTable, name, value.array, node->left->token->len)) {
+                    array_release(value.array);
+                    ERROR_RETURN(false, "Failed to store vector in symbol table\n");
+                }
+                out->array = value.array;
+                return true;
+            }
+            CHECK_NULL(symbol_table_insert(p->symTable, name, value.num, node->left->token->len),
+                       ERROR_RETURN(false, "Failed to store variable in symbol table"));
+            out->num = value.num;
+            return true;
+        }
+        default:
+            break;
+    }
+
+    out->num = evaluate_node_op(p, node); // already timed as this node
+    return out->num != NULL;
+}
+
+bool evaluate_expression(Parser* parser, Expr* expr, mpfr_t* ans) {
     DEBUG_FUNCTION_ENTER();
     CHECK_NULL(parser, ERROR_RETURN(false, "Parser is NULL"));
-    CHECK_NULL(head, ERROR_RETURN(false, "AST head is NULL"));
+    CHECK_NULL(expr, ERROR_RETURN(false, "Expression is NULL"));
     CHECK_NULL(ans, ERROR_RETURN(false, "Result pointer is NULL"));
     
     DEBUG_EVAL("Starting expression evaluation\n");
     parser->mpfrBuffer->count = 0;
+    parser->frame_base = parser->frame_top = 0;
+    parser->terms_top = 0;
+    parser->call_depth = 0;
+    parser->cut_base = parser->cut_top = 0;
+    parser->expr = expr;
+    parser->stack_floor = stack_floor();
+    // A definition only stores its body, the cuts of the expression are the body's
+    bool define = expr->head->token->type == TOK_DEFINE;
+    // Variables are borrowed when the only write is the head assignment, and
+    // calls cannot reach one
+    const ASTNode* reads = expr->head->token->type == TOK_ASSING ? expr->head->right : expr->head;
+    parser->borrow = reads->weight &&
+        (!(reads->weight & NODE_WEIGHT_CALLS) || !parser->funcTable->impure_count);
+    array_release(parser->array_result);
+    parser->array_result = NULL;
     
-    mpfr_t* result = evaluate_node(parser, head);
+    // The vector evaluator is only needed when a vector can show up
+    mpfr_t* result;
+    limits_begin(parser->limits, parser->precision, parser->serial);
+    parser->limit_steps = 0;
+    mp_memory_scope_begin();
+    if (expr->arrays || parser->symTable->array_count || parser->history->array_count) {
+        Value value = { NULL, NULL };
+        bool ok = (define || begin_cuts(parser, expr, true)) && evaluate_value(parser, expr->head, &value);
+        result = ok ? value.num : NULL;
+        parser->array_result = ok ? value.array : NULL;
+    } else {
+        result = define || begin_cuts(parser, expr, false) ? evaluate_node(parser, expr->head) : NULL;
+    }
+    end_cuts(parser, 0, 0);
+    mp_memory_scope_end();
+    parser->expr = NULL;
+
+    LimitKind limit = limits_end(parser->limits);
+    if (limit != LIMIT_NONE) {
+        limits_report(parser->limits, limit);
+        array_release(parser->array_result);
+        parser->array_result = NULL;
+        DEBUG_FUNCTION_EXIT();
+        return false;
+    }
+    
+    if (parser->array_result) {
+        mpfr_set_nan(*ans);
+        DEBUG_EVAL("Evaluation completed with a vector of %u elements\n", parser->array_result->len);
+        DEBUG_FUNCTION_EXIT();
+        return true;
+    }
     if (!result) {
         ERROR_PRINT("Expression evaluation failed\n");
         DEBUG_FUNCTION_EXIT();
@@ -758,6 +2404,107 @@ bool evaluate_expression(Parser* parser, ASTNode* head, mpfr_t* ans) {
     return true;
 }
 
+// ##############################
+// #####  PARALLEL EVALUATION #####
+// ##############################
+
+static void parallel_stop(Parser* parser) {
+    if (!parser->pool) return;
+    uint32_t workers = parser->pool->workers;
+    task_pool_destroy(parser->pool);
+    for (uint32_t i = 1; i < workers; i++) {
+        Parser* worker = parser->workers[i];
+        for (uint32_t k = 0; k < TOK_INVALID; k++) parser->op_counts[k] += worker->op_counts[k];
+        mpfr_buffer_destroy(worker->mpfrBuffer);
+        free(worker->frame);
+        free(worker->terms);
+        free(worker->cuts);
+        free(worker);
+    }
+    free(parser->workers);
+    parser->pool = NULL;
+    parser->workers = NULL;
+}
+
+// Worker parsers share the session tables, read-only while tasks run, and own
+// their temporaries, call frames and sum terms.
+static bool parallel_start(Parser* parser, uint32_t workers) {
+    parser->workers = calloc(workers, sizeof(Parser*));
+    CHECK_NULL(parser->workers, ERROR_RETURN(false, "Failed to allocate worker parsers"));
+    parser->workers[0] = parser;
+
+    for (uint32_t i = 1; i < workers; i++) {
+        Parser* worker = malloc(sizeof(Parser));
+        MpfrBuffer* buffer = worker ? mpfr_buffer_create(parser->precision) : NULL;
+        if (!buffer) {
+            free(worker);
+            while (--i > 0) {
+                mpfr_buffer_destroy(parser->workers[i]->mpfrBuffer);
+                free(parser->workers[i]);
+            }
+            free(parser->workers);
+            parser->workers = NULL;
+            ERROR_RETURN(false, "Failed to create worker parser\n");
+        }
+        *worker = *parser; // 'workers' is shared as well
+        worker->mpfrBuffer = buffer;
+        worker->worker = i;
+        worker->frame = NULL;
+        worker->frame_base = worker->frame_top = worker->frame_size = 0;
+        worker->terms = NULL;
+        worker->terms_top = worker->terms_size = 0;
+        worker->cuts = NULL;
+        worker->cut_base = worker->cut_top = worker->cut_size = 0;
+        worker->tokens = NULL;
+        worker->nodesBuffer = NULL;
+        worker->opStack = NULL;
+        worker->valStack = NULL;
+        worker->array_result = NULL;
+        memset(worker->op_counts, 0, sizeof(worker->op_counts));
+        parser->workers[i] = worker;
+    }
+
+    TaskPool* pool = task_pool_create(workers, (void**)parser->workers);
+    uint32_t started = pool ? pool->workers : 1;
+    for (uint32_t i = started; i < workers; i++) {
+        mpfr_buffer_destroy(parser->workers[i]->mpfrBuffer);
+        free(parser->workers[i]);
+    }
+    if (!pool) {
+        free(parser->workers);
+        parser->workers = NULL;
+        return false;
+    }
+
+    // Workers fork nested subtrees too
+    for (uint32_t i = 0; i < started; i++) parser->workers[i]->pool = pool;
+    return true;
+}
+
+// Derives the fork threshold from the precision: a multiplication of n limbs
+// costs about n^1.585 limb products (Karatsuba). The pool is started the first
+// time forking can pay off, and needs an MPFR built with thread-local state.
+static void parser_update_parallel(Parser* parser) {
+    double limbs = (double)(parser->precision + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+    double weight = ceil(EVAL_FORK_MIN_WORK / pow(limbs, 1.585) * NODE_WEIGHT_MUL);
+    parser->fork_weight = weight < NODE_WEIGHT_MASK ? (uint32_t)weight : NODE_WEIGHT_MASK;
+
+    for (uint32_t i = 1; parser->pool && i < parser->pool->workers; i++) {
+        mpfr_buffer_set_precision(parser->workers[i]->mpfrBuffer, parser->precision);
+        parser->workers[i]->precision = parser->precision;
+        parser->workers[i]->fork_weight = parser->fork_weight;
+    }
+    if (parser->pool || parser->serial || parser->fork_weight > EVAL_FORK_MAX_WEIGHT || !mpfr_buildopt_tls_p()) return;
+
+    uint32_t workers = task_pool_cpu_count();
+    if (workers > TASK_POOL_MAX_WORKERS) workers = TASK_POOL_MAX_WORKERS;
+    if (workers < 2) return;
+    if (parallel_start(parser, workers)) {
+        DEBUG_PARSE("Parallel evaluation on %u workers, forking subtrees of weight %u+\n",
+                    workers, parser->fork_weight);
+    }
+}
+
 Parser* parser_create(TokenBuffer* tokens) {
     DEBUG_FUNCTION_ENTER();
     CHECK_NULL(tokens, ERROR_RETURN_NULL("Token buffer is NULL"));
@@ -775,6 +2522,28 @@ Parser* parser_create(TokenBuffer* tokens) {
     parser->curr_node = 0;
     parser->curr_tok = 0;
     parser->tokens = tokens;
+    parser->opStack = NULL;
+    parser->valStack = NULL;
+    parser->stack_size = 0;
+    parser->frame = NULL;
+    parser->frame_base = parser->frame_top = parser->frame_size = 0;
+    parser->terms = NULL;
+    parser->terms_top = parser->terms_size = 0;
+    parser->call_depth = 0;
+    parser->stack_floor = 0;
+    parser->cuts = NULL;
+    parser->cut_base = parser->cut_top = parser->cut_size = 0;
+    parser->precision = PRECISION_ROUNDING_BITS;
+    parser->reassociate = false;
+    parser->trace = false;
+    parser->serial = false;
+    parser->borrow = false;
+    parser->pool = NULL;
+    parser->workers = NULL;
+    parser->worker = 0;
+    parser->expr = NULL;
+    parser->array_result = NULL;
+    memset(parser->op_counts, 0, sizeof(parser->op_counts));
     
     parser->symTable = symbol_table_create();
     CHECK_NULL(parser->symTable, {
@@ -783,29 +2552,45 @@ Parser* parser_create(TokenBuffer* tokens) {
         ERROR_RETURN_NULL("Failed to create symbol table");
     });
     
-    parser->mpfrBuffer = malloc(sizeof(MpfrBuffer));
-    CHECK_NULL(parser->mpfrBuffer, {
+    parser->funcTable = function_table_create();
+    CHECK_NULL(parser->funcTable, {
         symbol_table_destroy(parser->symTable);
         free(parser->nodesBuffer);
         free(parser);
-        ERROR_RETURN_NULL("Failed to allocate MPFR buffer");
+        ERROR_RETURN_NULL("Failed to create function table");
     });
     
-    parser->mpfrBuffer->buffer = calloc(MPRF_BUFFER_SIZE, sizeof(mpfr_t));
-    CHECK_NULL(parser->mpfrBuffer->buffer, {
-        free(parser->mpfrBuffer);
+    parser->history = history_create(parser->precision);
+    CHECK_NULL(parser->history, {
+        function_table_destroy(parser->funcTable);
         symbol_table_destroy(parser->symTable);
         free(parser->nodesBuffer);
         free(parser);
-        ERROR_RETURN_NULL("Failed to allocate MPFR variables");
+        ERROR_RETURN_NULL("Failed to create result history");
     });
     
-    parser->mpfrBuffer->size = MPRF_BUFFER_SIZE;
-    parser->mpfrBuffer->count = 0;
-    
-    for (uint16_t i = 0; i < MPRF_BUFFER_SIZE; i++) {
-        mpfr_init2(parser->mpfrBuffer->buffer[i], PRECISION_ROUNDING_BITS);
-    }
+    parser->mpfrBuffer = mpfr_buffer_create(parser->precision);
+    CHECK_NULL(parser->mpfrBuffer, {
+        history_destroy(parser->history);
+        function_table_destroy(parser->funcTable);
+        symbol_table_destroy(parser->symTable);
+        free(parser->nodesBuffer);
+        free(parser);
+        ERROR_RETURN_NULL("Failed to create MPFR buffer");
+    });
+
+    parser->limits = limits_create();
+    parser->limit_steps = 0;
+    CHECK_NULL(parser->limits, {
+        mpfr_buffer_destroy(parser->mpfrBuffer);
+        history_destroy(parser->history);
+        function_table_destroy(parser->funcTable);
+        symbol_table_destroy(parser->symTable);
+        free(parser->nodesBuffer);
+        free(parser);
+        ERROR_RETURN_NULL("Failed to create evaluation limits");
+    });
+    parser_update_parallel(parser);
     
     DEBUG_PARSE("Parser created successfully\n");
     DEBUG_FUNCTION_EXIT();
@@ -818,7 +2603,9 @@ void parser_destroy(Parser* parser) {
     
     DEBUG_PARSE("Destroying parser\n");
     
+    parallel_stop(parser);
     free(parser->nodesBuffer);
+    array_release(parser->array_result);
     
     if (parser->tokens) {
         token_buffer_destroy(parser->tokens);
@@ -828,16 +2615,22 @@ void parser_destroy(Parser* parser) {
         symbol_table_destroy(parser->symTable);
     }
     
-    if (parser->mpfrBuffer) {
-        if (parser->mpfrBuffer->buffer) {
-            for (uint16_t i = 0; i < parser->mpfrBuffer->size; i++) {
-                mpfr_clear(parser->mpfrBuffer->buffer[i]);
-            }
-            free(parser->mpfrBuffer->buffer);
-        }
-        free(parser->mpfrBuffer);
+    if (parser->funcTable) {
+        function_table_destroy(parser->funcTable);
     }
     
+    history_destroy(parser->history);
+    
+    mpfr_buffer_destroy(parser->mpfrBuffer);
+    limits_destroy(parser->limits);
+    
+    free(parser->opStack);
+    free(parser->valStack);
+    free(parser->frame);
+    free(parser->terms);
+    free(parser->cuts);
+    array_pool_free();
+    builtins_free_cache();
     mpfr_free_cache();
     free(parser);
     
@@ -845,6 +2638,40 @@ void parser_destroy(Parser* parser) {
     DEBUG_FUNCTION_EXIT();
 }
 
+void parser_take_op_counts(Parser* parser, uint64_t counts[TOK_INVALID]) {
+    CHECK_NULL(parser, return);
+    // Workers only count while a line is evaluated
+    uint32_t workers = parser->pool ? parser->pool->workers : 1;
+    for (uint32_t i = 0; i < workers; i++) {
+        Parser* worker = parser->pool ? parser->workers[i] : parser;
+        for (uint32_t k = 0; k < TOK_INVALID; k++) counts[k] += worker->op_counts[k];
+        memset(worker->op_counts, 0, sizeof(worker->op_counts));
+    }
+}
+
+bool parser_set_precision(Parser* parser, mpfr_prec_t precision) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(parser, ERROR_RETURN(false, "Parser is NULL"));
+    
+    if (precision < MPFR_PREC_MIN || precision > PRECISION_MAX_BITS) {
+        ERROR_RETURN(false, "Precision must be between %d and %ld bits\n",
+                     MPFR_PREC_MIN, (long)PRECISION_MAX_BITS);
+    }
+    
+    // The history is the only part that can fail, it goes first
+    if (!history_set_precision(parser->history, precision)) {
+        ERROR_RETURN(false, "Not enough memory for the result history at %ld bits\n", (long)precision);
+    }
+    parser->precision = precision;
+    parser->symTable->precision = precision;
+    mpfr_buffer_set_precision(parser->mpfrBuffer, precision);
+    parser_update_parallel(parser);
+    
+    DEBUG_PARSE("Precision set to %ld bits\n", (long)precision);
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
 void parser_show(Parser* parser) {
     DEBUG_FUNCTION_ENTER();
     CHECK_NULL(parser, return);
@@ -857,7 +2684,7 @@ void parser_show(Parser* parser) {
     
     printf("\n🌳 Abstract Syntax Tree:\n");
     printf("========================================\n");
-    for (uint16_t i = 0; i < parser->curr_node; i++) {
+    for (uint32_t i = 0; i < parser->curr_node; i++) {
         ASTNode* curr = &parser->nodesBuffer[i];
         char currBuff[256];
         snprintf(currBuff, sizeof(currBuff), "%.*s",
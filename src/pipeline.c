@@ -0,0 +1,386 @@
+#include "pipeline.h"
+#include "array.h"
+#include "history.h"
+#include "stats.h"
+#include "symbolTable.h"
+#include "debug.h"
+#include <mpfr.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum LineKind{
+    LINE_EXPR,   // goes through every stage
+    LINE_EMPTY,  // only its prompt is printed
+    LINE_FAILED, // a stage already reported it, the later ones pass it on
+    LINE_END     // EOF or -exit, each stage stops once it passed it on
+} LineKind;
+
+// One slot of the pipeline. Whoever popped it last from a ring owns it.
+typedef struct Line{
+    char* buffer; // getline's, kept across uses of the slot
+    size_t buffer_size;
+    const char* text; // trimmed, inside 'buffer'
+    size_t len;
+    TokenBuffer* tokens;
+    Expr* expr;
+    mpfr_t value; // scalar result, a copy: its history slot is reused before it is printed
+    Array* array; // vector result, a private copy the printer releases
+    LineKind kind;
+    bool prompt;  // LINE_END: the reader printed no prompt for it yet
+} Line;
+
+typedef struct Pipeline{
+    App* app;
+    Parser* front; // parses and compiles, separate from the evaluating parser
+    TokenBuffer* front_tokens;
+    SpscRing lexed;     // reader -> compiler
+    SpscRing compiled;  // compiler -> evaluator
+    SpscRing evaluated; // evaluator -> printer
+    SpscRing free;      // printer -> reader
+    Line lines[PIPELINE_DEPTH];
+} Pipeline;
+
+_Static_assert((PIPELINE_DEPTH & (PIPELINE_DEPTH - 1)) == 0, "PIPELINE_DEPTH must be a power of two");
+
+// ##########################################
+// ######          SPSC rings           #####
+// ##########################################
+
+static void ring_init(SpscRing* ring) {
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    ring->head_seen = 0;
+    ring->tail_seen = 0;
+}
+
+static bool ring_try_push(SpscRing* ring, void* item) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->head_seen == PIPELINE_DEPTH) {
+        ring->head_seen = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->head_seen == PIPELINE_DEPTH) return false;
+    }
+    ring->slots[tail & (PIPELINE_DEPTH - 1)] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static void* ring_try_pop(SpscRing* ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == ring->tail_seen) {
+        ring->tail_seen = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == ring->tail_seen) return NULL;
+    }
+    void* item = ring->slots[head & (PIPELINE_DEPTH - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return item;
+}
+
+// Spins, then yields, then sleeps, so a stage waiting for input costs no CPU
+static void ring_wait(uint32_t* polls) {
+    uint32_t n = (*polls)++;
+    if (n < PIPELINE_SPINS) return;
+    if (n < PIPELINE_SPINS + PIPELINE_YIELDS) {
+        sched_yield();
+        return;
+    }
+    *polls = PIPELINE_SPINS + PIPELINE_YIELDS;
+    nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = PIPELINE_SLEEP_NS }, NULL);
+}
+
+static void ring_push(SpscRing* ring, void* item) {
+    uint32_t polls = 0;
+    while (!ring_try_push(ring, item)) ring_wait(&polls);
+}
+
+static void* ring_pop(SpscRing* ring) {
+    uint32_t polls = 0;
+    void* item;
+    while (!(item = ring_try_pop(ring))) ring_wait(&polls);
+    return item;
+}
+
+// ##########################################
+// ######            Stages             #####
+// ##########################################
+
+static void compile_line(Pipeline* pipe, Line* line) {
+    App* app = pipe->app;
+    uint64_t start = stats_now();
+
+    // A cached line skips parse() and compilation, it was tokenized for nothing
+    line->expr = expr_cache_get(app->cache, line->text, (uint32_t)line->len);
+    if (line->expr) {
+        app->stats->cache_hits++;
+        return;
+    }
+
+    Parser* front = pipe->front;
+    front->tokens = line->tokens;
+    front->reassociate = app->parser->reassociate; // only changes while the pipeline is drained
+    ASTNode* head = parse(front);
+    if (head) line->expr = parser_compile(front, line->text, head);
+    stats_record(app->stats, STAT_PARSE, stats_now() - start);
+    if (!head) {
+        ERROR_PRINT("Parsing failed for: %s\n", line->text);
+        line->kind = LINE_FAILED;
+        return;
+    }
+    if (!line->expr) {
+        ERROR_PRINT("Compilation failed for: %s\n", line->text);
+        line->kind = LINE_FAILED;
+        return;
+    }
+    expr_cache_put(app->cache, line->expr);
+}
+
+static void* compile_stage(void* arg) {
+    Pipeline* pipe = arg;
+    for (;;) {
+        Line* line = ring_pop(&pipe->lexed);
+        if (line->kind == LINE_EXPR) compile_line(pipe, line);
+        bool end = line->kind == LINE_END; // the line belongs to the next stage once pushed
+        ring_push(&pipe->compiled, line);
+        if (end) break;
+    }
+    return NULL;
+}
+
+// The printer may release it on another thread, so it cannot share the
+// evaluator's reference counts
+static Array* array_clone(const Array* array) {
+    Array* copy = array->rows ? array_create_matrix(array->rows, array->cols, array->precision)
+                              : array_create(array->len, array->precision);
+    CHECK_NULL(copy, ERROR_RETURN_NULL("Failed to copy a vector result for printing\n"));
+    array_copy(copy, 0, array, 0, array->len);
+    return copy;
+}
+
+static void evaluate_pipeline_line(Pipeline* pipe, Line* line) {
+    App* app = pipe->app;
+    Parser* parser = app->parser;
+    History* history = parser->history;
+    uint64_t start = stats_now();
+
+    mpfr_t* result = history_next(history);
+    bool evaluated = evaluate_expression(parser, line->expr, result);
+    stats_record(app->stats, STAT_EVALUATE, stats_now() - start);
+    if (!evaluated) {
+        ERROR_PRINT("Evaluation failed for: %s\n", line->text);
+        line->kind = LINE_FAILED;
+        return;
+    }
+
+    if (line->expr->head->token->type == TOK_DEFINE) return;
+    if (parser->array_result) {
+        line->array = array_clone(parser->array_result);
+        if (!line->array) line->kind = LINE_FAILED;
+        history_commit(history, parser->array_result);
+    } else {
+        if (mpfr_get_prec(line->value) != parser->precision) mpfr_set_prec(line->value, parser->precision);
+        mpfr_set(line->value, *result, MPFR_RNDN);
+        history_commit(history, NULL);
+    }
+}
+
+static void* evaluate_stage(void* arg) {
+    Pipeline* pipe = arg;
+    for (;;) {
+        Line* line = ring_pop(&pipe->compiled);
+        if (line->kind == LINE_EXPR) evaluate_pipeline_line(pipe, line);
+        bool end = line->kind == LINE_END;
+        ring_push(&pipe->evaluated, line);
+        if (end) break;
+    }
+    array_pool_free();
+    mpfr_free_cache();
+    return NULL;
+}
+
+// Same output as the interactive loop, prompt included
+static void print_line(Pipeline* pipe, Line* line) {
+    if (line->kind == LINE_END && !line->prompt) return;
+    printf(">> ");
+    if (line->kind == LINE_EXPR) {
+        uint64_t start = stats_now();
+        if (line->expr->head->token->type == TOK_DEFINE) {
+            printf("Function defined: %s\n", line->expr->text);
+        } else if (line->array) {
+            array_print(line->array, "Result: ");
+        } else {
+            print_friendly_mpfr(line->value, "Result: ");
+        }
+        stats_record(pipe->app->stats, STAT_OUTPUT, stats_now() - start);
+    }
+    array_release(line->array);
+    line->array = NULL;
+    expr_release(line->expr);
+    line->expr = NULL;
+}
+
+static void* print_stage(void* arg) {
+    Pipeline* pipe = arg;
+    for (;;) {
+        Line* line = ring_pop(&pipe->evaluated);
+        print_line(pipe, line);
+        bool end = line->kind == LINE_END;
+        ring_push(&pipe->free, line);
+        if (end) break;
+    }
+    fflush(stdout);
+    array_pool_free();
+    mpfr_free_cache();
+    return NULL;
+}
+
+// ##########################################
+// ######       Reader and setup        #####
+// ##########################################
+
+static void pipeline_destroy(Pipeline* pipe) {
+    for (uint32_t i = 0; i < PIPELINE_DEPTH; i++) {
+        Line* line = &pipe->lines[i];
+        if (line->tokens) {
+            token_buffer_destroy(line->tokens);
+            mpfr_clear(line->value);
+        }
+        free(line->buffer);
+    }
+    if (pipe->front) {
+        pipe->front->tokens = pipe->front_tokens; // lent to the lines while compiling
+        parser_destroy(pipe->front);
+    } else {
+        token_buffer_destroy(pipe->front_tokens);
+    }
+    free(pipe);
+}
+
+static Pipeline* pipeline_create(App* app) {
+    DEBUG_FUNCTION_ENTER();
+    Pipeline* pipe = aligned_alloc(_Alignof(Pipeline), sizeof(Pipeline));
+    CHECK_NULL(pipe, ERROR_RETURN_NULL("Failed to allocate the pipeline\n"));
+    memset(pipe, 0, sizeof(Pipeline));
+    pipe->app = app;
+    ring_init(&pipe->lexed);
+    ring_init(&pipe->compiled);
+    ring_init(&pipe->evaluated);
+    ring_init(&pipe->free);
+
+    pipe->front_tokens = token_buffer_create();
+    pipe->front = pipe->front_tokens ? parser_create(pipe->front_tokens) : NULL;
+    CHECK_NULL(pipe->front, {
+        pipeline_destroy(pipe);
+        ERROR_RETURN_NULL("Failed to create the pipeline parser\n");
+    });
+    pipe->front->serial = true; // it never evaluates
+
+    for (uint32_t i = 0; i < PIPELINE_DEPTH; i++) {
+        Line* line = &pipe->lines[i];
+        line->tokens = token_buffer_create();
+        CHECK_NULL(line->tokens, {
+            pipeline_destroy(pipe);
+            ERROR_RETURN_NULL("Failed to create the pipeline token buffers\n");
+        });
+        mpfr_init2(line->value, app->parser->precision);
+    }
+    DEBUG_FUNCTION_EXIT();
+    return pipe;
+}
+
+static bool is_command(InstructionMap* instructions, const char* text) {
+    char word[32];
+    size_t len = strcspn(text, " ");
+    if (len >= sizeof(word)) return false;
+    memcpy(word, text, len);
+    word[len] = '\0';
+    return instruction_map_exist(instructions, word);
+}
+
+// The reader keeps the slots it holds on a stack and refills it from the free ring
+static Line* take_line(Pipeline* pipe, Line** held, uint32_t* count) {
+    if (*count == 0) held[(*count)++] = ring_pop(&pipe->free);
+    return held[--*count];
+}
+
+// Waits until the printer gave back every slot, then nothing else runs
+static void drain(Pipeline* pipe, Line** held, uint32_t* count) {
+    while (*count < PIPELINE_DEPTH) held[(*count)++] = ring_pop(&pipe->free);
+}
+
+bool pipeline_run(App* app, InstructionMap* instructions) {
+    DEBUG_FUNCTION_ENTER();
+    Pipeline* pipe = pipeline_create(app);
+    CHECK_NULL(pipe, return false);
+
+    void* (*stages[3])(void*) = { compile_stage, evaluate_stage, print_stage };
+    pthread_t threads[3];
+    uint32_t started = 0;
+    while (started < 3 && pthread_create(&threads[started], NULL, stages[started], pipe) == 0) started++;
+
+    Line* held[PIPELINE_DEPTH];
+    uint32_t count = 0;
+    for (uint32_t i = PIPELINE_DEPTH; i > 0; i--) held[count++] = &pipe->lines[i - 1];
+
+    Stats* stats = app->stats;
+    bool prompt = false; // a command stopped the input
+    if (started < 3) {
+        ERROR_PRINT("Failed to start the pipeline threads\n");
+    } else {
+        prompt = true;
+        while (app->run) {
+            Line* line = take_line(pipe, held, &count);
+            if (getline(&line->buffer, &line->buffer_size, stdin) < 0) {
+                held[count++] = line;
+                break;
+            }
+            size_t len;
+            line->text = trim_line(line->buffer, &len);
+            line->len = len;
+            line->expr = NULL;
+            line->array = NULL;
+
+            if (line->text[0] == '\0') {
+                line->kind = LINE_EMPTY;
+                ring_push(&pipe->lexed, line);
+                continue;
+            }
+            if (line->text[0] == '-' && is_command(instructions, line->text)) {
+                held[count++] = line;
+                drain(pipe, held, &count);
+                printf(">> ");
+                instruction_map_execute(instructions, line->text, app, NULL);
+                continue;
+            }
+
+            stats->lines++;
+            app->line++;
+            uint64_t start = stats_now();
+            line->kind = tokenize(line->tokens, line->text) ? LINE_EXPR : LINE_FAILED;
+            stats_record(stats, STAT_TOKENIZE, stats_now() - start);
+            if (line->kind == LINE_FAILED) ERROR_PRINT("Tokenization failed for: %s\n", line->text);
+            ring_push(&pipe->lexed, line);
+        }
+        prompt = app->run; // EOF, the interactive loop printed a prompt before noticing it
+    }
+
+    // The end marker passes every stage that started, each one stops behind it
+    if (started > 0) {
+        Line* end = take_line(pipe, held, &count);
+        end->kind = LINE_END;
+        end->prompt = prompt;
+        end->expr = NULL;
+        end->array = NULL;
+        ring_push(&pipe->lexed, end);
+    }
+    for (uint32_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    pipeline_destroy(pipe);
+
+    DEBUG_FUNCTION_EXIT();
+    return started == 3;
+}
@@ -0,0 +1,604 @@
+#define _GNU_SOURCE // accept4
+#include "server.h"
+#include "array.h"
+#include "instructions.h"
+#include "symbolTable.h"
+#include "taskPool.h"
+#include "debug.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <mpfr.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVER_READ_BYTES (1u << 16) // per recv(), epoll is level triggered
+
+typedef struct ByteBuffer{
+    char* data;
+    size_t length, capacity;
+} ByteBuffer;
+
+typedef struct Request{
+    struct Request* next;
+    char text[]; // the line, NUL terminated
+} Request;
+
+typedef struct Session{
+    int fd;
+    App* app;
+    // Under server.lock, shared with the evaluation threads
+    Request* head;
+    Request* tail;
+    uint32_t queued;
+    ByteBuffer replies;        // framed replies the epoll thread has not taken yet
+    bool busy;                 // on the job queue or being evaluated
+    bool listed;               // on the done list
+    bool lost;                 // a reply could not be kept, the epoll thread closes it
+    struct Session* next_job;
+    struct Session* next_done;
+    // Epoll thread only
+    ByteBuffer in;             // received bytes that do not make a whole frame yet
+    ByteBuffer out;            // replies not sent yet
+    size_t sent;
+    uint32_t events;           // what epoll watches
+    bool eof;                  // the peer stopped sending, close once everything is answered
+    bool failed;               // socket error or bad frame, close as soon as it is idle
+    bool closed;               // freed after the current epoll batch
+    struct Session* prev;      // all sessions
+    struct Session* next;
+    struct Session* next_closed;
+} Session;
+
+static struct {
+    int epoll, listen, wake, signals;
+    bool tcp;
+    const char* unix_path;  // unlinked on exit
+    InstructionMap* commands;
+    pthread_mutex_t lock;   // job queue, done list and the shared part of every session
+    pthread_cond_t work;
+    pthread_mutex_t command_lock; // commands read their arguments with strtok
+    Session* jobs_head;
+    Session* jobs_tail;
+    Session* done;
+    bool stopping;
+    // Epoll thread only
+    Session* sessions;
+    Session* closing;
+} server = {
+    .epoll = -1, .listen = -1, .wake = -1, .signals = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+    .command_lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+_Thread_local FILE* errorOutput; // debug.h, set while a session's line runs
+
+// epoll_event.data of the descriptors that are not sessions
+static char listenTag, wakeTag, signalTag;
+
+// ##########################################
+// ######          Buffers              #####
+// ##########################################
+
+static bool buffer_reserve(ByteBuffer* buffer, size_t extra) {
+    if (buffer->length + extra <= buffer->capacity) return true;
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity < buffer->length + extra) capacity *= 2;
+    char* data = realloc(buffer->data, capacity);
+    CHECK_NULL(data, ERROR_RETURN(false, "Failed to grow a session buffer to %zu bytes\n", capacity));
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+// Length prefix, then 'prefix' and 'text' as one message
+static bool buffer_frame(ByteBuffer* buffer, const char* prefix, const char* text, size_t length) {
+    size_t prefix_length = strlen(prefix);
+    if (!buffer_reserve(buffer, 4 + prefix_length + length)) return false;
+    uint32_t total = (uint32_t)(prefix_length + length);
+    unsigned char* p = (unsigned char*)buffer->data + buffer->length;
+    p[0] = (unsigned char)(total >> 24);
+    p[1] = (unsigned char)(total >> 16);
+    p[2] = (unsigned char)(total >> 8);
+    p[3] = (unsigned char)total;
+    memcpy(p + 4, prefix, prefix_length);
+    if (length) memcpy(p + 4 + prefix_length, text, length);
+    buffer->length += 4 + total;
+    return true;
+}
+
+// ##########################################
+// ######     Evaluation threads        #####
+// ##########################################
+
+// Under server.lock
+static void session_list_done(Session* s) {
+    if (!s->listed) {
+        s->listed = true;
+        s->next_done = server.done;
+        server.done = s;
+    }
+    uint64_t one = 1;
+    if (write(server.wake, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        ERROR_PRINT("Failed to wake the epoll thread: %s\n", strerror(errno));
+    }
+}
+
+// Under server.lock
+static void session_push_job(Session* s) {
+    s->next_job = NULL;
+    if (server.jobs_tail) server.jobs_tail->next_job = s;
+    else server.jobs_head = s;
+    server.jobs_tail = s;
+    pthread_cond_signal(&server.work);
+}
+
+// Runs one line against the session and frames the reply into 'reply': what
+// it printed and its diagnostics, or only the diagnostics of a failure
+static bool session_evaluate(Session* s, char* text, ByteBuffer* reply) {
+    char* output = NULL;
+    size_t output_size = 0;
+    char* errors = NULL;
+    size_t errors_size = 0;
+    FILE* out = open_memstream(&output, &output_size);
+    FILE* err = out ? open_memstream(&errors, &errors_size) : NULL;
+    if (!err) {
+        if (out) fclose(out);
+        free(output);
+        return buffer_frame(reply, "ERR ", "out of memory\n", 14);
+    }
+
+    size_t length;
+    char* line = trim_line(text, &length);
+    print_set_output(out);
+    errorOutput = err;
+    bool ok = true;
+    bool command = false;
+    if (line[0] == '-') {
+        pthread_mutex_lock(&server.command_lock);
+        command = instruction_map_execute(server.commands, line, s->app, &ok);
+        pthread_mutex_unlock(&server.command_lock);
+    }
+    if (!command && line[0] != '\0') ok = evaluate_line(s->app, line, length);
+    print_set_output(NULL);
+    errorOutput = NULL;
+    // A line can succeed with diagnostics ("Division by zero"), they follow its output
+    if (ok && fflush(err) == 0 && errors_size) fwrite(errors, 1, errors_size, out);
+    ok = fclose(out) == 0 && ok;
+    ok = fclose(err) == 0 && ok;
+
+    bool framed;
+    if (ok) framed = buffer_frame(reply, "OK ", output, output_size);
+    else if (errors_size) framed = buffer_frame(reply, "ERR ", errors, errors_size);
+    else framed = buffer_frame(reply, "ERR ", "evaluation failed\n", 18);
+    free(output);
+    free(errors);
+    return framed;
+}
+
+static void* server_worker(void* arg) {
+    (void)arg;
+    ByteBuffer reply = { 0 };
+    pthread_mutex_lock(&server.lock);
+    for (;;) {
+        while (!server.jobs_head && !server.stopping) pthread_cond_wait(&server.work, &server.lock);
+        if (server.stopping) break;
+        Session* s = server.jobs_head;
+        server.jobs_head = s->next_job;
+        if (!server.jobs_head) server.jobs_tail = NULL;
+
+        Request* request = s->head;
+        if (request) {
+            s->head = request->next;
+            if (!s->head) s->tail = NULL;
+            s->queued--;
+            pthread_mutex_unlock(&server.lock);
+
+            reply.length = 0;
+            bool framed = session_evaluate(s, request->text, &reply);
+            free(request);
+
+            pthread_mutex_lock(&server.lock);
+            if (!framed || !buffer_reserve(&s->replies, reply.length)) {
+                s->lost = true; // the client would miss a reply, it is better closed
+            } else {
+                memcpy(s->replies.data + s->replies.length, reply.data, reply.length);
+                s->replies.length += reply.length;
+            }
+        }
+        // One request per turn, so a busy session cannot starve the others
+        if (s->head && !server.stopping) {
+            session_push_job(s);
+        } else {
+            s->busy = false;
+        }
+        session_list_done(s);
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    free(reply.data);
+    array_pool_free();
+    mpfr_free_cache();
+    return NULL;
+}
+
+// ##########################################
+// ######          Sessions             #####
+// ##########################################
+
+static void session_drop_requests(Session* s) {
+    while (s->head) {
+        Request* next = s->head->next;
+        free(s->head);
+        s->head = next;
+    }
+    s->tail = NULL;
+    s->queued = 0;
+}
+
+static void session_close(Session* s) {
+    if (s->closed) return;
+    s->closed = true;
+    epoll_ctl(server.epoll, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    s->next_closed = server.closing;
+    server.closing = s;
+}
+
+static void session_free(Session* s) {
+    if (!s->closed) {
+        epoll_ctl(server.epoll, EPOLL_CTL_DEL, s->fd, NULL);
+        close(s->fd);
+    }
+    if (s->prev) s->prev->next = s->next;
+    else server.sessions = s->next;
+    if (s->next) s->next->prev = s->prev;
+    session_drop_requests(s);
+    app_destroy(s->app);
+    free(s->replies.data);
+    free(s->in.data);
+    free(s->out.data);
+    free(s);
+}
+
+static void server_accept() {
+    for (;;) {
+        int fd = accept4(server.listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                ERROR_PRINT("accept failed: %s\n", strerror(errno));
+            }
+            return;
+        }
+        if (server.tcp) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        Session* s = calloc(1, sizeof(Session));
+        App* app = s ? app_create(SERVER_SESSION_CACHE) : NULL;
+        if (!app) {
+            ERROR_PRINT("Failed to create a session, closing the connection\n");
+            free(s);
+            close(fd);
+            continue;
+        }
+        app->parser->serial = true; // sessions run side by side instead
+        s->fd = fd;
+        s->app = app;
+        s->events = EPOLLIN;
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = s };
+        if (epoll_ctl(server.epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+            ERROR_PRINT("Failed to watch a connection: %s\n", strerror(errno));
+            app_destroy(app);
+            free(s);
+            close(fd);
+            continue;
+        }
+        s->next = server.sessions;
+        if (s->next) s->next->prev = s;
+        server.sessions = s;
+        DEBUG_PRINT("Session %d opened\n", fd);
+    }
+}
+
+static bool session_enqueue(Session* s, const char* text, uint32_t length) {
+    Request* request = malloc(sizeof(Request) + length + 1);
+    CHECK_NULL(request, ERROR_RETURN(false, "Failed to allocate a request of %u bytes\n", length));
+    request->next = NULL;
+    memcpy(request->text, text, length);
+    request->text[length] = '\0';
+
+    pthread_mutex_lock(&server.lock);
+    if (s->tail) s->tail->next = request;
+    else s->head = request;
+    s->tail = request;
+    s->queued++;
+    if (!s->busy) {
+        s->busy = true;
+        session_push_job(s);
+    }
+    pthread_mutex_unlock(&server.lock);
+    return true;
+}
+
+static void session_read(Session* s) {
+    if (!buffer_reserve(&s->in, SERVER_READ_BYTES)) {
+        s->failed = true;
+        return;
+    }
+    ssize_t n = recv(s->fd, s->in.data + s->in.length, s->in.capacity - s->in.length, 0);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) s->failed = true;
+        return;
+    }
+    if (n == 0) {
+        s->eof = true;
+        return;
+    }
+    s->in.length += (size_t)n;
+
+    size_t at = 0;
+    while (s->in.length - at >= 4) {
+        const unsigned char* p = (const unsigned char*)s->in.data + at;
+        uint32_t length = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        if (length > SERVER_MAX_MESSAGE) {
+            ERROR_PRINT("Session %d sent a %u byte message (limit %u), closing it\n",
+                        s->fd, length, SERVER_MAX_MESSAGE);
+            s->failed = true;
+            return;
+        }
+        if (s->in.length - at - 4 < length) break;
+        if (!session_enqueue(s, (const char*)p + 4, length)) {
+            s->failed = true;
+            return;
+        }
+        at += 4 + (size_t)length;
+    }
+    memmove(s->in.data, s->in.data + at, s->in.length - at);
+    s->in.length -= at;
+}
+
+static void session_write(Session* s) {
+    while (s->sent < s->out.length) {
+        ssize_t n = send(s->fd, s->out.data + s->sent, s->out.length - s->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) s->failed = true;
+            return;
+        }
+        s->sent += (size_t)n;
+    }
+    s->sent = s->out.length = 0;
+}
+
+// After any event: closes the session once nothing refers to it anymore, or
+// sets what epoll has to watch (no reads while too many requests wait)
+static void session_update(Session* s) {
+    pthread_mutex_lock(&server.lock);
+    if (s->failed) session_drop_requests(s);
+    bool idle = !s->busy && !s->listed;
+    uint32_t queued = s->queued;
+    pthread_mutex_unlock(&server.lock);
+
+    if (s->failed || (s->eof && idle && !s->out.length)) {
+        // An evaluation thread may still hold it, it comes back through the done list
+        if (idle) session_close(s);
+        else if (s->events) {
+            epoll_ctl(server.epoll, EPOLL_CTL_DEL, s->fd, NULL);
+            s->events = 0;
+        }
+        return;
+    }
+    uint32_t events = 0;
+    if (!s->eof && queued < SERVER_MAX_QUEUED) events |= EPOLLIN;
+    if (s->out.length) events |= EPOLLOUT;
+    if (events != s->events) {
+        struct epoll_event event = { .events = events, .data.ptr = s };
+        if (epoll_ctl(server.epoll, EPOLL_CTL_MOD, s->fd, &event) < 0) {
+            ERROR_PRINT("Failed to update session %d: %s\n", s->fd, strerror(errno));
+        }
+        s->events = events;
+    }
+}
+
+// Takes the replies the evaluation threads finished
+static void server_collect() {
+    uint64_t count;
+    if (read(server.wake, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        ERROR_PRINT("Failed to read the wake counter: %s\n", strerror(errno));
+    }
+    for (;;) {
+        pthread_mutex_lock(&server.lock);
+        Session* s = server.done;
+        if (!s) {
+            pthread_mutex_unlock(&server.lock);
+            return;
+        }
+        server.done = s->next_done;
+        s->listed = false;
+        if (s->lost) s->failed = true;
+        if (s->replies.length && !s->failed) {
+            if (buffer_reserve(&s->out, s->replies.length)) {
+                memcpy(s->out.data + s->out.length, s->replies.data, s->replies.length);
+                s->out.length += s->replies.length;
+            } else {
+                s->failed = true;
+            }
+        }
+        s->replies.length = 0;
+        pthread_mutex_unlock(&server.lock);
+
+        if (!s->failed && !s->closed) session_write(s);
+        session_update(s);
+    }
+}
+
+// ##########################################
+// ######            Server             #####
+// ##########################################
+
+static int server_listen(const char* address) {
+    int fd;
+    if (strncmp(address, "tcp:", 4) == 0) {
+        char* end;
+        long port = strtol(address + 4, &end, 10);
+        if (*end != '\0' || port <= 0 || port > 65535) ERROR_RETURN(-1, "Invalid TCP port in '%s'\n", address);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) ERROR_RETURN(-1, "socket failed: %s\n", strerror(errno));
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        // Loopback only, there is no authentication
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            ERROR_PRINT("Cannot bind 127.0.0.1:%ld: %s\n", port, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        server.tcp = true;
+    } else {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(address) >= sizeof(addr.sun_path)) ERROR_RETURN(-1, "Socket path too long: '%s'\n", address);
+        strcpy(addr.sun_path, address);
+        // A socket left by an earlier run, never any other kind of file
+        struct stat st;
+        if (stat(address, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(address);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) ERROR_RETURN(-1, "socket failed: %s\n", strerror(errno));
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            ERROR_PRINT("Cannot bind '%s': %s\n", address, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        server.unix_path = address;
+    }
+    if (listen(fd, SERVER_BACKLOG) < 0) {
+        ERROR_PRINT("listen failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool server_watch(int fd, void* tag) {
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = tag };
+    if (epoll_ctl(server.epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+        ERROR_RETURN(false, "epoll_ctl failed: %s\n", strerror(errno));
+    }
+    return true;
+}
+
+static void server_close() {
+    while (server.sessions) session_free(server.sessions);
+    if (server.commands) instruction_map_destroy(server.commands);
+    if (server.listen >= 0) close(server.listen);
+    if (server.unix_path) unlink(server.unix_path);
+    if (server.wake >= 0) close(server.wake);
+    if (server.signals >= 0) close(server.signals);
+    if (server.epoll >= 0) close(server.epoll);
+    array_pool_free();
+}
+
+int server_run(const char* address) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(address, ERROR_RETURN(1, "Server address is NULL\n"));
+
+    // Only the epoll thread sees SIGINT/SIGTERM, through the signalfd
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    server.commands = instruction_map_session();
+    server.epoll = epoll_create1(EPOLL_CLOEXEC);
+    server.wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.signals = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    server.listen = server_listen(address);
+    if (!server.commands || server.epoll < 0 || server.wake < 0 || server.signals < 0 || server.listen < 0 ||
+        !server_watch(server.listen, &listenTag) || !server_watch(server.wake, &wakeTag) ||
+        !server_watch(server.signals, &signalTag)) {
+        ERROR_PRINT("Failed to start the server on '%s'\n", address);
+        server_close();
+        return 1;
+    }
+
+    uint32_t count = task_pool_cpu_count();
+    pthread_t* threads = calloc(count, sizeof(pthread_t));
+    CHECK_NULL(threads, {
+        server_close();
+        ERROR_RETURN(1, "Failed to allocate the evaluation threads\n");
+    });
+    uint32_t started = 0;
+    while (started < count && pthread_create(&threads[started], NULL, server_worker, NULL) == 0) started++;
+    if (!started) {
+        free(threads);
+        server_close();
+        ERROR_RETURN(1, "Failed to start any evaluation thread\n");
+    }
+
+    printf("Serving on %s with %u evaluation threads\n", address, started);
+    fflush(stdout);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    bool run = true;
+    while (run) {
+        int n = epoll_wait(server.epoll, events, SERVER_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ERROR_PRINT("epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &listenTag) {
+                server_accept();
+            } else if (tag == &wakeTag) {
+                server_collect();
+            } else if (tag == &signalTag) {
+                run = false;
+            } else {
+                Session* s = tag;
+                if (s->closed) continue;
+                if (events[i].events & EPOLLIN) session_read(s);
+                else if (events[i].events & (EPOLLERR | EPOLLHUP)) s->failed = true;
+                if (!s->failed && (events[i].events & EPOLLOUT)) session_write(s);
+                session_update(s);
+            }
+        }
+        // Freed only now, a later event of the same batch may still name them
+        while (server.closing) {
+            Session* s = server.closing;
+            server.closing = s->next_closed;
+            DEBUG_PRINT("Session %d closed\n", s->fd);
+            session_free(s);
+        }
+    }
+
+    // Requests still queued are dropped, evaluations in progress finish first
+    printf("Shutting down\n");
+    pthread_mutex_lock(&server.lock);
+    server.stopping = true;
+    pthread_cond_broadcast(&server.work);
+    pthread_mutex_unlock(&server.lock);
+    for (uint32_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    server_close();
+
+    DEBUG_FUNCTION_EXIT();
+    return 0;
+}
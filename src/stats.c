@@ -0,0 +1,126 @@
+#include "stats.h"
+#include "debug.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char* const stageNames[STAT_STAGES] = {
+    "tokenize", "parse", "evaluate", "output"
+};
+
+static inline uint32_t bucket_index(uint64_t ns) {
+    if (ns < 2 * STATS_SUB_BUCKETS) return (uint32_t)ns;
+    if (ns >> STATS_HISTOGRAM_BITS) ns = (1ULL << STATS_HISTOGRAM_BITS) - 1;
+    uint32_t shift = 63 - __builtin_clzll(ns) - 4; // keeps the top 5 bits, 1xxxx
+    return shift * STATS_SUB_BUCKETS + (uint32_t)(ns >> shift);
+}
+
+// Highest value that lands in 'index'
+static inline uint64_t bucket_value(uint32_t index) {
+    if (index < 2 * STATS_SUB_BUCKETS) return index;
+    uint32_t shift = index / STATS_SUB_BUCKETS - 1;
+    return (((uint64_t)(index - shift * STATS_SUB_BUCKETS) + 1) << shift) - 1;
+}
+
+static uint64_t percentile(const Histogram* h, double q) {
+    uint64_t target = (uint64_t)(q * h->count + 0.5);
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < STATS_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) return bucket_value(i) < h->max ? bucket_value(i) : h->max;
+    }
+    return h->max;
+}
+
+static const char* format_ns(char* buffer, size_t size, uint64_t ns) {
+    if (ns < 1000) snprintf(buffer, size, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000) snprintf(buffer, size, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(buffer, size, "%.2fms", ns / 1e6);
+    else snprintf(buffer, size, "%.2fs", ns / 1e9);
+    return buffer;
+}
+
+Stats* stats_create() {
+    Stats* stats = calloc(1, sizeof(Stats));
+    CHECK_NULL(stats, ERROR_RETURN_NULL("Failed to allocate Stats"));
+    return stats;
+}
+
+void stats_destroy(Stats* stats) {
+    free(stats);
+}
+
+void stats_reset(Stats* stats) {
+    CHECK_NULL(stats, return);
+    memset(stats, 0, sizeof(Stats));
+}
+
+uint64_t stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void stats_record(Stats* stats, StatStage stage, uint64_t ns) {
+    Histogram* h = &stats->stages[stage];
+    h->buckets[bucket_index(ns)]++;
+    h->count++;
+    h->total += ns;
+    if (ns > h->max) h->max = ns;
+}
+
+void stats_add_ops(Stats* stats, long precision, const uint64_t* counts, uint32_t kinds) {
+    uint32_t bits = 0;
+    while (bits < 63 && (1L << bits) < precision) bits++;
+    uint32_t cls = bits > STATS_PREC_MIN_BITS ? bits - STATS_PREC_MIN_BITS : 0;
+    if (cls >= STATS_PREC_CLASSES) cls = STATS_PREC_CLASSES - 1;
+    if (kinds > STATS_OP_KINDS) kinds = STATS_OP_KINDS;
+    for (uint32_t k = 0; k < kinds; k++) stats->ops[cls][k] += counts[k];
+}
+
+void stats_show(const Stats* stats, const char* const* op_names, uint32_t kinds) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(stats, return);
+
+    printf("Lines: %llu (%llu from the expression cache)\n",
+           (unsigned long long)stats->lines, (unsigned long long)stats->cache_hits);
+    printf("%-9s %9s %9s %9s %9s %9s %9s %9s\n",
+           "stage", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    char cells[6][16];
+    for (uint32_t s = 0; s < STAT_STAGES; s++) {
+        const Histogram* h = &stats->stages[s];
+        if (!h->count) {
+            printf("%-9s %9s\n", stageNames[s], "0");
+            continue;
+        }
+        printf("%-9s %9llu %9s %9s %9s %9s %9s %9s\n", stageNames[s], (unsigned long long)h->count,
+               format_ns(cells[0], sizeof(cells[0]), h->total / h->count),
+               format_ns(cells[1], sizeof(cells[1]), percentile(h, 0.50)),
+               format_ns(cells[2], sizeof(cells[2]), percentile(h, 0.90)),
+               format_ns(cells[3], sizeof(cells[3]), percentile(h, 0.99)),
+               format_ns(cells[4], sizeof(cells[4]), percentile(h, 0.999)),
+               format_ns(cells[5], sizeof(cells[5]), h->max));
+    }
+
+    if (kinds > STATS_OP_KINDS) kinds = STATS_OP_KINDS;
+    bool any = false;
+    for (uint32_t c = 0; c < STATS_PREC_CLASSES; c++) {
+        bool header = false;
+        for (uint32_t k = 0; k < kinds; k++) {
+            if (!stats->ops[c][k] || !op_names[k]) continue;
+            if (!header) {
+                if (!any) printf("Evaluated nodes by precision:\n");
+                printf("  <= %ld bits:", 1L << (c + STATS_PREC_MIN_BITS));
+                header = any = true;
+            }
+            printf(" %s %llu", op_names[k], (unsigned long long)stats->ops[c][k]);
+        }
+        if (header) printf("\n");
+    }
+    if (!any) printf("No nodes evaluated yet\n");
+    DEBUG_FUNCTION_EXIT();
+}
@@ -1,7 +1,9 @@
 #include "symbolTable.h"
+#include "array.h"
 #include "debug.h"
 #include <assert.h>
 #include <gmp.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -23,7 +25,7 @@ static inline uint32_t hash_string(const char* str, size_t len) {
     return hash;
 }
 
-static void symbol_table_debug_bucket(SymbolTable* table, uint16_t bucket_index);
+static void symbol_table_debug_bucket(SymbolTable* table, uint32_t bucket_index);
 static void symbol_table_debug_show(SymbolTable* table);
 static void symbol_table_debug_stats(SymbolTable* table);
 
@@ -33,7 +35,7 @@ static void symbol_table_debug_stats(SymbolTable* table);
 
 
 #ifdef DEBUG
-static void symbol_table_debug_bucket(SymbolTable* table, uint16_t bucket_index) {
+static void symbol_table_debug_bucket(SymbolTable* table, uint32_t bucket_index) {
     DEBUG_PRINT("=== BUCKET %d DEBUG ===\n", bucket_index);
     
     if (bucket_index >= table->capacity) {
@@ -51,7 +53,7 @@ static void symbol_table_debug_bucket(SymbolTable* table, uint16_t bucket_index)
     int position = 0;
     while (current) {
         char value_str[100];
-        mpfr_sprintf(value_str, "%.15Rf", current->num);
+        mpfr_snprintf(value_str, sizeof(value_str), "%.15Rg", current->num);
         DEBUG_PRINT("Position %d: %s = %s\n", 
                    position, current->name, value_str);
         DEBUG_PRINT("  Hash: %u, Length: %d, Next: %p\n",
@@ -69,7 +71,7 @@ static void symbol_table_debug_show(SymbolTable* table) {
                 (float)table->count / table->capacity * 100);
     
     int total_buckets_used = 0;
-    for (uint16_t i = 0; i < table->capacity; i++) {
+    for (uint32_t i = 0; i < table->capacity; i++) {
         if (table->buckets[i]) {
             total_buckets_used++;
             DEBUG_PRINT("Bucket %3d: ", i);
@@ -77,7 +79,7 @@ static void symbol_table_debug_show(SymbolTable* table) {
             int chain_length = 0;
             while (current) {
                 char value_str[100];
-                mpfr_sprintf(value_str, "%.10Rf", current->num);
+                mpfr_snprintf(value_str, sizeof(value_str), "%.10Rg", current->num);
                 DEBUG_PRINT("%s=%s", current->name, value_str);
                 current = current->next;
                 chain_length++;
@@ -101,7 +103,7 @@ static void symbol_table_debug_stats(SymbolTable* table) {
     int non_empty_buckets = 0;
     int total_symbols = 0;
     
-    for (uint16_t i = 0; i < table->capacity; i++) {
+    for (uint32_t i = 0; i < table->capacity; i++) {
         if (table->buckets[i] == NULL) {
             empty_buckets++;
         } else {
@@ -135,7 +137,7 @@ static void symbol_table_debug_stats(SymbolTable* table) {
     DEBUG_PRINT("===============================\n");
 }
 #else
-static void symbol_table_debug_bucket(SymbolTable* table, uint16_t bucket_index){}
+static void symbol_table_debug_bucket(SymbolTable* table, uint32_t bucket_index){}
 static void symbol_table_debug_show(SymbolTable* table){}
 static void symbol_table_debug_stats(SymbolTable* table){}
 #endif
@@ -150,6 +152,11 @@ SymbolTable* symbol_table_create() {
     
     sym->capacity = SYMBOL_MAP_BASE_SIZE;
     sym->count = 0;
+    sym->array_count = 0;
+    sym->precision = PRECISION_ROUNDING_BITS;
+    sym->chunks = sym->last_chunk = NULL;
+    sym->names = NULL;
+    sym->limbs = NULL;
     sym->buckets = calloc(SYMBOL_MAP_BASE_SIZE, sizeof(Symbol*));
     CHECK_NULL(sym->buckets, {
         free(sym);
@@ -215,13 +222,65 @@ static inline void symbol_table_resize(SymbolTable* table, size_t new_capacity)
     DEBUG_FUNCTION_EXIT();
 }
 
+static Symbol* symbol_alloc(SymbolTable* table) {
+    SymbolChunk* chunk = table->last_chunk;
+    if (!chunk || chunk->used == chunk->size) {
+        uint32_t size = chunk ? chunk->size << 1 : SYMBOL_CHUNK_MIN;
+        if (size > SYMBOL_CHUNK_MAX) size = SYMBOL_CHUNK_MAX;
+        SymbolChunk* grown = malloc(sizeof(SymbolChunk) + size * sizeof(Symbol));
+        CHECK_NULL(grown, ERROR_RETURN_NULL("Failed to allocate a symbol chunk"));
+        grown->next = NULL;
+        grown->used = 0;
+        grown->size = size;
+        if (chunk) chunk->next = grown;
+        else table->chunks = grown;
+        table->last_chunk = chunk = grown;
+    }
+    return &chunk->symbols[chunk->used++];
+}
+
+static char* name_alloc(SymbolTable* table, const char* name, uint8_t len) {
+    NameChunk* chunk = table->names;
+    if (!chunk || chunk->size - chunk->used < (uint32_t)len + 1) {
+        chunk = malloc(sizeof(NameChunk) + NAME_CHUNK_BYTES);
+        CHECK_NULL(chunk, ERROR_RETURN_NULL("Failed to allocate a name chunk"));
+        chunk->next = table->names;
+        chunk->used = 0;
+        chunk->size = NAME_CHUNK_BYTES;
+        table->names = chunk;
+    }
+    char* copy = chunk->data + chunk->used;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    chunk->used += len + 1;
+    return copy;
+}
+
+// Significand storage for a value of 'precision' bits
+static mp_limb_t* limb_alloc(SymbolTable* table, mpfr_prec_t precision) {
+    size_t count = mpfr_custom_get_size(precision) / sizeof(mp_limb_t);
+    LimbChunk* chunk = table->limbs;
+    if (!chunk || chunk->size - chunk->used < count) {
+        size_t size = count > LIMB_CHUNK_LIMBS ? count : LIMB_CHUNK_LIMBS;
+        chunk = malloc(sizeof(LimbChunk) + size * sizeof(mp_limb_t));
+        CHECK_NULL(chunk, ERROR_RETURN_NULL("Failed to allocate a limb chunk"));
+        chunk->next = table->limbs;
+        chunk->used = 0;
+        chunk->size = size;
+        table->limbs = chunk;
+    }
+    mp_limb_t* limbs = chunk->limbs + chunk->used;
+    chunk->used += count;
+    return limbs;
+}
+
 mpfr_t* symbol_table_insert(SymbolTable* table, const char* name, const mpfr_t* num, uint8_t nameLen) {
     DEBUG_FUNCTION_ENTER();
     CHECK_NULL(table, ERROR_RETURN_NULL("Table is NULL"));
     CHECK_NULL(name, ERROR_RETURN_NULL("Variable name is NULL"));
     CHECK_NULL(num, ERROR_RETURN_NULL("MPFR value is NULL"));
     
-    DEBUG_PRINT("Insert operation: '%s' (length: %d)\n", name, nameLen);
+    DEBUG_PRINT("Insert operation: '%.*s' (length: %d)\n", nameLen, name, nameLen);
     DEBUG_MPFR_VALUE(*num, "Input value");
     
     // Check if resizing is needed
@@ -236,24 +295,41 @@ mpfr_t* symbol_table_insert(SymbolTable* table, const char* name, const mpfr_t*
     
     Symbol* current = table->buckets[index];
     Symbol* prev = NULL;
-    uint16_t position = 0;
+    uint32_t position = 0;
     
     // Search for existing symbol
     while (current) {
-        if (current->len == nameLen && strcmp(current->name, name) == 0) {
+        if (current->len == nameLen && memcmp(current->name, name, nameLen) == 0) {
             DEBUG_PRINT("Found existing symbol at bucket %d, position %d\n", index, position);
             
+#ifdef DEBUG
             char old_value[100], new_value[100];
-            mpfr_sprintf(old_value, "%.15Rf", current->num);
-            mpfr_sprintf(new_value, "%.15Rf", *num);
+            mpfr_snprintf(old_value, sizeof(old_value), "%.15Rg", current->num);
+            mpfr_snprintf(new_value, sizeof(new_value), "%.15Rg", *num);
             
             DEBUG_PRINT("Updating value: %s -> %s\n", old_value, new_value);
+#endif
             
-            mpfr_clear(current->num);
-            mpfr_init2(current->num, PRECISION_ROUNDING_BITS);
+            if (current->array) {
+                array_release(current->array);
+                current->array = NULL;
+                table->array_count--;
+            }
+            // Same precision -> written in place. Limbs only get replaced when
+            // the session precision grew past what they hold.
+            mpfr_prec_t held = mpfr_get_prec(current->num);
+            if (held != table->precision) {
+                mp_limb_t* limbs = mpfr_custom_get_significand(current->num);
+                if (mpfr_custom_get_size(table->precision) > mpfr_custom_get_size(held)) {
+                    // Keeps the old value when no limbs are left
+                    limbs = limb_alloc(table, table->precision);
+                    CHECK_NULL(limbs, ERROR_RETURN_NULL("Failed to allocate limbs for '%.*s'\n", nameLen, name));
+                }
+                mpfr_custom_init_set(current->num, MPFR_NAN_KIND, 0, table->precision, limbs);
+            }
             mpfr_set(current->num, *num, MPFR_RNDN);
             
-            DEBUG_SYMBOL_OP("updated", name, current->num);
+            DEBUG_SYMBOL_OP("updated", current->name, current->num);
             DEBUG_FUNCTION_EXIT();
             return &current->num;
         }
@@ -262,20 +338,20 @@ mpfr_t* symbol_table_insert(SymbolTable* table, const char* name, const mpfr_t*
         position++;
     }
     
-    DEBUG_PRINT("Creating new symbol '%s' in bucket %d\n", name, index);
+    DEBUG_PRINT("Creating new symbol '%.*s' in bucket %d\n", nameLen, name, index);
     
-    // Create new symbol
-    Symbol* new_symbol = malloc(sizeof(Symbol));
+    // Create new symbol, the name and the limbs go first so a failure leaves no half symbol
+    mp_limb_t* limbs = limb_alloc(table, table->precision);
+    CHECK_NULL(limbs, ERROR_RETURN_NULL("Failed to allocate limbs for '%.*s'\n", nameLen, name));
+    char* copy = name_alloc(table, name, nameLen);
+    CHECK_NULL(copy, ERROR_RETURN_NULL("Failed to store symbol name"));
+    Symbol* new_symbol = symbol_alloc(table);
     CHECK_NULL(new_symbol, ERROR_RETURN_NULL("Failed to allocate new symbol"));
-    
-    new_symbol->name = strdup(name);
-    CHECK_NULL(new_symbol->name, {
-        free(new_symbol);
-        ERROR_RETURN_NULL("Failed to duplicate symbol name");
-    });
+    new_symbol->name = copy;
     
     new_symbol->len = nameLen;
-    mpfr_init2(new_symbol->num, PRECISION_ROUNDING_BITS);
+    new_symbol->array = NULL;
+    mpfr_custom_init_set(new_symbol->num, MPFR_NAN_KIND, 0, table->precision, limbs);
     mpfr_set(new_symbol->num, *num, MPFR_RNDN);
     
     // Insert at head of bucket chain
@@ -283,7 +359,7 @@ mpfr_t* symbol_table_insert(SymbolTable* table, const char* name, const mpfr_t*
     table->buckets[index] = new_symbol;
     table->count++;
     
-    DEBUG_SYMBOL_OP("inserted", name, new_symbol->num);
+    DEBUG_SYMBOL_OP("inserted", new_symbol->name, new_symbol->num);
     DEBUG_PRINT("Total symbols now: %d\n", table->count);
     DEBUG_SHOW_TABLE(table);
     
@@ -296,7 +372,7 @@ mpfr_t* symbol_table_get(SymbolTable* table, const char* name, uint8_t nameLen)
     CHECK_NULL(table, ERROR_RETURN_NULL("Table is NULL"));
     CHECK_NULL(name, ERROR_RETURN_NULL("Variable name is NULL"));
     
-    DEBUG_PRINT("Lookup operation: '%s' (length: %d)\n", name, nameLen);
+    DEBUG_PRINT("Lookup operation: '%.*s' (length: %d)\n", nameLen, name, nameLen);
     
     uint32_t index = hash_string(name, nameLen) % table->capacity;
     DEBUG_PRINT("Hash index calculated: %u\n", index);
@@ -305,9 +381,9 @@ mpfr_t* symbol_table_get(SymbolTable* table, const char* name, uint8_t nameLen)
     int position = 0;
     
     while (current) {
-        if (current->len == nameLen && strcmp(current->name, name) == 0) {
+        if (current->len == nameLen && memcmp(current->name, name, nameLen) == 0) {
             DEBUG_PRINT("Found symbol at bucket %d, position %d\n", index, position);
-            DEBUG_SYMBOL_OP("retrieved", name, current->num);
+            DEBUG_SYMBOL_OP("retrieved", current->name, current->num);
             DEBUG_FUNCTION_EXIT();
             return &current->num;
         }
@@ -315,44 +391,497 @@ mpfr_t* symbol_table_get(SymbolTable* table, const char* name, uint8_t nameLen)
         position++;
     }
     
-    DEBUG_PRINT("Symbol '%s' not found in table\n", name);
-    WARNING_PRINT("Undefined variable: '%s'\n", name);
+    DEBUG_PRINT("Symbol '%.*s' not found in table\n", nameLen, name);
+    WARNING_PRINT("Undefined variable: '%.*s'\n", nameLen, name);
     DEBUG_FUNCTION_EXIT();
     return NULL;
 }
 
+Symbol* symbol_table_find(SymbolTable* table, const char* name, uint8_t nameLen) {
+    CHECK_NULL(table, ERROR_RETURN_NULL("Table is NULL"));
+    CHECK_NULL(name, ERROR_RETURN_NULL("Variable name is NULL"));
+
+    Symbol* current = table->buckets[hash_string(name, nameLen) % table->capacity];
+    while (current) {
+        if (current->len == nameLen && memcmp(current->name, name, nameLen) == 0) return current;
+        current = current->next;
+    }
+    return NULL;
+}
+
+Symbol* symbol_table_insert_array(SymbolTable* table, const char* name, Array* array, uint8_t nameLen) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(table, ERROR_RETURN_NULL("Table is NULL"));
+    CHECK_NULL(array, ERROR_RETURN_NULL("Vector is NULL"));
+
+    Symbol* symbol = symbol_table_find(table, name, nameLen);
+    if (!symbol) {
+        // A new name goes through the scalar path first, then holds the vector
+        mpfr_t zero;
+        mpfr_init2(zero, MPFR_PREC_MIN);
+        mpfr_set_zero(zero, 1);
+        CHECK_NULL(symbol_table_insert(table, name, &zero, nameLen), {
+            mpfr_clear(zero);
+            ERROR_RETURN_NULL("Failed to insert vector '%.*s'", nameLen, name);
+        });
+        mpfr_clear(zero);
+        symbol = symbol_table_find(table, name, nameLen);
+    }
+
+    array->refs++;
+    if (symbol->array) array_release(symbol->array);
+    else table->array_count++;
+    symbol->array = array;
+
+    DEBUG_PRINT("Vector stored: '%s' (%u elements)\n", symbol->name, array->len);
+    DEBUG_FUNCTION_EXIT();
+    return symbol;
+}
+
+// Grows the buckets once so 'count' more symbols fit without a resize
+void symbol_table_reserve(SymbolTable* table, uint32_t count) {
+    CHECK_NULL(table, return);
+    uint64_t needed = (uint64_t)table->count + count;
+    uint64_t capacity = table->capacity;
+    while (needed > capacity * THRESHOLD_MAP) capacity <<= 1;
+    if (capacity > UINT32_MAX) capacity = (uint64_t)1 << 31;
+    if (capacity != table->capacity) symbol_table_resize(table, capacity);
+}
+
+// #### SNAPSHOTS ####
+// "MSYM", version, symbol count, then per symbol: name length, name, kind and
+// the values in MPFR's portable binary format. Integers are little-endian.
+
+static bool write_u32(FILE* out, uint32_t value) {
+    uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+    return fwrite(bytes, 1, 4, out) == 4;
+}
+
+static bool read_u32(FILE* in, uint32_t* value) {
+    uint8_t bytes[4];
+    if (fread(bytes, 1, 4, in) != 4) return false;
+    *value = bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+    return true;
+}
+
+static bool save_symbol(FILE* out, const Symbol* symbol, mpfr_t element) {
+    uint8_t kind = !symbol->array ? SNAPSHOT_SCALAR : symbol->array->rows ? SNAPSHOT_MATRIX : SNAPSHOT_VECTOR;
+    if (fputc(symbol->len, out) == EOF || fwrite(symbol->name, 1, symbol->len, out) != symbol->len ||
+        fputc(kind, out) == EOF) return false;
+    if (kind == SNAPSHOT_SCALAR) return mpfr_fpif_export(out, (mpfr_ptr)symbol->num) == 0;
+
+    const Array* array = symbol->array;
+    if (kind == SNAPSHOT_MATRIX) {
+        if (!write_u32(out, array->rows) || !write_u32(out, array->cols)) return false;
+    } else if (!write_u32(out, array->len)) {
+        return false;
+    }
+    mpfr_set_prec(element, array->storage == ARRAY_DOUBLE ? ARRAY_DOUBLE_MAX_PRECISION : array->precision);
+    for (uint32_t i = 0; i < array->len; i++) {
+        array_get(array, i, element);
+        if (mpfr_fpif_export(out, element) != 0) return false;
+    }
+    return true;
+}
+
+bool symbol_table_save(SymbolTable* table, FILE* out) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(table, ERROR_RETURN(false, "Table is NULL"));
+    CHECK_NULL(out, ERROR_RETURN(false, "Output stream is NULL"));
+
+    bool ok = fwrite(SNAPSHOT_MAGIC, 1, 4, out) == 4 && fputc(SNAPSHOT_VERSION, out) != EOF &&
+              write_u32(out, table->count);
+    mpfr_t element;
+    mpfr_init2(element, table->precision);
+    for (SymbolChunk* chunk = table->chunks; ok && chunk; chunk = chunk->next) {
+        for (uint32_t i = 0; ok && i < chunk->used; i++) ok = save_symbol(out, &chunk->symbols[i], element);
+    }
+    mpfr_clear(element);
+
+    DEBUG_PRINT("Snapshot saved: %u symbols\n", table->count);
+    DEBUG_FUNCTION_EXIT();
+    return ok && !ferror(out);
+}
+
+// Reads one record. With a NULL 'table' the values are only decoded, which
+// checks the record without storing anything.
+static bool load_array(SymbolTable* table, FILE* in, uint8_t kind, const char* name, uint8_t len, mpfr_t element) {
+    uint32_t rows = 0, cols;
+    if (kind == SNAPSHOT_MATRIX && !read_u32(in, &rows)) return false;
+    if (!read_u32(in, &cols) || !cols || (kind == SNAPSHOT_MATRIX && !rows)) return false;
+    uint64_t count = rows ? (uint64_t)rows * cols : cols;
+    if (!table) {
+        for (uint64_t i = 0; i < count; i++) {
+            if (mpfr_fpif_import(element, in) != 0) return false;
+        }
+        return true;
+    }
+
+    Array* array = rows ? array_create_matrix(rows, cols, table->precision) : array_create(cols, table->precision);
+    CHECK_NULL(array, return false);
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < array->len; i++) {
+        ok = mpfr_fpif_import(element, in) == 0;
+        if (ok) array_set(array, i, element);
+    }
+    ok = ok && symbol_table_insert_array(table, name, array, len) != NULL;
+    array_release(array);
+    return ok;
+}
+
+static bool load_symbol(SymbolTable* table, FILE* in, mpfr_t* value) {
+    char name[TOKEN_LEXEME_LEN_LIMIT + 1];
+    int len = fgetc(in);
+    if (len <= 0 || fread(name, 1, len, in) != (size_t)len) return false;
+    int kind = fgetc(in);
+    name[len] = '\0';
+
+    if (kind == SNAPSHOT_SCALAR) {
+        if (mpfr_fpif_import(*value, in) != 0) return false;
+        return !table || symbol_table_insert(table, name, value, len) != NULL;
+    }
+    if (kind == SNAPSHOT_VECTOR || kind == SNAPSHOT_MATRIX) return load_array(table, in, kind, name, len, *value);
+    return false;
+}
+
+bool symbol_table_load(SymbolTable* table, FILE* in, uint32_t* loaded) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(table, ERROR_RETURN(false, "Table is NULL"));
+    CHECK_NULL(in, ERROR_RETURN(false, "Input stream is NULL"));
+    if (loaded) *loaded = 0;
+
+    char magic[4];
+    uint32_t count;
+    if (fread(magic, 1, 4, in) != 4 || memcmp(magic, SNAPSHOT_MAGIC, 4) != 0 ||
+        fgetc(in) != SNAPSHOT_VERSION || !read_u32(in, &count)) {
+        ERROR_RETURN(false, "Not a variable snapshot (version %d)\n", SNAPSHOT_VERSION);
+    }
+    long records = ftell(in);
+    if (records < 0) ERROR_RETURN(false, "Snapshots are read twice, the input cannot be rewound\n");
+
+    mpfr_t value;
+    mpfr_init2(value, table->precision);
+
+    // The whole file is checked before the first insert, so a truncated or
+    // corrupt snapshot leaves the table as it was
+    uint32_t done = 0;
+    while (done < count && load_symbol(NULL, in, &value)) done++;
+    bool ok = done == count;
+    if (!ok) {
+        ERROR_PRINT("Snapshot is truncated or corrupt after %u of %u symbols, nothing was loaded\n", done, count);
+    } else if (fseek(in, records, SEEK_SET) != 0) {
+        ok = false;
+        ERROR_PRINT("Failed to rewind the snapshot, nothing was loaded\n");
+    } else {
+        // The count is proven by the file now, reserving it is safe
+        symbol_table_reserve(table, count);
+        for (done = 0; ok && done < count; done++) ok = load_symbol(table, in, &value);
+        if (!ok) ERROR_PRINT("Snapshot stopped loading at symbol %u of %u, the earlier ones were loaded\n", done, count);
+        else if (loaded) *loaded = count;
+    }
+    mpfr_clear(value);
+
+    DEBUG_PRINT("Snapshot loaded: %u symbols\n", ok ? count : 0);
+    DEBUG_FUNCTION_EXIT();
+    return ok;
+}
+
 void print_friendly_mpfr(mpfr_t value, const char* label) {
-    if (label) printf("%s: ", label);
-    
-    if (mpfr_nan_p(value)) {
-        printf("NaN\n");
+    FILE* out = print_output();
+    if (label) fprintf(out, "%s: ", label);
+    print_friendly_mpfr_inline(value);
+    fputc('\n', out);
+}
+
+static uint8_t outputBase = 10;
+static _Thread_local FILE* printOutput; // NULL -> stdout
+
+FILE* print_output() {
+    return printOutput ? printOutput : stdout;
+}
+
+void print_set_output(FILE* out) {
+    printOutput = out;
+}
+
+void print_friendly_mpfr_inline(mpfr_t value) {
+    if (outputBase != 10 && mpfr_number_p(value)) {
+        print_mpfr_base(value, outputBase);
         return;
     }
-    if (mpfr_inf_p(value)) {
-        printf("%sInfinity\n", mpfr_signbit(value) ? "-" : "");
+    char buffer[FRIENDLY_MPFR_SIZE];
+    format_friendly_mpfr(buffer, sizeof(buffer), value);
+    fputs(buffer, print_output());
+}
+
+bool print_friendly_set_base(uint8_t base) {
+    if (base != 2 && base != 8 && base != 10 && base != 16) return false;
+    outputBase = base;
+    return true;
+}
+
+uint8_t print_friendly_base() {
+    return outputBase;
+}
+
+// Digits of 'z' in base 2^bits, most significant first, read straight from
+// its limbs: linear in the size of z whatever the base.
+static char* put_limb_digits(char* out, const mpz_t z, uint64_t count, uint8_t bits) {
+    static const char digitChars[] = "0123456789abcdef";
+    for (uint64_t i = count; i-- > 0;) {
+        uint64_t bit = i * bits;
+        mp_size_t limb = bit / GMP_NUMB_BITS;
+        unsigned shift = bit % GMP_NUMB_BITS;
+        mp_limb_t digit = mpz_getlimbn(z, limb) >> shift;
+        if (shift + bits > GMP_NUMB_BITS) digit |= mpz_getlimbn(z, limb + 1) << (GMP_NUMB_BITS - shift);
+        *out++ = digitChars[digit & ((1u << bits) - 1)];
+    }
+    return out;
+}
+
+void print_mpfr_base(mpfr_t value, uint8_t base) {
+    uint8_t bits = base == 16 ? 4 : base == 8 ? 3 : 1;
+    const char* prefix = base == 16 ? "0x" : base == 8 ? "0o" : "0b";
+    const char* sign = mpfr_signbit(value) ? "-" : "";
+    if (mpfr_zero_p(value)) {
+        fprintf(print_output(), "%s%s0", sign, prefix);
         return;
     }
-    
-    // Choose the best format automatically
-    mpfr_exp_t exponent;
-    char* str = mpfr_get_str(NULL, &exponent, 10, 0, value, MPFR_RNDN);
-    
-    if (str && strlen(str) > 0) {
-        if (exponent < -3 || exponent > 6) {
-            // Use scientific notation for very small or very large numbers
-            mpfr_printf("%.10Re\n", value);
-        } else {
-            // Use fixed point for normal numbers
-            int digits_after_decimal = 10 - exponent;
-            if (digits_after_decimal < 0) digits_after_decimal = 0;
-            if (digits_after_decimal > 10) digits_after_decimal = 10;
-            
-            mpfr_printf("%.*Rf\n", digits_after_decimal, value);
+
+    // value = z * 2^e with z odd, then the exponent is aligned to whole
+    // digits: value = z * base^q
+    mpz_t z;
+    mpz_init(z);
+    mpfr_exp_t e = mpfr_get_z_2exp(z, value);
+    mpz_abs(z, z);
+    mp_bitcnt_t zeros = mpz_scan1(z, 0);
+    mpz_tdiv_q_2exp(z, z, zeros);
+    e += zeros;
+    mpfr_exp_t shift = ((e % bits) + bits) % bits;
+    mpz_mul_2exp(z, z, shift);
+    e -= shift;
+    int64_t q = e / bits;
+    uint64_t count = (mpz_sizeinbase(z, 2) + bits - 1) / bits;
+
+    // Positional while the padding zeros stay few, otherwise d.ddd with a
+    // binary exponent like C's %a
+    bool positional = q >= 0 ? q <= BASE_PRINT_PAD_DIGITS
+                             : (uint64_t)-q <= count + BASE_PRINT_PAD_DIGITS;
+    char* text = malloc(count + BASE_PRINT_PAD_DIGITS + 48);
+    CHECK_NULL(text, {
+        mpz_clear(z);
+        ERROR_PRINT("Failed to allocate %llu digits\n", (unsigned long long)count);
+        return;
+    });
+    char* out = text;
+    if (positional && q >= 0) {
+        out = put_limb_digits(out, z, count, bits);
+        memset(out, '0', q);
+        out += q;
+    } else if (positional && (uint64_t)-q < count) {
+        out = put_limb_digits(out, z, count, bits);
+        memmove(out + q + 1, out + q, -q);
+        out[q] = '.';
+        out++;
+    } else if (positional) {
+        *out++ = '0';
+        *out++ = '.';
+        memset(out, '0', -q - count);
+        out += -q - count;
+        out = put_limb_digits(out, z, count, bits);
+    } else {
+        char* first = out;
+        out = put_limb_digits(out + 1, z, count, bits);
+        first[0] = first[1];
+        first[1] = '.';
+        if (count == 1) out--;
+        out += sprintf(out, "p%+lld", (long long)(q + (int64_t)count - 1) * bits);
+    }
+    *out = '\0';
+
+    fprintf(print_output(), "%s%s%s", sign, prefix, text);
+    free(text);
+    mpz_clear(z);
+}
+
+// Significant digits shown for a value 0.d1d2... x 10^exponent: 11 in
+// scientific notation, otherwise down to 10 decimals and 10 digits in total.
+static inline int friendly_digits(mpfr_exp_t exponent) {
+    if (exponent < -3 || exponent > 6) return 11;
+    return exponent > 0 ? 10 : 10 + (int)exponent;
+}
+
+int format_friendly_mpfr(char* buffer, size_t size, mpfr_t value) {
+    if (mpfr_nan_p(value)) return snprintf(buffer, size, "NaN");
+    if (mpfr_inf_p(value)) return snprintf(buffer, size, "%sInfinity", mpfr_signbit(value) ? "-" : "");
+    const char* sign = mpfr_signbit(value) ? "-" : "";
+    if (mpfr_zero_p(value)) return snprintf(buffer, size, "%s0.0000000000", sign);
+
+    // The decimal exponent follows from the binary one up to an off-by-one and
+    // a carry when rounding, the digits are converted again only in that case
+    char digits[FRIENDLY_MPFR_DIGITS + 2];
+    mpfr_exp_t exponent = (mpfr_exp_t)floor((mpfr_get_exp(value) - 1) * 0.30102999566398120) + 1;
+    int n = friendly_digits(exponent);
+    mpfr_get_str(digits, &exponent, 10, n, value, MPFR_RNDN);
+    if (friendly_digits(exponent) != n) {
+        mpfr_exp_t first = exponent;
+        n = friendly_digits(first);
+        mpfr_get_str(digits, &exponent, 10, n, value, MPFR_RNDN);
+        if (friendly_digits(exponent) != n) {
+            // Only one of the two carried into the next decade: the value rounds
+            // to that power of ten, shown with the digits of its own layout
+            if (first > exponent) exponent = first;
+            n = friendly_digits(exponent);
+            char* carry = digits + (digits[0] == '-');
+            carry[0] = '1';
+            memset(carry + 1, '0', n - 1);
+            carry[n] = '\0';
         }
-        mpfr_free_str(str);
+    }
+    const char* d = digits + (digits[0] == '-');
+
+    if (exponent < -3 || exponent > 6) {
+        long shown = (long)exponent - 1;
+        return snprintf(buffer, size, "%s%c.%se%c%02ld", sign, d[0], d + 1,
+                        shown < 0 ? '-' : '+', shown < 0 ? -shown : shown);
+    }
+    if (exponent > 0) return snprintf(buffer, size, "%s%.*s.%s", sign, (int)exponent, d, d + exponent);
+    return snprintf(buffer, size, "%s0.%.*s%s", sign, (int)-exponent, "000", d);
+}
+
+// Digits leave in chunks of DUMP_CHUNK_DIGITS, the only string ever held
+typedef struct DigitStream{
+    FILE* out;
+    mpz_t* powers; // powers[i] = 10^(DUMP_CHUNK_DIGITS * 2^i)
+    uint64_t written;
+    uint64_t point; // the '.' goes after this many digits
+    char chunk[DUMP_CHUNK_DIGITS + 2];
+} DigitStream;
+
+static void stream_put(DigitStream* s, const char* digits, uint64_t len) {
+    if (s->point > s->written && s->point < s->written + len) {
+        uint64_t head = s->point - s->written;
+        fwrite(digits, 1, head, s->out);
+        fputc('.', s->out);
+        fwrite(digits + head, 1, len - head, s->out);
+    } else {
+        fwrite(digits, 1, len, s->out);
+    }
+    s->written += len;
+}
+
+// Writes m < 10^digits as exactly 'digits' digits: the high half first, then
+// the low half zero-padded, split at a power of ten kept for the whole stream.
+static void stream_digits(DigitStream* s, const mpz_t m, uint64_t digits) {
+    if (digits <= DUMP_CHUNK_DIGITS) {
+        static char zeros[DUMP_CHUNK_DIGITS];
+        if (!zeros[0]) memset(zeros, '0', sizeof(zeros));
+        mpz_get_str(s->chunk, 10, m);
+        uint64_t len = strlen(s->chunk);
+        if (len < digits) stream_put(s, zeros, digits - len);
+        stream_put(s, s->chunk, len);
+        return;
+    }
+
+    uint32_t level = 0;
+    while (((uint64_t)DUMP_CHUNK_DIGITS << (level + 1)) < digits) level++;
+    uint64_t low = (uint64_t)DUMP_CHUNK_DIGITS << level;
+    mpz_t high, rest;
+    mpz_init(high);
+    mpz_init(rest);
+    mpz_tdiv_qr(high, rest, m, s->powers[level]);
+    stream_digits(s, high, digits - low);
+    mpz_clear(high);
+    stream_digits(s, rest, low);
+    mpz_clear(rest);
+}
+
+// m = round(|value| * 10^(digits - exponent)) exactly: value = z * 2^e is a
+// ratio of integers once the powers of 2 and 10 go to the right side.
+static void scaled_digits(mpz_t m, const mpz_t z, mpfr_exp_t e, int64_t shift) {
+    mpz_t den;
+    mpz_init_set_ui(den, 1);
+    mpz_set(m, z);
+    if (shift >= 0) {
+        mpz_ui_pow_ui(den, 10, shift);
+        mpz_mul(m, m, den);
+        mpz_set_ui(den, 1);
     } else {
-        mpfr_printf("%Rf\n", value);
+        mpz_ui_pow_ui(den, 10, -shift);
     }
+    if (e >= 0) mpz_mul_2exp(m, m, e);
+    else mpz_mul_2exp(den, den, -e);
+
+    // m / den to nearest, ties to even like MPFR
+    mpz_t r;
+    mpz_init(r);
+    mpz_fdiv_qr(m, r, m, den);
+    mpz_mul_2exp(r, r, 1);
+    int half = mpz_cmp(r, den);
+    if (half > 0 || (half == 0 && mpz_odd_p(m))) mpz_add_ui(m, m, 1);
+    mpz_clear(r);
+    mpz_clear(den);
+}
+
+bool write_mpfr_digits(FILE* out, mpfr_t value, uint64_t digits) {
+    CHECK_NULL(out, ERROR_RETURN(false, "Output stream is NULL"));
+    if (!mpfr_number_p(value) || mpfr_zero_p(value)) {
+        char buffer[FRIENDLY_MPFR_SIZE];
+        format_friendly_mpfr(buffer, sizeof(buffer), value);
+        fprintf(out, "%s\n", buffer);
+        return true;
+    }
+    if (digits == 0) ERROR_RETURN(false, "At least one digit is needed\n");
+
+    mpz_t z, m, limit;
+    mpz_inits(z, m, limit, NULL);
+    mpfr_exp_t e = mpfr_get_z_2exp(z, value);
+    mpz_abs(z, z);
+    mpz_ui_pow_ui(limit, 10, digits);
+
+    // The estimate from the binary exponent is the decimal one or one less,
+    // a carry when rounding can add one more
+    int64_t exponent = (int64_t)floor((mpfr_get_exp(value) - 1) * 0.30102999566398120) + 1;
+    for (int attempt = 0; attempt < 3; attempt++) {
+        scaled_digits(m, z, e, (int64_t)digits - exponent);
+        if (mpz_cmp(m, limit) < 0) break;
+        exponent++;
+    }
+
+    // The powers of ten the split needs, up to about half the digits
+    uint32_t levels = 1;
+    while (((uint64_t)DUMP_CHUNK_DIGITS << levels) < digits) levels++;
+    DigitStream stream = { .out = out, .written = 0 };
+    stream.powers = malloc(levels * sizeof(mpz_t));
+    CHECK_NULL(stream.powers, {
+        mpz_clears(z, m, limit, NULL);
+        ERROR_RETURN(false, "Failed to allocate the digit stream\n");
+    });
+    mpz_init(stream.powers[0]);
+    mpz_ui_pow_ui(stream.powers[0], 10, DUMP_CHUNK_DIGITS);
+    for (uint32_t i = 1; i < levels; i++) {
+        mpz_init(stream.powers[i]);
+        mpz_mul(stream.powers[i], stream.powers[i - 1], stream.powers[i - 1]);
+    }
+    mpz_clears(z, limit, NULL);
+
+    // Positional unless there would be many leading zeros or the integer part
+    // is longer than the digits, then d.ddd...e+x
+    bool positional = exponent > -DUMP_LEADING_ZEROS && exponent <= (int64_t)digits;
+    if (mpfr_signbit(value)) fputc('-', out);
+    if (positional && exponent <= 0) {
+        fputs("0.", out);
+        for (int64_t i = exponent; i < 0; i++) fputc('0', out);
+    }
+    stream.point = positional ? (exponent > 0 ? (uint64_t)exponent : 0) : 1;
+    stream_digits(&stream, m, digits);
+    if (!positional) fprintf(out, "e%+lld", (long long)(exponent - 1));
+    fputc('\n', out);
+
+    for (uint32_t i = 0; i < levels; i++) mpz_clear(stream.powers[i]);
+    free(stream.powers);
+    mpz_clear(m);
+    return !ferror(out);
 }
 
 void symbol_table_show(SymbolTable* symTable){
@@ -361,14 +890,12 @@ void symbol_table_show(SymbolTable* symTable){
     CHECK_NULL(symTable->buckets, return;);
 
     printf("=== === === Variables === === ===\n");
-    for(uint16_t i = 0; i<symTable->capacity ;i++){
-        if(symTable->buckets[i]){
-            Symbol* sym = symTable->buckets[i];
-            while (sym) {
-                printf("-- %s : ",sym->name);            
-                print_friendly_mpfr(sym->num, NULL);
-                sym = sym->next;
-            }
+    for (SymbolChunk* chunk = symTable->chunks; chunk; chunk = chunk->next) {
+        for (uint32_t i = 0; i < chunk->used; i++) {
+            Symbol* sym = &chunk->symbols[i];
+            printf("-- %s : ",sym->name);            
+            if (sym->array) array_print(sym->array, NULL);
+            else print_friendly_mpfr(sym->num, NULL);
         }
     }
     printf("==== === === === === === === ====\n");
@@ -383,21 +910,32 @@ void symbol_table_empty(SymbolTable* symTable){
     DEBUG_PRINT("Destroying symbol table - Capacity: %d, Count: %d\n", 
                 symTable->capacity, symTable->count);
     
-    uint16_t symbols_freed = 0;
-    for (uint16_t i = 0; i < symTable->capacity; i++) {
-        if (symTable->buckets[i]) {
-            Symbol* current = symTable->buckets[i];
-            while (current) {
-                Symbol* next = current->next;
-                DEBUG_PRINT("Freeing symbol: '%s' (bucket %d)\n", current->name, i);
-                mpfr_clear(current->num);
-                free(current->name);
-                free(current);
-                current = next;
-                symbols_freed++;
-            }
+    // Values own their vectors, the symbols, names and limbs go with their chunks
+    uint32_t symbols_freed = 0;
+    SymbolChunk* chunk = symTable->chunks;
+    while (chunk) {
+        SymbolChunk* next = chunk->next;
+        for (uint32_t i = 0; i < chunk->used; i++) {
+            array_release(chunk->symbols[i].array);
         }
+        symbols_freed += chunk->used;
+        free(chunk);
+        chunk = next;
+    }
+    while (symTable->names) {
+        NameChunk* next = symTable->names->next;
+        free(symTable->names);
+        symTable->names = next;
+    }
+    while (symTable->limbs) {
+        LimbChunk* next = symTable->limbs->next;
+        free(symTable->limbs);
+        symTable->limbs = next;
     }
+    memset(symTable->buckets, 0, symTable->capacity * sizeof(Symbol*));
+    symTable->chunks = symTable->last_chunk = NULL;
+    symTable->count = 0;
+    symTable->array_count = 0;
 
     DEBUG_PRINT("Symbol table destroyed. Freed %d symbols\n", symbols_freed);
     DEBUG_FUNCTION_EXIT();
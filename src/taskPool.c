@@ -0,0 +1,165 @@
+#include "taskPool.h"
+#include "debug.h"
+#include <mpfr.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+uint32_t task_pool_cpu_count() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (uint32_t)cpus : 1;
+}
+
+static inline void run_task(TaskPool* pool, uint32_t worker, Task* task) {
+    atomic_store(&task->state, TASK_RUNNING);
+    task->run(task, pool->contexts[worker]);
+    atomic_store_explicit(&task->state, TASK_DONE, memory_order_release);
+}
+
+// Takes the oldest task of another worker, starting after 'worker'.
+static Task* steal(TaskPool* pool, uint32_t worker) {
+    for (uint32_t k = 1; k <= pool->workers; k++) {
+        TaskDeque* deque = &pool->deques[(worker + k) % pool->workers];
+        Task* task = NULL;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->top != deque->bottom) {
+            task = deque->items[deque->top % TASK_DEQUE_SIZE];
+            deque->top++;
+        }
+        pthread_mutex_unlock(&deque->lock);
+        if (task) {
+            atomic_fetch_sub(&pool->pending, 1);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void* worker_main(void* arg) {
+    TaskWorker* args = arg;
+    TaskPool* pool = args->pool;
+
+    while (!atomic_load(&pool->stop)) {
+        Task* task = steal(pool, args->index);
+        if (task) {
+            run_task(pool, args->index, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->idle_lock);
+        while (!atomic_load(&pool->pending) && !atomic_load(&pool->stop)) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+
+    // MPFR keeps per-thread constant caches
+    mpfr_free_cache2(MPFR_FREE_LOCAL_CACHE);
+    return NULL;
+}
+
+TaskPool* task_pool_create(uint32_t workers, void** contexts) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(contexts, ERROR_RETURN_NULL("Worker contexts are NULL"));
+    if (workers < 2 || workers > TASK_POOL_MAX_WORKERS) {
+        ERROR_RETURN_NULL("A task pool needs 2 to %d workers, got %u\n", TASK_POOL_MAX_WORKERS, workers);
+    }
+
+    TaskPool* pool = calloc(1, sizeof(TaskPool));
+    CHECK_NULL(pool, ERROR_RETURN_NULL("Failed to allocate task pool"));
+    pool->deques = calloc(workers, sizeof(TaskDeque));
+    pool->threads = calloc(workers, sizeof(TaskWorker));
+    if (!pool->deques || !pool->threads) {
+        free(pool->deques);
+        free(pool->threads);
+        free(pool);
+        ERROR_RETURN_NULL("Failed to allocate task deques");
+    }
+
+    pool->contexts = contexts;
+    pool->workers = workers;
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->stop, false);
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    for (uint32_t i = 0; i < workers; i++) pthread_mutex_init(&pool->deques[i].lock, NULL);
+
+    for (uint32_t i = 1; i < workers; i++) {
+        pool->threads[i].pool = pool;
+        pool->threads[i].index = i;
+        if (pthread_create(&pool->threads[i].thread, NULL, worker_main, &pool->threads[i]) != 0) {
+            ERROR_PRINT("Failed to start worker %u, running with %u\n", i, i);
+            pool->workers = i;
+            break;
+        }
+    }
+
+    DEBUG_PRINT("Task pool started: %u workers\n", pool->workers);
+    DEBUG_FUNCTION_EXIT();
+    return pool;
+}
+
+void task_pool_destroy(TaskPool* pool) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(pool, return);
+
+    pthread_mutex_lock(&pool->idle_lock);
+    atomic_store(&pool->stop, true);
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    for (uint32_t i = 1; i < pool->workers; i++) pthread_join(pool->threads[i].thread, NULL);
+    for (uint32_t i = 0; i < pool->workers; i++) pthread_mutex_destroy(&pool->deques[i].lock);
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+
+    DEBUG_FUNCTION_EXIT();
+}
+
+bool task_pool_push(TaskPool* pool, uint32_t worker, Task* task) {
+    TaskDeque* deque = &pool->deques[worker];
+    atomic_init(&task->state, TASK_QUEUED);
+
+    pthread_mutex_lock(&deque->lock);
+    bool room = deque->bottom - deque->top < TASK_DEQUE_SIZE;
+    if (room) deque->items[deque->bottom++ % TASK_DEQUE_SIZE] = task;
+    pthread_mutex_unlock(&deque->lock);
+    if (!room) return false;
+
+    atomic_fetch_add(&pool->pending, 1);
+    pthread_mutex_lock(&pool->idle_lock);
+    pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+    return true;
+}
+
+void task_pool_sync(TaskPool* pool, uint32_t worker, Task* task) {
+    // Tasks pushed after this one were synced already, so it is at the bottom unless stolen
+    TaskDeque* deque = &pool->deques[worker];
+    bool own = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top && deque->items[(deque->bottom - 1) % TASK_DEQUE_SIZE] == task) {
+        deque->bottom--;
+        own = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    if (own) {
+        atomic_fetch_sub(&pool->pending, 1);
+        run_task(pool, worker, task);
+        return;
+    }
+
+    while (atomic_load_explicit(&task->state, memory_order_acquire) != TASK_DONE) {
+        Task* other = steal(pool, worker);
+        if (other) run_task(pool, worker, other);
+        else sched_yield();
+    }
+}
@@ -0,0 +1,124 @@
+#include "trace.h"
+#include "stats.h"
+#include "debug.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct TraceChunk{
+    struct TraceChunk* next;
+    uint32_t count;
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+} TraceChunk;
+
+// One trace per process, workers append under the lock
+static struct {
+    FILE* file;
+    const char* path;
+    TraceChunk* first;
+    TraceChunk* last;
+    uint64_t origin; // stats_now() at trace_start(), the JSON counts from there
+    uint32_t count, dropped;
+    uint32_t threads; // highest thread id seen + 1
+    pthread_mutex_t lock;
+} trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+bool trace_start(const char* path) {
+    DEBUG_FUNCTION_ENTER();
+    CHECK_NULL(path, ERROR_RETURN(false, "Trace path is NULL"));
+    if (trace.file) ERROR_RETURN(false, "A trace is already being recorded\n");
+
+    trace.file = fopen(path, "w");
+    CHECK_NULL(trace.file, ERROR_RETURN(false, "Cannot open trace file '%s'\n", path));
+    trace.path = path;
+    trace.origin = stats_now();
+    trace.threads = 1;
+
+    DEBUG_PRINT("Tracing to %s\n", path);
+    DEBUG_FUNCTION_EXIT();
+    return true;
+}
+
+bool trace_enabled() {
+    return trace.file != NULL;
+}
+
+void trace_event(const char* name, const char* category, uint64_t start, uint64_t end,
+                 uint32_t thread, const char* arg_name, int64_t arg) {
+    pthread_mutex_lock(&trace.lock);
+    if (!trace.file || trace.count >= TRACE_MAX_EVENTS) {
+        trace.dropped += trace.file != NULL;
+        pthread_mutex_unlock(&trace.lock);
+        return;
+    }
+    TraceChunk* chunk = trace.last;
+    if (!chunk || chunk->count == TRACE_CHUNK_EVENTS) {
+        chunk = malloc(sizeof(TraceChunk));
+        if (!chunk) {
+            trace.dropped++;
+            pthread_mutex_unlock(&trace.lock);
+            return;
+        }
+        chunk->next = NULL;
+        chunk->count = 0;
+        if (trace.last) trace.last->next = chunk;
+        else trace.first = chunk;
+        trace.last = chunk;
+    }
+    chunk->events[chunk->count++] = (TraceEvent){
+        .name = name, .category = category, .arg_name = arg_name, .arg = arg,
+        .start = start, .duration = end - start, .thread = thread
+    };
+    trace.count++;
+    if (thread >= trace.threads) trace.threads = thread + 1;
+    pthread_mutex_unlock(&trace.lock);
+}
+
+bool trace_finish() {
+    DEBUG_FUNCTION_ENTER();
+    if (!trace.file) return true;
+
+    FILE* f = trace.file;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"calc\"}}");
+    for (uint32_t t = 0; t < trace.threads; t++) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+                t, t ? "worker" : "session", t);
+    }
+
+    // Timestamps are microseconds, three decimals keep the nanoseconds
+    for (TraceChunk* chunk = trace.first; chunk; chunk = chunk->next) {
+        for (uint32_t i = 0; i < chunk->count; i++) {
+            const TraceEvent* e = &chunk->events[i];
+            uint64_t ts = e->start - trace.origin;
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                       "\"ts\":%llu.%03u,\"dur\":%llu.%03u",
+                    e->name, e->category, e->thread,
+                    (unsigned long long)(ts / 1000), (unsigned)(ts % 1000),
+                    (unsigned long long)(e->duration / 1000), (unsigned)(e->duration % 1000));
+            if (e->arg_name) fprintf(f, ",\"args\":{\"%s\":%lld}", e->arg_name, (long long)e->arg);
+            fputc('}', f);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    bool ok = !ferror(f);
+    ok &= fclose(f) == 0;
+    if (!ok) ERROR_PRINT("Failed to write trace file '%s'\n", trace.path);
+    if (trace.dropped) {
+        WARNING_PRINT("Trace kept the first %u events, %u more were dropped\n", trace.count, trace.dropped);
+    }
+
+    while (trace.first) {
+        TraceChunk* next = trace.first->next;
+        free(trace.first);
+        trace.first = next;
+    }
+    trace.file = NULL;
+    trace.last = NULL;
+    trace.count = trace.dropped = 0;
+
+    DEBUG_FUNCTION_EXIT();
+    return ok;
+}